@@ -118,6 +118,50 @@ IOWorkLoop* IntelWifi::getWorkLoop() const {
     return fWorkLoop;
 }
 
+/**
+ * Frames of the network stack are sent from the work loop, the same as the
+ * TX status notifications that free room on the queues.
+ */
+IOOutputQueue* IntelWifi::createOutputQueue() {
+    if (!fOutputQueue) {
+        fOutputQueue = IOGatedOutputQueue::withTarget(this, getWorkLoop());
+        /* the controller releases the queue it is given, we keep our own reference */
+        if (fOutputQueue)
+            fOutputQueue->retain();
+    }
+    return fOutputQueue;
+}
+
+IOOutputQueue* IntelWifi::getOutputQueue() const {
+    return fOutputQueue;
+}
+
+UInt32 IntelWifi::outputPacket(mbuf_t m, void *param) {
+    int ret;
+    
+    if (!hw || !fTrans || !fTrans->intf) {
+        freePacket(m);
+        return kIOReturnOutputDropped;
+    }
+    
+    /* the output queue knows whether more frames follow this one */
+    ret = opmode->tx((struct iwl_priv *)hw->priv, &m, fOutputQueue->getSize() > 0);
+    if (ret == -EBUSY)
+        return kIOReturnOutputStall;
+    
+    if (ret) {
+        if (m)
+            freePacket(m);
+        if (fNetworkStats)
+            fNetworkStats->outputErrors++;
+        return kIOReturnOutputDropped;
+    }
+    
+    if (fNetworkStats)
+        fNetworkStats->outputPackets++;
+    return kIOReturnOutputSuccess;
+}
+
 bool IntelWifi::start(IOService *provider) {
     TraceLog("Driver start");
     
@@ -127,26 +171,32 @@ bool IntelWifi::start(IOService *provider) {
         return false;
     }
     
-    int source = findMSIInterruptTypeIndex();
+    /* the transport picks MSI or MSI-X from the vector count, see iwl_pcie_set_interrupt_capa() */
+    fMsiIndex = findMSIInterruptTypeIndex();
+#ifdef CONFIG_IWLMVM
+    fMsiVectors = countMSIVectors(fMsiIndex);
+#else
+    fMsiVectors = 1;
+#endif
     fIrqLoop = IO80211WorkLoop::workLoop();
-    fInterruptSource = IOFilterInterruptEventSource::filterInterruptEventSource(this,
-                                                                                (IOInterruptEventAction) &IntelWifi::interruptOccured,
-                                                                                (IOFilterInterruptAction) &IntelWifi::interruptFilter,
-                                                                                pciDevice, source);
-    if (!fInterruptSource) {
-        TraceLog("InterruptSource init failed!");
+    
+    fRxPollSource = IOInterruptEventSource::interruptEventSource(this,
+                                                                 (IOInterruptEventAction) &IntelWifi::rxPollOccured);
+    if (!fRxPollSource || fIrqLoop->addEventSource(fRxPollSource) != kIOReturnSuccess) {
+        TraceLog("RX poll registration failed");
         releaseAll();
-        return 0;
+        return false;
     }
+    fRxPollSource->enable();
     
-    if (fIrqLoop->addEventSource(fInterruptSource) != kIOReturnSuccess) {
-        TraceLog("EventSource registration failed");
+    /* serialized with the interrupt handler that updates the statistics */
+    fIntModTimer = IOTimerEventSource::timerEventSource(this, &IntelWifi::intModOccured);
+    if (!fIntModTimer || fIrqLoop->addEventSource(fIntModTimer) != kIOReturnSuccess) {
+        TraceLog("Interrupt moderation timer registration failed");
         releaseAll();
-        return 0;
+        return false;
     }
     
-    fInterruptSource->enable();
-    
     gate = IOCommandGate::commandGate(this, (IOCommandGate::Action)&IntelWifi::gateAction);
     
     if (fWorkLoop->addEventSource(gate) != kIOReturnSuccess) {
@@ -156,15 +206,60 @@ bool IntelWifi::start(IOService *provider) {
     }
     gate->enable();
     
+    fTxWatchdog = IOTimerEventSource::timerEventSource(this, &IntelWifi::txWatchdogOccured);
+    if (!fTxWatchdog || fWorkLoop->addEventSource(fTxWatchdog) != kIOReturnSuccess) {
+        TraceLog("TX watchdog registration failed");
+        releaseAll();
+        return false;
+    }
+    
+    /* RX pages are allocated on a work loop of their own, off the interrupt path */
+    fRxAllocLoop = IOWorkLoop::workLoop();
+    fRxAllocSource = IOInterruptEventSource::interruptEventSource(this,
+                                                                  (IOInterruptEventAction) &IntelWifi::rxAllocOccured);
+    if (!fRxAllocLoop || !fRxAllocSource || fRxAllocLoop->addEventSource(fRxAllocSource) != kIOReturnSuccess) {
+        TraceLog("RX allocator registration failed");
+        releaseAll();
+        return false;
+    }
+    fRxAllocSource->enable();
+    
     fTrans = iwl_trans_pcie_alloc(fConfiguration);
     if (!fTrans) {
         TraceLog("iwl_trans_pcie_alloc failed");
         releaseAll();
         return false;
     }
-    fTrans->mbuf_cursor = IOMbufNaturalMemoryCursor::withSpecification(PAGE_SIZE, 1);
+    fTrans->tx_mbuf_cursor = IOMbufNaturalMemoryCursor::withSpecification(IWL_TX_SEG_MAX_SIZE, IWL_TFH_NUM_TBS);
     fTrans->dev = this;
     fTrans->gate = gate;
+    IWL_TRANS_GET_PCIE_TRANS(fTrans)->rba.alloc_wq = fRxAllocSource;
+    IWL_TRANS_GET_PCIE_TRANS(fTrans)->rx_poll_src = fRxPollSource;
+    
+    if (IWL_TRANS_GET_PCIE_TRANS(fTrans)->msix_enabled) {
+        if (!registerMsixVectors()) {
+            releaseAll();
+            return false;
+        }
+    } else {
+        fInterruptSource = IOFilterInterruptEventSource::filterInterruptEventSource(this,
+                                                                                    (IOInterruptEventAction) &IntelWifi::interruptOccured,
+                                                                                    (IOFilterInterruptAction) &IntelWifi::interruptFilter,
+                                                                                    pciDevice, fMsiIndex);
+        if (!fInterruptSource) {
+            TraceLog("InterruptSource init failed!");
+            releaseAll();
+            return 0;
+        }
+        
+        if (fIrqLoop->addEventSource(fInterruptSource) != kIOReturnSuccess) {
+            TraceLog("EventSource registration failed");
+            releaseAll();
+            return 0;
+        }
+        
+        fInterruptSource->enable();
+    }
     
 #ifdef CONFIG_IWLMVM
     const struct iwl_cfg *cfg_7265d = NULL;
@@ -257,18 +352,53 @@ bool IntelWifi::start(IOService *provider) {
 
     registerService();
     
+    fTxWatchdog->setTimeoutMS(IWL_TXQ_WATCHDOG_INTERVAL_MS);
+    fIntModTimer->setTimeoutMS(IWL_INT_MOD_INTERVAL_MS);
+    
     return true;
 }
 
 void IntelWifi::stop(IOService *provider) {
     
+    if (fOutputQueue) {
+        fOutputQueue->stop();
+        fOutputQueue->flush();
+    }
+    
     if (fWorkLoop) {
+        if (fTxWatchdog) {
+            fTxWatchdog->cancelTimeout();
+            fWorkLoop->removeEventSource(fTxWatchdog);
+        }
         if (fInterruptSource) {
             fInterruptSource->disable();
             fWorkLoop->removeEventSource(fInterruptSource);
         }
     }
     
+    if (fIrqLoop && fRxPollSource) {
+        fRxPollSource->disable();
+        fIrqLoop->removeEventSource(fRxPollSource);
+    }
+    
+    for (int i = 0; i < IWL_MAX_RX_HW_QUEUES; i++) {
+        if (fMsixLoops[i] && fMsixSources[i]) {
+            fMsixSources[i]->disable();
+            fMsixLoops[i]->removeEventSource(fMsixSources[i]);
+        }
+    }
+    
+    if (fIrqLoop && fIntModTimer) {
+        fIntModTimer->cancelTimeout();
+        fIrqLoop->removeEventSource(fIntModTimer);
+    }
+    
+    /* waits for a running allocation, like cancel_work_sync() */
+    if (fRxAllocLoop && fRxAllocSource) {
+        fRxAllocSource->disable();
+        fRxAllocLoop->removeEventSource(fRxAllocSource);
+    }
+    
     struct iwl_priv *priv = (struct iwl_priv *)hw->priv;
 
     opmode->stop(priv);
@@ -295,12 +425,18 @@ IOReturn IntelWifi::enable(IONetworkInterface *netif) {
     IONetworkMedium *medium = IONetworkMedium::getMediumWithType(mediumDict, mediumType);
     setLinkStatus(kIONetworkLinkActive | kIONetworkLinkValid, medium);
     fTrans->intf = netif;
+    if (fOutputQueue)
+        fOutputQueue->start();
     
     return kIOReturnSuccess;
 }
 
 IOReturn IntelWifi::disable(IONetworkInterface *netif) {
     TraceLog("disable");
+    if (fOutputQueue) {
+        fOutputQueue->stop();
+        fOutputQueue->flush();
+    }
     fTrans->intf = NULL;
     return kIOReturnSuccess;
 }
@@ -322,6 +458,19 @@ IOReturn IntelWifi::setMulticastMode(bool active) {
     return kIOReturnSuccess;
 }
 
+/*
+ * The TCP/IP stack may leave IPv4, TCP and UDP checksums of outgoing packets
+ * to us, the transport computes them while building the TFD since the
+ * hardware can't (see iwl_pcie_tx_csum()). Nothing is offloaded on receive.
+ */
+IOReturn IntelWifi::getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput) {
+    if (checksumFamily != kChecksumFamilyTCPIP)
+        return kIOReturnUnsupported;
+    
+    *checksumMask = isOutput ? (kChecksumIP | kChecksumTCP | kChecksumUDP) : 0;
+    return kIOReturnSuccess;
+}
+
 bool IntelWifi::configureInterface(IONetworkInterface *netif) {
     TraceLog("Configure interface");
     if (!super::configureInterface(netif)) {
@@ -367,6 +516,39 @@ bool IntelWifi::interruptFilter(OSObject* owner, IOFilterInterruptEventSource *
     return true;
 }
 
+/**
+ * MSI-X filter. The hardware masks a vector when it fires (automask) and the
+ * handler unmasks it, so there is nothing to do in primary interrupt context.
+ */
+bool IntelWifi::msixInterruptFilter(OSObject* owner, IOFilterInterruptEventSource * src) {
+    return true;
+}
+
+/**
+ * MSI-X vector handler. The default vector serves the non RX causes, every
+ * other vector one RX queue on its own work loop.
+ */
+void IntelWifi::msixInterruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count) {
+    IntelWifi* me = (IntelWifi*)owner;
+    struct iwl_trans_pcie *trans_pcie;
+    
+    if (me == 0 || !me->fTrans) {
+        return;
+    }
+    
+    trans_pcie = IWL_TRANS_GET_PCIE_TRANS(me->fTrans);
+    for (int i = 0; i < trans_pcie->alloc_vecs; i++) {
+        if (me->fMsixSources[i] != sender)
+            continue;
+        
+        /* budget used up, the vector stays masked until the next pass */
+        if (i == trans_pcie->def_irq ? me->iwl_pcie_irq_msix_handler(me->fTrans, i) :
+            me->iwl_pcie_irq_rx_msix_handler(me->fTrans, i))
+            me->fMsixSources[i]->signalInterrupt();
+        return;
+    }
+}
+
 void IntelWifi::interruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count) {
     IntelWifi* me = (IntelWifi*)owner;
     
@@ -377,10 +559,85 @@ void IntelWifi::interruptOccured(OSObject* owner, IOInterruptEventSource* sender
     me->iwl_pcie_irq_handler(0, me->fTrans);
 }
 
+/**
+ * One pass of the TX queue stuck watchdog. A stuck queue is reported to the
+ * op mode as a firmware error, which restarts the device.
+ */
+void IntelWifi::txWatchdogOccured(OSObject* owner, IOTimerEventSource* sender) {
+    IntelWifi* me = (IntelWifi*)owner;
+    
+    if (me == 0 || !me->fTrans) {
+        return;
+    }
+    
+    if (iwl_pcie_txq_check_stuck(me->fTrans)) {
+        /* prevent double restarts due to the same erroneous FW */
+        if (!test_and_set_bit(STATUS_FW_ERROR, &me->fTrans->status))
+            me->opmode->nic_error((struct iwl_priv *)me->hw->priv);
+    }
+    
+    sender->setTimeoutMS(IWL_TXQ_WATCHDOG_INTERVAL_MS);
+}
+
+/**
+ * Periodic sample of the interrupt load that retunes the coalescing timer.
+ */
+void IntelWifi::intModOccured(OSObject* owner, IOTimerEventSource* sender) {
+    IntelWifi* me = (IntelWifi*)owner;
+    
+    if (me == 0 || !me->fTrans) {
+        return;
+    }
+    
+    iwl_pcie_int_moderation(me->fTrans, IWL_INT_MOD_INTERVAL_MS);
+    
+    sender->setTimeoutMS(IWL_INT_MOD_INTERVAL_MS);
+}
+
 IO80211Interface *IntelWifi::getNetworkInterface() {
     return netif;
 }
 
+void IntelWifi::getTxStatistics(struct iwl_client_tx_stats *stats) {
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(fTrans);
+    
+    stats->packets = trans_pcie->tx_stats.packets;
+    stats->doorbells = trans_pcie->tx_stats.doorbells;
+    stats->deferred = trans_pcie->tx_stats.deferred;
+    stats->amsdus = trans_pcie->tx_stats.amsdus;
+    stats->amsdu_subframes = trans_pcie->tx_stats.amsdu_subframes;
+    stats->reclaimed = trans_pcie->tx_stats.reclaimed;
+    stats->reclaims = trans_pcie->tx_stats.reclaims;
+    stats->overflowed = trans_pcie->tx_stats.overflowed;
+    stats->overflow_drops = trans_pcie->tx_stats.overflow_drops;
+    stats->overflow_max_depth = trans_pcie->tx_stats.overflow_max_depth;
+}
+
+void IntelWifi::getTxQueueStatistics(struct iwl_client_txq_stats *stats) {
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(fTrans);
+    int txq_id;
+    
+    stats->n_queues = 0;
+    
+    for (txq_id = 0; txq_id < IWL_CLIENT_MAX_TXQS; txq_id++) {
+        struct iwl_txq *txq = trans_pcie->txq[txq_id];
+        
+        if (txq_id == trans_pcie->cmd_queue || !txq ||
+            !test_bit(txq_id, trans_pcie->queue_used))
+            continue;
+        
+        IOSimpleLockLock(txq->lock);
+        stats->queues[stats->n_queues].id = txq_id;
+        stats->queues[stats->n_queues].used = (txq->write_ptr - txq->read_ptr) & (TFD_QUEUE_SIZE_MAX - 1);
+        stats->queues[stats->n_queues].bql_limit = txq->bql.limit;
+        stats->queues[stats->n_queues].bql_inflight = iwl_txq_bql_inflight(&txq->bql);
+        stats->queues[stats->n_queues].overflow_depth = iwl_txq_overflow_depth(&txq->overflow_q);
+        IOSimpleLockUnlock(txq->lock);
+        
+        stats->n_queues++;
+    }
+}
+
 const OSString* IntelWifi::newVendorString() const {
     return OSString::withCString("Intel");
 }
@@ -438,11 +695,78 @@ int IntelWifi::findMSIInterruptTypeIndex() {
     return source;
 }
 
+/**
+ * Number of consecutive message signaled interrupt indices from @first.
+ * With MSI-X every vector of the device is published as one of them.
+ */
+int IntelWifi::countMSIVectors(int first) {
+    int index, count = 0;
+    
+    for (index = first; ; index++) {
+        int interruptType;
+        if (pciDevice->getInterruptType(index, &interruptType) != kIOReturnSuccess)
+            break;
+        if (!(interruptType & kIOInterruptTypePCIMessaged))
+            break;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * One filter event source per MSI-X vector. The default vector runs on the
+ * interrupt work loop, every RX vector gets a work loop of its own so the
+ * queues are serviced in parallel and not behind the non RX causes.
+ */
+bool IntelWifi::registerMsixVectors() {
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(fTrans);
+    
+    for (int i = 0; i < trans_pcie->alloc_vecs; i++) {
+        if (i == trans_pcie->def_irq) {
+            fMsixLoops[i] = fIrqLoop;
+            fIrqLoop->retain();
+        } else {
+            fMsixLoops[i] = IOWorkLoop::workLoop();
+        }
+        fMsixSources[i] = IOFilterInterruptEventSource::filterInterruptEventSource(this,
+                                                                                   (IOInterruptEventAction) &IntelWifi::msixInterruptOccured,
+                                                                                   (IOFilterInterruptAction) &IntelWifi::msixInterruptFilter,
+                                                                                   pciDevice, fMsiIndex + i);
+        if (!fMsixLoops[i] || !fMsixSources[i] ||
+            fMsixLoops[i]->addEventSource(fMsixSources[i]) != kIOReturnSuccess) {
+            TraceLog("MSI-X vector %d registration failed", i);
+            return false;
+        }
+        fMsixSources[i]->enable();
+    }
+    return true;
+}
+
 /**
  * Release all internal fields
  */
 void IntelWifi::releaseAll() {
     RELEASE(fInterruptSource);
+    if (fTxWatchdog && fWorkLoop)
+        fWorkLoop->removeEventSource(fTxWatchdog);
+    RELEASE(fTxWatchdog);
+    if (fRxAllocSource && fRxAllocLoop)
+        fRxAllocLoop->removeEventSource(fRxAllocSource);
+    RELEASE(fRxAllocSource);
+    RELEASE(fRxAllocLoop);
+    if (fRxPollSource && fIrqLoop)
+        fIrqLoop->removeEventSource(fRxPollSource);
+    RELEASE(fRxPollSource);
+    if (fIntModTimer && fIrqLoop)
+        fIrqLoop->removeEventSource(fIntModTimer);
+    RELEASE(fIntModTimer);
+    for (int i = 0; i < IWL_MAX_RX_HW_QUEUES; i++) {
+        if (fMsixSources[i] && fMsixLoops[i])
+            fMsixLoops[i]->removeEventSource(fMsixSources[i]);
+        RELEASE(fMsixSources[i]);
+        RELEASE(fMsixLoops[i]);
+    }
+    RELEASE(fOutputQueue);
     RELEASE(fWorkLoop);
     RELEASE(mediumDict);
     
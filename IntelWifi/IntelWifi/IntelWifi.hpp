@@ -26,6 +26,7 @@ extern "C" {
 #include <IOKit/IOFilterInterruptEventSource.h>
 #include <IOKit/pci/IOPCIDevice.h>
 #include <IOKit/network/IOPacketQueue.h>
+#include <IOKit/network/IOGatedOutputQueue.h>
 #include <IOKit/network/IOMbufMemoryCursor.h>
 #include <IOKit/IOMemoryCursor.h>
 
@@ -36,6 +37,8 @@ extern "C" {
 #include "TransOps.h"
 #include "IwlOpModeOps.h"
 
+#include "kext_user_shared.h"
+
 
 // Configuration
 #define CONFIG_IWLMVM // Need NVM mode at least to see that code is compiling
@@ -78,19 +81,27 @@ public:
     IOReturn disable(IONetworkInterface *netif) override;
     bool configureInterface(IONetworkInterface *netif) override;
     IO80211Interface *getNetworkInterface();
+    void getTxStatistics(struct iwl_client_tx_stats *stats);
+    void getTxQueueStatistics(struct iwl_client_txq_stats *stats);
     IOReturn setPromiscuousMode(bool active) override;
     IOReturn setMulticastMode(bool active) override;
+    IOReturn getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput) override;
     SInt32 monitorModeSetEnabled(IO80211Interface*, bool, unsigned int) override {
         return kIOReturnSuccess;
     }
     bool createWorkLoop() override;
     IOWorkLoop* getWorkLoop() const override;
+    UInt32 outputPacket(mbuf_t m, void *param) override;
+    IOOutputQueue* createOutputQueue() override;
+    IOOutputQueue* getOutputQueue() const override;
     
 public:
     int iwl_trans_pcie_start_fw(struct iwl_trans *trans, const struct fw_img *fw, bool run_in_rfkill); // line 1224
     void iwl_trans_pcie_stop_device(struct iwl_trans *trans, bool low_power); // line 1347
     int iwl_trans_pcie_start_hw(struct iwl_trans *trans, bool low_power); // line 1675
     void iwl_trans_pcie_op_mode_leave(struct iwl_trans *trans); // line 1687
+    void iwl_op_mode_queue_full(int queue);
+    void iwl_op_mode_queue_not_full(int queue);
     
 private:
     bool createMediumDict();
@@ -99,8 +110,17 @@ private:
     static void interruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count);
     static bool interruptFilter(OSObject* owner, IOFilterInterruptEventSource * src);
     static IOReturn gateAction(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+    static void txWatchdogOccured(OSObject* owner, IOTimerEventSource* sender);
+    static void rxAllocOccured(OSObject* owner, IOInterruptEventSource* sender, int count);
+    static void rxPollOccured(OSObject* owner, IOInterruptEventSource* sender, int count);
+    static void intModOccured(OSObject* owner, IOTimerEventSource* sender);
+    static void msixInterruptOccured(OSObject* owner, IOInterruptEventSource* sender, int count);
+    static bool msixInterruptFilter(OSObject* owner, IOFilterInterruptEventSource * src);
+    static int msixRxPass(void* ctx, int queue, int budget);
     
     int findMSIInterruptTypeIndex();
+    int countMSIVectors(int first);
+    bool registerMsixVectors();
     
     // trans.c
     void iwl_pcie_set_pwr(struct iwl_trans *trans, bool vaux); // line 186
@@ -143,21 +163,20 @@ private:
     void iwl_pcie_handle_rfkill_irq(struct iwl_trans *trans);
     void iwl_pcie_irq_handle_error(struct iwl_trans *trans);
 
-    void iwl_pcie_rx_handle(struct iwl_trans *trans, int queue);
+    int iwl_pcie_rx_handle(struct iwl_trans *trans, int queue, int budget);
     void iwl_pcie_rx_handle_rb(struct iwl_trans *trans, struct iwl_rxq *rxq,
                                struct iwl_rx_mem_buffer *rxb, bool emergency);
+    bool iwl_pcie_irq_msix_handler(struct iwl_trans *trans, int entry);
+    bool iwl_pcie_irq_rx_msix_handler(struct iwl_trans *trans, int entry);
     
     // tx.c
     int iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq, int slots_num, bool cmd_queue); // line 487
     int iwl_pcie_txq_init(struct iwl_trans *trans, struct iwl_txq *txq, int slots_num, bool cmd_queue); // line 551
     int iwl_pcie_tx_alloc(struct iwl_trans *trans); // line 907
     int iwl_pcie_tx_init(struct iwl_trans *trans); // line 973
-    void iwl_pcie_txq_progress(struct iwl_txq *txq); // line 1034
     void iwl_pcie_cmdq_reclaim(struct iwl_trans *trans, int txq_id, int idx); // line 1211
 
     void iwl_pcie_hcmd_complete(struct iwl_trans *trans, struct iwl_rx_cmd_buffer *rxb); // line 1723
-    int iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
-                          struct iwl_device_cmd *dev_cmd, int txq_id); // line 2256
     
     // other
     UInt16 fDeviceId;
@@ -171,12 +190,22 @@ private:
     IOPCIDevice *pciDevice;
     IO80211Interface *netif;
     IOWorkLoop *fWorkLoop;
+    IOOutputQueue *fOutputQueue;
     IOWorkLoop *fIrqLoop;
+    IOWorkLoop *fRxAllocLoop;
+    IOWorkLoop *fMsixLoops[IWL_MAX_RX_HW_QUEUES];
     OSDictionary *mediumDict;
     
     IONetworkStats *fNetworkStats;
     IOEthernetStats *fEthernetStats;
     IOFilterInterruptEventSource* fInterruptSource;
+    IOFilterInterruptEventSource* fMsixSources[IWL_MAX_RX_HW_QUEUES];
+    int fMsiIndex;
+    int fMsiVectors;
+    IOTimerEventSource* fTxWatchdog;
+    IOTimerEventSource* fIntModTimer;
+    IOInterruptEventSource* fRxAllocSource;
+    IOInterruptEventSource* fRxPollSource;
     
     IOMemoryMap *fMemoryMap;
     
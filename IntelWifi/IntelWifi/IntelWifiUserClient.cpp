@@ -20,6 +20,22 @@ const IOExternalMethodDispatch IntelWifiUserClient::sMethods[kNumberOfMethods] =
         0,
         0,
         0
+    },
+    {
+        // kIwlClientTxStats
+        (IOExternalMethodAction) &IntelWifiUserClient::txStats,
+        0,
+        0,
+        0,
+        sizeof(struct iwl_client_tx_stats)
+    },
+    {
+        // kIwlClientTxQueues
+        (IOExternalMethodAction) &IntelWifiUserClient::txQueues,
+        0,
+        0,
+        0,
+        sizeof(struct iwl_client_txq_stats)
     }
 };
 
@@ -66,6 +82,20 @@ IOReturn IntelWifiUserClient::scanImpl() {
     return kIOReturnSuccess;
 }
 
+IOReturn IntelWifiUserClient::txStats(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->txStatsImpl((struct iwl_client_tx_stats *)arguments->structureOutput);
+}
 
+IOReturn IntelWifiUserClient::txStatsImpl(struct iwl_client_tx_stats *stats) {
+    this->fProvider->getTxStatistics(stats);
+    return kIOReturnSuccess;
+}
 
+IOReturn IntelWifiUserClient::txQueues(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments) {
+    return target->txQueuesImpl((struct iwl_client_txq_stats *)arguments->structureOutput);
+}
 
+IOReturn IntelWifiUserClient::txQueuesImpl(struct iwl_client_txq_stats *stats) {
+    this->fProvider->getTxQueueStatistics(stats);
+    return kIOReturnSuccess;
+}
@@ -35,6 +35,12 @@ protected:
     
     static IOReturn scan(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
     IOReturn scanImpl();
+    
+    static IOReturn txStats(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn txStatsImpl(struct iwl_client_tx_stats *stats);
+    
+    static IOReturn txQueues(IntelWifiUserClient *target, void *reference, IOExternalMethodArguments *arguments);
+    IOReturn txQueuesImpl(struct iwl_client_txq_stats *stats);
 };
 
 
@@ -76,6 +76,7 @@
 #include <IntelWifi.hpp>
 
 #include <kern/task.h>
+#include <sys/sysctl.h>
 
 /* extended range in FW SRAM */
 #define IWL_FW_MEM_EXTENDED_START    0x40000
@@ -1248,11 +1249,56 @@ void iwl_trans_pcie_rf_kill(struct iwl_trans *trans, bool state)
 void IntelWifi::iwl_pcie_set_interrupt_capa(/*struct pci_dev *pdev,*/
                                             struct iwl_trans *trans)
 {
-    // I haven't found any way to enable MSI-X in OS X, so this method is basically not needed
-    // MSI is enabled in start method of this class.
+    // CUSTOM: MSI-X is only built with CONFIG_IWLMVM. The devices that have it
+    // (mq_rx_supported) all need the MVM op mode, which this port lacks. The
+    // vectors are also taken as consecutive message signaled interrupt
+    // indices from fMsiIndex, and nothing puts the function into MSI-X mode
+    // yet. Without it the transport always uses the single MSI source.
     
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
     trans_pcie->msix_enabled = false;
+    
+#ifdef CONFIG_IWLMVM
+    int max_irqs, num_irqs, nr_online_cpus = 1;
+    size_t len = sizeof(nr_online_cpus);
+    
+    if (!trans->cfg->mq_rx_supported)
+        return;
+    
+    if (sysctlbyname("hw.activecpu", &nr_online_cpus, &len, NULL, 0) || nr_online_cpus < 1)
+        nr_online_cpus = 1;
+    max_irqs = min_t(int, nr_online_cpus + 2, IWL_MAX_RX_HW_QUEUES);
+    num_irqs = min_t(int, fMsiVectors, max_irqs);
+    if (num_irqs < MSIX_MIN_INTERRUPT_VECTORS) {
+        IWL_DEBUG_INFO(trans, "Failed to enable msi-x mode (%d vectors). Moving to msi mode.\n", num_irqs);
+        return;
+    }
+    trans_pcie->def_irq = (num_irqs == max_irqs) ? num_irqs - 1 : 0;
+    
+    IWL_DEBUG_INFO(trans, "MSI-X enabled. %d interrupt vectors were allocated\n", num_irqs);
+    
+    /*
+     * In case the OS provides fewer interrupts than requested, different
+     * causes will share the same interrupt vector as follows:
+     * One interrupt less: non rx causes shared with FBQ.
+     * Two interrupts less: non rx causes shared with FBQ and RSS.
+     * More than two interrupts: we will use fewer RSS queues.
+     */
+    if (num_irqs <= nr_online_cpus) {
+        trans_pcie->trans->num_rx_queues = num_irqs + 1;
+        trans_pcie->shared_vec_mask = IWL_SHARED_IRQ_NON_RX | IWL_SHARED_IRQ_FIRST_RSS;
+    } else if (num_irqs == nr_online_cpus + 1) {
+        trans_pcie->trans->num_rx_queues = num_irqs;
+        trans_pcie->shared_vec_mask = IWL_SHARED_IRQ_NON_RX;
+    } else {
+        trans_pcie->trans->num_rx_queues = num_irqs - 1;
+    }
+    
+    trans_pcie->alloc_vecs = num_irqs;
+    trans_pcie->msix_enabled = true;
+#endif /* CONFIG_IWLMVM */
+    
     //    int max_irqs, num_irqs, i, ret, nr_online_cpus;
     //    u16 pci_cmd;
     //
@@ -1413,6 +1459,8 @@ void iwl_trans_pcie_configure(struct iwl_trans *trans, const struct iwl_trans_co
     trans_pcie->bc_table_dword = trans_cfg->bc_table_dword;
     trans_pcie->scd_set_active = trans_cfg->scd_set_active;
     trans_pcie->sw_csum_tx = trans_cfg->sw_csum_tx;
+    trans_pcie->amsdu_max_subframes = min_t(u8, trans_cfg->tx_amsdu_max_subframes, IWL_TRANS_AMSDU_MAX_SUBFRAMES);
+    trans_pcie->amsdu_max_bytes = trans_cfg->tx_amsdu_max_bytes;
     
     trans_pcie->page_offs = trans_cfg->cb_data_offs;
     trans_pcie->dev_cmd_offs = trans_cfg->cb_data_offs + sizeof(void *);
@@ -1472,10 +1520,60 @@ void IntelWifi::iwl_trans_pcie_free(struct iwl_trans *trans)
     //    free_percpu(trans_pcie->tso_hdr_page);
     IOSimpleLockFree(trans_pcie->irq_lock);
     IOSimpleLockFree(trans_pcie->reg_lock);
+    IOSimpleLockFree(trans_pcie->rba.lock);
     IOLockFree(trans_pcie->mutex);
     iwl_trans_free(trans);
 }
 
+// line 1968
+void iwl_trans_pcie_freeze_txq_timer(struct iwl_trans *trans, unsigned long txqs, bool freeze)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int queue;
+    
+    for_each_set_bit(queue, &txqs, BITS_PER_LONG) {
+        struct iwl_txq *txq = trans_pcie->txq[queue];
+        unsigned long now;
+        
+        IOSimpleLockLock(txq->lock);
+        
+        now = jiffies;
+        
+        if (txq->frozen == freeze)
+            goto next_queue;
+        
+        IWL_DEBUG_TX_QUEUES(trans, "%s TXQ %d\n", freeze ? "Freezing" : "Waking", queue);
+        
+        txq->frozen = freeze;
+        
+        if (txq->read_ptr == txq->write_ptr)
+            goto next_queue;
+        
+        if (freeze) {
+            if (unlikely(!txq->stuck_deadline || time_after(now, txq->stuck_deadline))) {
+                /*
+                 * The deadline already expired, the watchdog will
+                 * pick the queue up on its next pass.
+                 */
+                goto next_queue;
+            }
+            /* remember how long until the deadline expires */
+            txq->frozen_expiry_remainder = txq->stuck_deadline - now;
+            txq->stuck_deadline = 0;
+            goto next_queue;
+        }
+        
+        /*
+         * Wake a non-empty queue -> arm the deadline with the
+         * remainder before it froze
+         */
+        txq->stuck_deadline = now + txq->frozen_expiry_remainder;
+        
+    next_queue:
+        IOSimpleLockUnlock(txq->lock);
+    }
+}
+
 
 
 
@@ -1500,6 +1598,7 @@ struct iwl_trans* IntelWifi::iwl_trans_pcie_alloc(const struct iwl_cfg *cfg) {
     trans_pcie->opmode_down = true;
     trans_pcie->irq_lock = IOSimpleLockAlloc();
     trans_pcie->reg_lock = IOSimpleLockAlloc();
+    trans_pcie->rba.lock = IOSimpleLockAlloc();
     trans_pcie->mutex = IOLockAlloc();
     
     trans_pcie->ucode_write_waitq = IOLockAlloc();
@@ -1535,6 +1634,8 @@ struct iwl_trans* IntelWifi::iwl_trans_pcie_alloc(const struct iwl_cfg *cfg) {
         trans_pcie->tfd_size = sizeof(struct iwl_tfd);
     }
     trans->max_skb_frags = IWL_PCIE_MAX_FRAGS(trans_pcie);
+    trans_pcie->tx_db_batch_frames = IWL_TX_DB_BATCH_FRAMES;
+    trans_pcie->tx_db_batch_bytes = IWL_TX_DB_BATCH_BYTES;
     
     // original linux code: pci_set_master(pdev);
     pciDevice->setBusMasterEnable(true);
@@ -1655,10 +1756,10 @@ struct iwl_trans* IntelWifi::iwl_trans_pcie_alloc(const struct iwl_cfg *cfg) {
     trans_pcie->wait_command_queue = IOLockAlloc();
     trans_pcie->d0i3_waitq = IOLockAlloc();
     
-    // TODO: Implement
     int ret;
     
     if (trans_pcie->msix_enabled) {
+        /* the vector event sources are registered by start() */
         // ret = iwl_pcie_init_msix_handler(pdev, trans_pcie);
         // if (ret)
         //     goto out_no_pci;
@@ -39,12 +39,214 @@
 
 #include "IntelWifi.hpp"
 #include "iwlwifi/fw/api/tx.h"
+#include <linux/etherdevice.h>
+#include <libkern/OSAtomic.h>
 
 #include "iwlwifi/iwl-trans.h"
 
+#include "iw_utils/csum.h"
+#include "iw_utils/tx_range.h"
+#include "iw_utils/tx_tbs.h"
+
 #define IWL_TX_CRC_SIZE 4
 #define IWL_TX_DELIMITER_SIZE 4
 
+/*
+ * CUSTOM
+ */
+
+/*
+ * The op mode doesn't want transmitted frames back (there is no TX status
+ * to report to the stack), so the transport owns the mbuf chain and the TX
+ * command from iwl_trans_pcie_tx until the frame is reclaimed.
+ */
+static void iwl_pcie_free_tx_mbuf(struct iwl_trans *trans, mbuf_t m) {
+    IO80211Controller *dev = static_cast<IO80211Controller *>(trans->dev);
+    
+    /* A-MSDU subframes are linked with nextpkt */
+    while (m) {
+        mbuf_t next = mbuf_nextpkt(m);
+        
+        mbuf_setnextpkt(m, NULL);
+        dev->freePacket(m);
+        m = next;
+    }
+}
+
+static void iwl_pcie_txq_overflow_drain(struct iwl_trans *trans, struct iwl_txq *txq);
+static void iwl_pcie_txq_overflow_free(struct iwl_trans *trans, struct iwl_txq *txq);
+
+/* iwl-op-mode.h, called under the lock of the queue */
+void IntelWifi::iwl_op_mode_queue_full(int queue)
+{
+    if (opmode && hw)
+        opmode->queue_full((struct iwl_priv *)hw->priv, queue);
+}
+
+void IntelWifi::iwl_op_mode_queue_not_full(int queue)
+{
+    if (opmode && hw)
+        opmode->queue_not_full((struct iwl_priv *)hw->priv, queue);
+}
+
+void iwl_trans_pcie_queue_full(struct iwl_trans *trans, int queue)
+{
+    static_cast<IntelWifi *>(trans->dev)->iwl_op_mode_queue_full(queue);
+}
+
+void iwl_trans_pcie_queue_not_full(struct iwl_trans *trans, int queue)
+{
+    static_cast<IntelWifi *>(trans->dev)->iwl_op_mode_queue_not_full(queue);
+}
+
+#define POSDIFF(A, B) ((int)((A) - (B)) > 0 ? (A) - (B) : 0)
+#define AFTER_EQ(A, B) ((int)((A) - (B)) >= 0)
+
+static void iwl_pcie_txq_bql_reset(struct iwl_txq_bql *bql)
+{
+    memset(bql, 0, sizeof(*bql));
+    bql->limit = IWL_BQL_MIN_LIMIT;
+    bql->adj_limit = bql->limit;
+    bql->lowest_slack = ~0U;
+    bql->slack_start_time = jiffies;
+}
+
+/*
+ * iwl_pcie_txq_bql_completed - account reclaimed bytes and adapt the limit
+ *
+ * Same algorithm as dql_completed in lib/dynamic_queue_limits.c.
+ */
+static void iwl_pcie_txq_bql_completed(struct iwl_txq_bql *bql, u32 count)
+{
+    u32 inprogress, prev_inprogress, limit;
+    u32 ovlimit, completed, num_queued;
+    bool all_prev_completed;
+    
+    num_queued = bql->num_queued;
+    
+    /* Can't complete more than what's in queue */
+    if (WARN_ON(count > num_queued - bql->num_completed))
+        count = num_queued - bql->num_completed;
+    
+    completed = bql->num_completed + count;
+    limit = bql->limit;
+    ovlimit = POSDIFF(num_queued - bql->num_completed, limit);
+    inprogress = num_queued - completed;
+    prev_inprogress = bql->prev_num_queued - bql->num_completed;
+    all_prev_completed = AFTER_EQ(completed, bql->prev_num_queued);
+    
+    if ((ovlimit && !inprogress) ||
+        (bql->prev_ovlimit && all_prev_completed)) {
+        /*
+         * Queue considered starved if:
+         *   - The queue was over-limit in the last interval,
+         *     and there is no more data in the queue.
+         *  OR
+         *   - The queue was over-limit in the previous interval and
+         *     when enqueuing it was possible that all queued data
+         *     had been consumed.  This covers the case when queue
+         *     may have becomes starved between completion processing
+         *     running and next time enqueue was scheduled.
+         *
+         *     When queue is starved increase the limit by the amount
+         *     of bytes both sent and completed in the last interval,
+         *     plus any previous over-limit.
+         */
+        limit += POSDIFF(completed, bql->prev_num_queued) + bql->prev_ovlimit;
+        bql->slack_start_time = jiffies;
+        bql->lowest_slack = ~0U;
+    } else if (inprogress && prev_inprogress && !all_prev_completed) {
+        /*
+         * Queue was not starved, check if the limit can be decreased.
+         * A decrease is only considered if the queue has been busy in
+         * the whole interval (the check above).
+         *
+         * If there is slack, the amount of excess data queued above
+         * the amount needed to prevent starvation, the queue limit
+         * can be decreased.  To avoid hysteresis we consider the
+         * minimum amount of slack found over several iterations of the
+         * completion routine.
+         */
+        u32 slack, slack_last_objs;
+        
+        /*
+         * Slack is the maximum of
+         *   - The queue limit plus previous over-limit minus twice
+         *     the number of objects completed.  Note that two times
+         *     number of completed bytes is a basis for an upper bound
+         *     of the limit.
+         *   - Portion of objects in the last queuing operation that
+         *     was not part of non-zero previous over-limit.  That is
+         *     "round down" by non-overlimit portion of the last
+         *     queueing operation.
+         */
+        slack = POSDIFF(limit + bql->prev_ovlimit, 2 * (completed - bql->num_completed));
+        slack_last_objs = bql->prev_ovlimit ?
+            POSDIFF(bql->prev_last_obj_cnt, bql->prev_ovlimit) : 0;
+        
+        slack = max_t(u32, slack, slack_last_objs);
+        
+        if (slack < bql->lowest_slack)
+            bql->lowest_slack = slack;
+        
+        if (time_after(jiffies, bql->slack_start_time + IWL_BQL_SLACK_HOLD_TIME)) {
+            limit = POSDIFF(limit, bql->lowest_slack);
+            bql->slack_start_time = jiffies;
+            bql->lowest_slack = ~0U;
+        }
+    }
+    
+    /* Enforce bounds on limit */
+    limit = max_t(u32, limit, IWL_BQL_MIN_LIMIT);
+    limit = min_t(u32, limit, IWL_BQL_MAX_LIMIT);
+    
+    if (limit != bql->limit) {
+        bql->limit = limit;
+        ovlimit = 0;
+    }
+    
+    bql->adj_limit = limit + completed;
+    bql->prev_ovlimit = ovlimit;
+    bql->prev_last_obj_cnt = bql->last_obj_cnt;
+    bql->num_completed = completed;
+    bql->prev_num_queued = num_queued;
+}
+
+static void iwl_pcie_amsdu_stage_reset(struct iwl_amsdu_stage *stage)
+{
+    memset(stage, 0, sizeof(*stage));
+}
+
+/*
+ * iwl_pcie_amsdu_stage_free - drop the frames being gathered
+ */
+static void iwl_pcie_amsdu_stage_free(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    struct iwl_amsdu_stage *stage = &txq->amsdu;
+    
+    if (!stage->head)
+        return;
+    
+    iwl_pcie_free_tx_mbuf(trans, stage->head);
+    iwl_trans_free_tx_cmd(trans, stage->dev_cmd);
+    iwl_pcie_amsdu_stage_reset(stage);
+}
+
+static void iwl_pcie_txq_free_amsdu_hdrs(struct iwl_txq *txq)
+{
+    if (!txq->amsdu_hdrs)
+        return;
+    
+    free_dma_buf(txq->amsdu_hdrs_dma_ptr);
+    txq->amsdu_hdrs_dma_ptr = NULL;
+    txq->amsdu_hdrs_dma = 0;
+    txq->amsdu_hdrs = NULL;
+}
+
+/*
+ * CUSTOM END
+ */
+
 /*************** DMA-QUEUE-GENERAL-FUNCTIONS  *****
  * DMA services
  *
@@ -148,32 +350,67 @@ void iwl_pcie_free_dma_ptr(struct iwl_trans *trans, struct iwl_dma_ptr *ptr)
 
 
 
-// line 217
-static void iwl_pcie_txq_inval_byte_cnt_tbl(struct iwl_trans *trans, struct iwl_txq *txq)
+/* line 179
+ * iwl_pcie_txq_update_byte_cnt_tbl - Set up entry in Tx byte-count array
+ */
+static void iwl_pcie_txq_update_byte_cnt_tbl(struct iwl_trans *trans, struct iwl_txq *txq, u16 byte_cnt,
+                                             int num_tbs)
 {
-    struct iwl_trans_pcie *trans_pcie =
-    IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
     struct iwlagn_scd_bc_tbl *scd_bc_tbl = (struct iwlagn_scd_bc_tbl *)trans_pcie->scd_bc_tbls->addr;
+    int write_ptr = txq->write_ptr;
     int txq_id = txq->id;
-    int read_ptr = txq->read_ptr;
-    u8 sta_id = 0;
+    u8 sec_ctl = 0;
+    u16 len = byte_cnt + IWL_TX_CRC_SIZE + IWL_TX_DELIMITER_SIZE;
     __le16 bc_ent;
-    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)txq->entries[read_ptr].cmd->payload;
-    
-    if (read_ptr >= TFD_QUEUE_SIZE_MAX) {
-        IWL_WARN(trans, "read_ptr >= TFD_QUEUE_SIZE_MAX");
+    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)txq->entries[txq->write_ptr].cmd->payload;
+    u8 sta_id = tx_cmd->sta_id;
+    
+    sec_ctl = tx_cmd->sec_ctl;
+    
+    switch (sec_ctl & TX_CMD_SEC_MSK) {
+        case TX_CMD_SEC_CCM:
+            len += IEEE80211_CCMP_MIC_LEN;
+            break;
+        case TX_CMD_SEC_TKIP:
+            len += IEEE80211_TKIP_ICV_LEN;
+            break;
+        case TX_CMD_SEC_WEP:
+            len += IEEE80211_WEP_IV_LEN + IEEE80211_WEP_ICV_LEN;
+            break;
     }
+    if (trans_pcie->bc_table_dword)
+        len = DIV_ROUND_UP(len, 4);
     
-    if (txq_id != trans_pcie->cmd_queue)
-        sta_id = tx_cmd->sta_id;
+    if (WARN_ON(len > 0xFFF || write_ptr >= TFD_QUEUE_SIZE_MAX))
+        return;
+    
+    bc_ent = cpu_to_le16(len | (sta_id << 12));
     
-    bc_ent = cpu_to_le16(1 | (sta_id << 12));
+    scd_bc_tbl[txq_id].tfd_offset[write_ptr] = bc_ent;
     
-    scd_bc_tbl[txq_id].tfd_offset[read_ptr] = bc_ent;
+    if (write_ptr < TFD_QUEUE_SIZE_BC_DUP)
+        scd_bc_tbl[txq_id].tfd_offset[TFD_QUEUE_SIZE_MAX + write_ptr] = bc_ent;
+}
+
+/* CUSTOM */
+/*
+ * iwl_pcie_txq_inval_byte_cnt_range - invalidate the byte counts of @count
+ * entries starting at @first
+ *
+ * Unlike the per-entry iwl_pcie_txq_inval_byte_cnt_tbl() of Linux, the
+ * station id is taken from the entry written by
+ * iwl_pcie_txq_update_byte_cnt_tbl(), so the TX commands aren't touched and
+ * each part of the range is a single pass over a contiguous array.
+ */
+static void iwl_pcie_txq_inval_byte_cnt_range(struct iwl_trans *trans, struct iwl_txq *txq, int first, int count)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwlagn_scd_bc_tbl *scd_bc_tbl = (struct iwlagn_scd_bc_tbl *)trans_pcie->scd_bc_tbls->addr;
     
-    if (read_ptr < TFD_QUEUE_SIZE_BC_DUP)
-        scd_bc_tbl[txq_id].tfd_offset[TFD_QUEUE_SIZE_MAX + read_ptr] = bc_ent;
+    iwl_pcie_bc_inval_range(scd_bc_tbl[txq->id].tfd_offset, first, count);
 }
+/* CUSTOM END */
 
 
 /* line 244
@@ -216,8 +453,14 @@ static void iwl_pcie_txq_inc_wr_ptr(struct iwl_trans *trans, struct iwl_txq *txq
      * trying to tx (during RFKILL, we're not trying to tx).
      */
     IWL_DEBUG_TX(trans, "Q:%d WR: 0x%x\n", txq_id, txq->write_ptr);
-    if (!txq->block)
+    if (!txq->block) {
         iwl_write32(trans, HBUS_TARG_WRPTR, txq->write_ptr | (txq_id << 8));
+        
+        if (txq_id != trans_pcie->cmd_queue)
+            trans_pcie->tx_stats.doorbells++;
+        txq->db_pending_frames = 0;
+        txq->db_pending_bytes = 0;
+    }
 }
 
 // line 292
@@ -234,7 +477,8 @@ void iwl_pcie_txq_check_wrptrs(struct iwl_trans *trans)
 
         //spin_lock_bh(&txq->lock);
         //IOSimpleLockLock(txq->lock);
-        if (txq->need_update) {
+        /* frames held back by xmit_more are published here as well */
+        if (txq->need_update || txq->db_pending_frames) {
             iwl_pcie_txq_inc_wr_ptr(trans, txq);
             txq->need_update = false;
         }
@@ -353,6 +597,33 @@ static void iwl_pcie_tfd_unmap(struct iwl_trans *trans, struct iwl_cmd_meta *met
     
 }
 
+/* CUSTOM
+ * iwl_pcie_tfd_reset_range - reset @count TFDs starting at @first
+ *
+ * Range version of the num_tbs reset in iwl_pcie_tfd_unmap() for data
+ * queues, which never put DMA buffers into the meta and have nothing else
+ * to unmap. The range wraps with the ring indexes, at TFD_QUEUE_SIZE_MAX.
+ */
+static void iwl_pcie_tfd_reset_range(struct iwl_trans *trans, struct iwl_txq *txq, int first, int count)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    /* a data queue has a TFD per ring index, they are contiguous up to the wrap */
+    BUILD_BUG_ON(TFD_TX_CMD_SLOTS != TFD_QUEUE_SIZE_MAX);
+    if (WARN_ON_ONCE(txq->n_window != TFD_QUEUE_SIZE_MAX))
+        return;
+    
+    while (count > 0) {
+        int n = min_t(int, count, TFD_QUEUE_SIZE_MAX - first);
+        
+        iwl_pcie_tfd_clear(iwl_pcie_get_tfd(trans_pcie, txq, first), trans_pcie->tfd_size,
+                           trans->cfg->use_tfh, n);
+        
+        count -= n;
+        first = 0;
+    }
+}
+
 /* line 416
  * iwl_pcie_txq_free_tfd - Free all chunks referenced by TFD [txq->q.read_ptr]
  * @trans - transport private data
@@ -379,7 +650,7 @@ void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
     
     /* free SKB */
     if (txq->entries) {
-        struct sk_buff *skb;
+        mbuf_t skb;
         
         skb = txq->entries[idx].skb;
         
@@ -388,9 +659,13 @@ void iwl_pcie_txq_free_tfd(struct iwl_trans *trans, struct iwl_txq *txq)
          * freed and that the queue is not empty - free the skb
          */
         if (skb) {
-            // TODO: Implement
             // iwl_op_mode_free_skb(trans->op_mode, skb);
+            iwl_pcie_free_tx_mbuf(trans, skb);
             txq->entries[idx].skb = NULL;
+            
+            /* data queues don't own command buffers, the TX command came with the skb */
+            iwl_trans_free_tx_cmd(trans, txq->entries[idx].cmd);
+            txq->entries[idx].cmd = NULL;
         }
     }
 }
@@ -423,6 +698,34 @@ static int iwl_pcie_txq_build_tfd(struct iwl_trans *trans, struct iwl_txq *txq,
     return num_tbs;
 }
 
+/*
+ * Dump the scheduler view of a queue the watchdog found stuck
+ */
+void iwl_trans_pcie_log_scd_error(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    u32 txq_id = txq->id;
+    u32 status;
+    bool active;
+    u8 fifo;
+    
+    if (trans->cfg->use_tfh) {
+        IWL_ERR(trans, "Queue %d is stuck %d %d\n", txq_id, txq->read_ptr, txq->write_ptr);
+        /* TODO: access new SCD registers and dump them */
+        return;
+    }
+    
+    status = iwl_read_prph(trans, SCD_QUEUE_STATUS_BITS(txq_id));
+    fifo = (status >> SCD_QUEUE_STTS_REG_POS_TXF) & 0x7;
+    active = !!(status & BIT(SCD_QUEUE_STTS_REG_POS_ACTIVE));
+    
+    IWL_ERR(trans, "Queue %d is %sactive on fifo %d and stuck for %u ms. SW [%d, %d] HW [%d, %d] FH TRB=0x0%x\n",
+            txq_id, active ? "" : "in", fifo, jiffies_to_msecs(txq->wd_timeout),
+            txq->read_ptr, txq->write_ptr,
+            iwl_read_prph(trans, SCD_QUEUE_RDPTR(txq_id)) & (TFD_QUEUE_SIZE_MAX - 1),
+            iwl_read_prph(trans, SCD_QUEUE_WRPTR(txq_id)) & (TFD_QUEUE_SIZE_MAX - 1),
+            iwl_read_direct32(trans, FH_TX_TRB_REG(fifo)));
+}
+
 
 // line 487
 int IntelWifi::iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq, int slots_num, bool cmd_queue)
@@ -434,12 +737,14 @@ int IntelWifi::iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq,
     int ret;
     struct iwl_dma_ptr *tfds_dma = NULL;
     struct iwl_dma_ptr *first_tb_bufs_dma = NULL;
+    struct iwl_dma_ptr *tb1_bufs_dma = NULL;
+    struct iwl_dma_ptr *hcmd_bufs_dma = NULL;
 
     if (WARN_ON(txq->entries || txq->tfds))
         return -EINVAL;
 
-    // TODO: Implement
-//    setup_timer(&txq->stuck_timer, iwl_pcie_txq_stuck_timer, (unsigned long)txq);
+    /* No stuck timer: iwl_pcie_txq_check_stuck() scans stuck_deadline */
+    txq->stuck_deadline = 0;
     txq->trans_pcie = trans_pcie;
     
     txq->n_window = slots_num;
@@ -478,7 +783,31 @@ int IntelWifi::iwl_pcie_txq_alloc(struct iwl_trans *trans, struct iwl_txq *txq,
     txq->first_tb_bufs = (struct iwl_pcie_first_tb_buf *)first_tb_bufs_dma->addr;
     txq->first_tb_dma = first_tb_bufs_dma->dma;
     
+    /* the command queue maps TB1 together with the host command */
+    if (!cmd_queue) {
+        ret = iwl_pcie_alloc_dma_ptr(trans, &tb1_bufs_dma, sizeof(*txq->tb1_bufs) * slots_num);
+        if (ret) {
+            goto err_free_first_tb;
+        }
+        
+        txq->tb1_dma_ptr = tb1_bufs_dma;
+        txq->tb1_bufs = (struct iwl_pcie_tb1_buf *)tb1_bufs_dma->addr;
+        txq->tb1_dma = tb1_bufs_dma->dma;
+    } else {
+        ret = iwl_pcie_alloc_dma_ptr(trans, &hcmd_bufs_dma, sizeof(*txq->hcmd_bufs) * slots_num);
+        if (ret) {
+            goto err_free_first_tb;
+        }
+        
+        txq->hcmd_dma_ptr = hcmd_bufs_dma;
+        txq->hcmd_bufs = (struct iwl_pcie_hcmd_buf *)hcmd_bufs_dma->addr;
+        txq->hcmd_dma = hcmd_bufs_dma->dma;
+    }
+    
     return 0;
+err_free_first_tb:
+    free_dma_buf(txq->first_tb_dma_ptr);
+    txq->first_tb_bufs = NULL;
 err_free_tfds:
     free_dma_buf(txq->tfds_dma_ptr);
 error:
@@ -559,13 +888,10 @@ static void iwl_pcie_txq_unmap(struct iwl_trans *trans, int txq_id)
         IWL_DEBUG_TX_REPLY(trans, "Q %d Free %d\n", txq_id, txq->read_ptr);
         
         if (txq_id != trans_pcie->cmd_queue) {
-            struct sk_buff *skb = txq->entries[txq->read_ptr].skb;
+            mbuf_t skb = txq->entries[txq->read_ptr].skb;
             
             if (WARN_ON_ONCE(!skb))
                 continue;
-            
-            // TODO: Implement
-            // iwl_pcie_free_tso_page(trans_pcie, skb);
         }
         iwl_pcie_txq_free_tfd(trans, txq);
         txq->read_ptr = iwl_queue_inc_wrap(txq->read_ptr);
@@ -584,12 +910,13 @@ static void iwl_pcie_txq_unmap(struct iwl_trans *trans, int txq_id)
         }
     }
 
-    // TODO: Implement
-//    while (!skb_queue_empty(&txq->overflow_q)) {
-//        struct sk_buff *skb = __skb_dequeue(&txq->overflow_q);
-//
-//        iwl_op_mode_free_skb(trans->op_mode, skb);
-//    }
+    /* the TX path and the reclaim path only touch these under the lock */
+    IOSimpleLockLock(txq->lock);
+    iwl_pcie_amsdu_stage_free(trans, txq);
+    
+    iwl_pcie_txq_overflow_free(trans, txq);
+    iwl_pcie_txq_bql_reset(&txq->bql);
+    IOSimpleLockUnlock(txq->lock);
     
     //spin_unlock_bh(&txq->lock);
     
@@ -622,10 +949,8 @@ static void iwl_pcie_txq_free(struct iwl_trans *trans, int txq_id)
     
     /* De-alloc array of command/tx buffers */
     if (txq_id == trans_pcie->cmd_queue)
-        for (i = 0; i < txq->n_window; i++) {
+        for (i = 0; i < txq->n_window; i++)
             iwh_free(txq->entries[i].cmd);
-            iwh_free((void *)txq->entries[i].free_buf);
-        }
     
     /* De-alloc circular buffer of TFDs */
     if (txq->tfds) {
@@ -636,11 +961,23 @@ static void iwl_pcie_txq_free(struct iwl_trans *trans, int txq_id)
         free_dma_buf(txq->first_tb_dma_ptr);
     }
     
+    if (txq->tb1_bufs) {
+        free_dma_buf(txq->tb1_dma_ptr);
+        txq->tb1_dma = 0;
+        txq->tb1_bufs = NULL;
+    }
+    
+    if (txq->hcmd_bufs) {
+        free_dma_buf(txq->hcmd_dma_ptr);
+        txq->hcmd_dma = 0;
+        txq->hcmd_bufs = NULL;
+    }
+    
+    iwl_pcie_txq_free_amsdu_hdrs(txq);
+    
     iwh_free(txq->entries);
     txq->entries = NULL;
     
-    //del_timer_sync(&txq->stuck_timer);
-    
     /* 0-fill queue descriptor structure */
     bzero(txq, sizeof(*txq));
 }
@@ -915,7 +1252,7 @@ error:
 }
 
 // line 1034
-void IntelWifi::iwl_pcie_txq_progress(struct iwl_txq *txq)
+static void iwl_pcie_txq_progress(struct iwl_txq *txq)
 {
     //lockdep_assert_held(&txq->lock);
     
@@ -924,20 +1261,192 @@ void IntelWifi::iwl_pcie_txq_progress(struct iwl_txq *txq)
     
     /*
      * station is asleep and we send data - that must
-     * be uAPSD or PS-Poll. Don't rearm the timer.
+     * be uAPSD or PS-Poll. Don't move the deadline.
      */
     if (txq->frozen)
         return;
     
     /*
-     * if empty delete timer, otherwise move timer forward
+     * if empty disarm the deadline, otherwise move it forward
      * since we're making progress on this queue
      */
-    // TODO: Implement
-//    if (txq->read_ptr == txq->write_ptr)
-//        del_timer(&txq->stuck_timer);
-//    else
-//        mod_timer(&txq->stuck_timer, jiffies + txq->wd_timeout);
+    if (txq->read_ptr == txq->write_ptr)
+        txq->stuck_deadline = 0;
+    else
+        txq->stuck_deadline = jiffies + txq->wd_timeout;
+}
+
+/* CUSTOM */
+/*
+ * Periodic TX queue watchdog, replaces the per-queue stuck timer. Every
+ * reclaim pushes stuck_deadline forward, so it only expires if read_ptr
+ * didn't move for wd_timeout while frames were pending. Returns true if a
+ * stuck queue was found: its state is logged and the firmware is asked to
+ * dump its log, the caller is responsible for the recovery.
+ */
+bool iwl_pcie_txq_check_stuck(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    unsigned long now = jiffies;
+    struct iwl_txq *txq;
+    bool stuck;
+    int i;
+    
+    if (trans->state != IWL_TRANS_FW_ALIVE || test_bit(STATUS_FW_ERROR, &trans->status))
+        return false;
+    
+    for (i = 0; i < trans->cfg->base_params->num_of_queues; i++) {
+        txq = trans_pcie->txq[i];
+        
+        /* lockless peek, the deadline is re-checked under the lock */
+        if (!txq || !test_bit(i, trans_pcie->queue_used) || !txq->stuck_deadline)
+            continue;
+        
+        IOSimpleLockLock(txq->lock);
+        /* check if armed erroneously */
+        if (txq->read_ptr == txq->write_ptr)
+            txq->stuck_deadline = 0;
+        stuck = txq->stuck_deadline && !txq->frozen && time_after(now, txq->stuck_deadline);
+        IOSimpleLockUnlock(txq->lock);
+        
+        if (!stuck)
+            continue;
+        
+        iwl_trans_pcie_log_scd_error(trans, txq);
+        iwl_force_nmi(trans);
+        return true;
+    }
+    
+    return false;
+}
+/* CUSTOM END */
+
+/* line 1084
+ * Frees buffers until index _not_ inclusive
+ *
+ * The mbufs of all reclaimed frames are chained with nextpkt and released
+ * with a single call once the walk is done, instead of one free per frame.
+ */
+void iwl_trans_pcie_reclaim(struct iwl_trans *trans, int txq_id, int ssn)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *txq = trans_pcie->txq[txq_id];
+    int tfd_num = iwl_pcie_get_cmd_index(txq, ssn);
+    int read_ptr = iwl_pcie_get_cmd_index(txq, txq->read_ptr);
+    int last_to_free;
+    int first, count = 0;
+    mbuf_t free_head = NULL, free_tail = NULL;
+    u32 freed = 0, freed_bytes = 0;
+    
+    /* This function is not meant to release cmd queue*/
+    if (WARN_ON(txq_id == trans_pcie->cmd_queue))
+        return;
+    
+    IOSimpleLockLock(txq->lock);
+    
+    if (!test_bit(txq_id, trans_pcie->queue_used)) {
+        IWL_DEBUG_TX_QUEUES(trans, "Q %d inactive - ignoring idx %d\n", txq_id, ssn);
+        goto out;
+    }
+    
+    if (read_ptr == tfd_num)
+        goto out;
+    
+    IWL_DEBUG_TX_REPLY(trans, "[Q %d] %d -> %d (%d)\n", txq_id, txq->read_ptr, tfd_num, ssn);
+    
+    /*Since we free until index _not_ inclusive, the one before index is
+     * the last we will free. This one must be used */
+    last_to_free = iwl_queue_dec_wrap(tfd_num);
+    
+    if (!iwl_queue_used(txq, last_to_free)) {
+        IWL_ERR(trans,
+                "%s: Read index for DMA queue txq id (%d), last_to_free %d is out of range [0-%d] %d %d.\n",
+                __func__, txq_id, last_to_free, TFD_QUEUE_SIZE_MAX,
+                txq->write_ptr, txq->read_ptr);
+        goto out;
+    }
+    
+    first = txq->read_ptr;
+    
+    for (;
+         read_ptr != tfd_num;
+         txq->read_ptr = iwl_queue_inc_wrap(txq->read_ptr),
+         read_ptr = iwl_pcie_get_cmd_index(txq, txq->read_ptr)) {
+        mbuf_t skb = txq->entries[read_ptr].skb;
+        mbuf_t last;
+        
+        count++;
+        
+        if (WARN_ON_ONCE(!skb))
+            continue;
+        
+        /* an A-MSDU is already a nextpkt list, append it as a whole */
+        for (last = skb; mbuf_nextpkt(last); last = mbuf_nextpkt(last))
+            ;
+        if (free_tail)
+            mbuf_setnextpkt(free_tail, skb);
+        else
+            free_head = skb;
+        free_tail = last;
+        freed++;
+        freed_bytes += txq->entries[read_ptr].bytes;
+        
+        txq->entries[read_ptr].skb = NULL;
+        
+        /* data queues don't own command buffers, the TX command came with the skb */
+        iwl_trans_free_tx_cmd(trans, txq->entries[read_ptr].cmd);
+        txq->entries[read_ptr].cmd = NULL;
+    }
+    
+    /* the byte counts and TFDs of the whole range are reset in one go */
+    if (!trans->cfg->use_tfh)
+        iwl_pcie_txq_inval_byte_cnt_range(trans, txq, first, count);
+    iwl_pcie_tfd_reset_range(trans, txq, first, count);
+    
+    iwl_pcie_txq_progress(txq);
+    iwl_pcie_txq_bql_completed(&txq->bql, freed_bytes);
+    
+    trans_pcie->tx_stats.reclaimed += freed;
+    trans_pcie->tx_stats.reclaims++;
+    
+    /*
+     * The queue is stopped below high_mark free slots and only woken
+     * above low_mark, so it doesn't bounce on every reclaim. It is also
+     * kept stopped while more bytes than the byte limit are in flight.
+     */
+    if (iwl_queue_space(txq) > txq->low_mark &&
+        (test_bit(txq_id, trans_pcie->queue_stopped) ||
+         iwl_txq_overflow_depth(&txq->overflow_q))) {
+        /*
+         * This is tricky: we are in reclaim path which is non
+         * re-entrant, so noone will try to take the access the
+         * txq data from that path. We stopped tx, so we can't
+         * have tx as well. Bottom line, we can unlock and re-lock
+         * later.
+         */
+        IOSimpleLockUnlock(txq->lock);
+        
+        iwl_pcie_txq_overflow_drain(trans, txq);
+        
+        IOSimpleLockLock(txq->lock);
+        
+        if (iwl_queue_space(txq) > txq->low_mark &&
+            iwl_txq_bql_avail(&txq->bql) >= 0 &&
+            !iwl_txq_overflow_depth(&txq->overflow_q))
+            iwl_wake_queue(trans, txq);
+    }
+    
+    if (txq->read_ptr == txq->write_ptr) {
+        IWL_DEBUG_RPM(trans, "Q %d - last tx reclaimed\n", txq->id);
+        iwl_trans_unref(trans);
+    }
+
+out:
+    IOSimpleLockUnlock(txq->lock);
+    
+    /* one free for the whole batch, outside of the queue lock */
+    if (free_head)
+        mbuf_freem_list(free_head);
 }
 
 
@@ -1069,6 +1578,24 @@ bool iwl_trans_pcie_txq_enable(struct iwl_trans *trans, int txq_id, u16 ssn,
     }
     
     txq->wd_timeout = msecs_to_jiffies(wdg_timeout);
+    iwl_pcie_txq_bql_reset(&txq->bql);
+    
+    /*
+     * A-MSDU subframe headers are built in place, one set per TFD, so that
+     * they don't have to be mapped for every frame. A-MSDUs are only built
+     * on aggregation queues, the others don't get the area.
+     */
+    if (cfg && cfg->aggregate && trans_pcie->amsdu_max_subframes && !txq->amsdu_hdrs) {
+        txq->amsdu_hdrs_dma_ptr = allocate_dma_buf(TFD_QUEUE_SIZE_MAX * IWL_TRANS_AMSDU_MAX_SUBFRAMES *
+                                                   IWL_AMSDU_SUBFRAME_HDR_SIZE,
+                                                   DMA_BIT_MASK(trans_pcie->addr_size));
+        if (txq->amsdu_hdrs_dma_ptr) {
+            txq->amsdu_hdrs = (u8 *)txq->amsdu_hdrs_dma_ptr->addr;
+            txq->amsdu_hdrs_dma = txq->amsdu_hdrs_dma_ptr->dma;
+        } else {
+            IWL_WARN(trans, "Q: %d no A-MSDU header area, A-MSDUs disabled\n", txq_id);
+        }
+    }
     
     if (cfg) {
         fifo = cfg->fifo;
@@ -1209,11 +1736,37 @@ void iwl_trans_pcie_txq_disable(struct iwl_trans *trans, int txq_id, bool config
     iwl_pcie_txq_unmap(trans, txq_id);
     trans_pcie->txq[txq_id]->ampdu = false;
     
+    /* CUSTOM: the queue may come back as a non-aggregation queue */
+    iwl_pcie_txq_free_amsdu_hdrs(trans_pcie->txq[txq_id]);
+    
     IWL_DEBUG_TX_QUEUES(trans, "Deactivate queue %d\n", txq_id);
 }
 
 /*************** HOST COMMAND QUEUE FUNCTIONS   *****/
 
+/* CUSTOM
+ * iwl_pcie_hcmd_build_tb - copy a host command fragment into the TFD
+ *
+ * Fragments are packed into the slot's pre-mapped command buffer, so
+ * neither enqueue nor reclaim touch the allocator.
+ */
+static int iwl_pcie_hcmd_build_tb(struct iwl_trans *trans, struct iwl_txq *txq,
+                                  int idx, u32 *pos, const void *data, u16 len)
+{
+    dma_addr_t addr;
+    
+    /* iwl_pcie_enqueue_hcmd() already refused commands too big for the slot */
+    if (WARN_ON(*pos + len > IWL_PCIE_HCMD_BUF_SIZE))
+        return -EINVAL;
+    
+    memcpy(txq->hcmd_bufs[idx].buf + *pos, data, len);
+    addr = iwl_pcie_get_hcmd_dma(txq, idx) + *pos;
+    *pos = LNX_ALIGN(*pos + len, 4);
+    
+    iwl_pcie_txq_build_tfd(trans, txq, addr, len, false);
+    return 0;
+}
+
 /* line 1440
  * iwl_pcie_enqueue_hcmd - enqueue a uCode command
  * @priv: device private data point
@@ -1230,13 +1783,13 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     struct iwl_device_cmd *out_cmd;
     struct iwl_cmd_meta *out_meta;
     IOInterruptState flags;
-    void *dup_buf = NULL;
+    bool had_dup = false;
     int idx;
     u16 copy_size, cmd_size, tb0_size;
     bool had_nocopy = false;
     u8 group_id = iwl_cmd_groupid(cmd->id);
     int i, ret;
-    u32 cmd_pos;
+    u32 cmd_pos, hcmd_pos = 0;
     const u8 *cmddata[IWL_MAX_CMD_TBS_PER_TFD];
     u16 cmdlen[IWL_MAX_CMD_TBS_PER_TFD];
     
@@ -1276,7 +1829,7 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
             had_nocopy = true;
             if (WARN_ON(cmd->dataflags[i] & IWL_HCMD_DFL_DUP)) {
                 idx = -EINVAL;
-                goto free_dup_buf;
+                goto out;
             }
         } else if (cmd->dataflags[i] & IWL_HCMD_DFL_DUP) {
             /*
@@ -1286,21 +1839,21 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
             had_nocopy = true;
             
             /* only allowed once */
-            if (WARN_ON(dup_buf)) {
+            if (WARN_ON(had_dup)) {
                 idx = -EINVAL;
-                goto free_dup_buf;
+                goto out;
             }
             
-            dup_buf = iwh_malloc(cmdlen[i]);
-            if (!dup_buf)
-                return -ENOMEM;
-            memcpy(dup_buf, cmddata[i], cmdlen[i]);
-           
+            /*
+             * CUSTOM: all fragments are copied into the slot's DMA
+             * buffer below, so the chunk needs no copy of its own.
+             */
+            had_dup = true;
         } else {
             /* NOCOPY must not be followed by normal! */
             if (WARN_ON(had_nocopy)) {
                 idx = -EINVAL;
-                goto free_dup_buf;
+                goto out;
             }
             copy_size += cmdlen[i];
         }
@@ -1315,7 +1868,18 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
      */
     if (copy_size > TFD_MAX_PAYLOAD_SIZE) {
         idx = -EINVAL;
-        goto free_dup_buf;
+        goto out;
+    }
+    
+    /*
+     * CUSTOM: everything but TB0 goes into the slot's command buffer, the
+     * fragments are dword aligned in it and TB0 makes up for the padding.
+     */
+    if (cmd_size > IWL_PCIE_HCMD_BUF_SIZE) {
+        IWL_ERR(trans, "Command %s of %u bytes doesn't fit the command buffer\n",
+                iwl_get_cmd_string(trans, cmd->id), cmd_size);
+        idx = -EINVAL;
+        goto out;
     }
     
     //IOSimpleLockLock(txq->lock);
@@ -1327,7 +1891,7 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
         // TODO: Implement
         //iwl_op_mode_cmd_queue_full(trans->op_mode);
         idx = -ENOSPC;
-        goto free_dup_buf;
+        goto out;
     }
     
     idx = iwl_pcie_get_cmd_index(txq, txq->write_ptr);
@@ -1409,55 +1973,50 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     
     /* map first command fragment, if any remains */
     if (copy_size > tb0_size) {
-        struct iwl_dma_ptr *dma = allocate_dma_buf(copy_size - tb0_size, DMA_BIT_MASK(trans_pcie->addr_size));
-        if (!dma) {
+        ret = iwl_pcie_hcmd_build_tb(trans, txq, idx, &hcmd_pos,
+                                     ((u8 *)&out_cmd->hdr) + tb0_size, copy_size - tb0_size);
+        if (ret) {
             iwl_pcie_tfd_unmap(trans, out_meta, txq, txq->write_ptr);
-            idx = -ENOMEM;
+            idx = ret;
             goto out;
         }
-        out_meta->dma[0] = dma;
-        memcpy(dma->addr, ((u8 *)&out_cmd->hdr) + tb0_size, copy_size - tb0_size);
-        iwl_pcie_txq_build_tfd(trans, txq, dma->dma, copy_size - tb0_size, false);
     }
     
     /* map the remaining (adjusted) nocopy/dup fragments */
     for (i = 0; i < IWL_MAX_CMD_TBS_PER_TFD; i++) {
-        const void *data = cmddata[i];
-        
         if (!cmdlen[i])
             continue;
         if (!(cmd->dataflags[i] & (IWL_HCMD_DFL_NOCOPY | IWL_HCMD_DFL_DUP)))
             continue;
-        if (cmd->dataflags[i] & IWL_HCMD_DFL_DUP)
-            data = dup_buf;
         
-        struct iwl_dma_ptr *dma = allocate_dma_buf(cmdlen[i], DMA_BIT_MASK(trans_pcie->addr_size));
-        if (!dma) {
+        ret = iwl_pcie_hcmd_build_tb(trans, txq, idx, &hcmd_pos, cmddata[i], cmdlen[i]);
+        if (ret) {
             iwl_pcie_tfd_unmap(trans, out_meta, txq, txq->write_ptr);
-            idx = -ENOMEM;
+            idx = ret;
             goto out;
         }
-        out_meta->dma[i + 1] = dma;
-        memcpy(dma->addr, data, cmdlen[i]);
-        iwl_pcie_txq_build_tfd(trans, txq, dma->dma, cmdlen[i], false);
     }
     
     BUILD_BUG_ON(IWL_TFH_NUM_TBS > sizeof(out_meta->tbs) * BITS_PER_BYTE);
     out_meta->flags = cmd->flags;
-    if (txq->entries[idx].free_buf) {
-        IWL_DEBUG_TX(trans, "txq->entries[%d].free_buf is not null", idx);
-        iwh_free((void *)txq->entries[idx].free_buf);
-    }
-    
-    txq->entries[idx].free_buf = dup_buf;
     
     //trace_iwlwifi_dev_hcmd(trans->dev, cmd, cmd_size, &out_cmd->hdr_wide);
     
-    /* start timer if queue currently empty */
-    if (txq->read_ptr == txq->write_ptr && txq->wd_timeout) {
-        // TODO: Implement
-        // mod_timer(&txq->stuck_timer, jiffies + txq->wd_timeout);
+    /* arm the stuck deadline if queue currently empty */
+    if (txq->read_ptr == txq->write_ptr && txq->wd_timeout)
+        txq->stuck_deadline = jiffies + txq->wd_timeout;
+    
+    /* CUSTOM */
+    if (cmd->flags & CMD_WANT_COMPLETION) {
+        struct iwl_pcie_cmd_completion *comp = &trans_pcie->cmd_completion[idx];
+        
+        IOLockLock(trans_pcie->wait_command_queue);
+        comp->gen = (comp->gen + 1) & IWL_PCIE_CMD_GEN_MASK;
+        comp->done = false;
+        cmd->token = IWL_PCIE_CMD_TOKEN(comp->gen, idx);
+        IOLockUnlock(trans_pcie->wait_command_queue);
     }
+    /* CUSTOM END */
 
     flags = IOSimpleLockLockDisableInterrupt(trans_pcie->reg_lock);
     
@@ -1476,9 +2035,6 @@ static int iwl_pcie_enqueue_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *c
     
 out:
     //IOSimpleLockUnlock(txq->lock);
-free_dup_buf:
-//    if (idx < 0)
-//        kfree(dup_buf);
     return idx;
 }
 
@@ -1499,20 +2055,55 @@ static int iwl_pcie_send_hcmd_async(struct iwl_trans *trans, struct iwl_host_cmd
     return 0;
 }
 
-/* line 1723
- * iwl_pcie_hcmd_complete - Pull unused buffers off the queue and reclaim them
- * @rxb: Rx buffer to reclaim
+/* CUSTOM
+ * iwl_pcie_get_resp_buf - pick the buffer for a command response
+ *
+ * Prefers the caller's own buffer, then a free buffer of the response pool.
+ * Only responses that fit neither are allocated. iwl_free_resp() releases
+ * the buffer.
  */
-void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
-                            struct iwl_rx_cmd_buffer *rxb)
+static struct iwl_rx_packet *iwl_pcie_get_resp_buf(struct iwl_trans *trans, struct iwl_host_cmd *cmd, u32 len)
 {
-    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(rxb);
-    u16 sequence = le16_to_cpu(pkt->hdr.sequence);
-    u8 group_id;
-    u32 cmd_id;
-    int txq_id = SEQ_TO_QUEUE(sequence);
-    int index = SEQ_TO_INDEX(sequence);
-    int cmd_index;
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_rx_packet *resp;
+    int i;
+    
+    if (cmd->resp_buf && len <= cmd->resp_buf_len)
+        return (struct iwl_rx_packet *)cmd->resp_buf;
+    
+    if (len <= IWL_RESP_BUF_SIZE) {
+        for (i = 0; i < IWL_RESP_POOL_SIZE; i++) {
+            struct iwl_resp_buf *buf = &trans_pcie->resp_pool[i];
+            
+            if (test_and_set_bit(0, &buf->state))
+                continue;
+            cmd->_resp_pool_buf = buf;
+            return (struct iwl_rx_packet *)buf->data;
+        }
+    }
+    
+    IWL_DEBUG_HC(trans, "Allocating %u bytes for the response of %s\n", len,
+                 iwl_get_cmd_string(trans, cmd->id));
+    resp = (struct iwl_rx_packet *)iwh_malloc(len);
+    if (resp)
+        cmd->_resp_alloc_len = len;
+    return resp;
+}
+
+/* line 1723
+ * iwl_pcie_hcmd_complete - Pull unused buffers off the queue and reclaim them
+ * @rxb: Rx buffer to reclaim
+ */
+void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
+                            struct iwl_rx_cmd_buffer *rxb)
+{
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(rxb);
+    u16 sequence = le16_to_cpu(pkt->hdr.sequence);
+    u8 group_id;
+    u32 cmd_id;
+    int txq_id = SEQ_TO_QUEUE(sequence);
+    int index = SEQ_TO_INDEX(sequence);
+    int cmd_index;
     struct iwl_device_cmd *cmd;
     struct iwl_cmd_meta *meta;
     struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
@@ -1541,11 +2132,18 @@ void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
     
     /* Input error checking is done when commands are added to queue. */
     if (meta->flags & CMD_WANT_SKB) {
-        mbuf_t p = rxb_steal_page(rxb);
+        /* CUSTOM: copy the response, the RX page stays on the ring */
+        u32 len = iwl_rx_packet_len(pkt) + sizeof(u32);
+        struct iwl_rx_packet *resp = iwl_pcie_get_resp_buf(trans, meta->source, len);
         
-        meta->source->resp_pkt = pkt;
-        meta->source->_rx_page_addr = (unsigned long)p;
-        meta->source->_rx_page_order = trans_pcie->rx_page_order;
+        if (resp) {
+            memcpy(resp, pkt, len);
+            meta->source->resp_pkt = resp;
+        } else {
+            IWL_ERR(trans, "No buffer for the %u byte response of %s\n", len,
+                    iwl_get_cmd_string(trans, cmd_id));
+            meta->source->_resp_alloc_failed = true;
+        }
     }
     
     if (meta->flags & CMD_WANT_ASYNC_CALLBACK)
@@ -1565,6 +2163,17 @@ void IntelWifi::iwl_pcie_hcmd_complete(struct iwl_trans *trans,
         IOLockUnlock(trans_pcie->wait_command_queue);
     }
     
+    /* CUSTOM */
+    if (meta->flags & CMD_WANT_COMPLETION) {
+        struct iwl_pcie_cmd_completion *comp = &trans_pcie->cmd_completion[cmd_index];
+        
+        IOLockLock(trans_pcie->wait_command_queue);
+        comp->done = true;
+        IOLockWakeup(trans_pcie->wait_command_queue, comp, false);
+        IOLockUnlock(trans_pcie->wait_command_queue);
+    }
+    /* CUSTOM END */
+    
     if (meta->flags & CMD_MAKE_TRANS_IDLE) {
         IWL_DEBUG_INFO(trans, "complete %s - mark trans as idle\n", iwl_get_cmd_string(trans, cmd->hdr.cmd));
         set_bit(STATUS_TRANS_IDLE, &trans->status);
@@ -1601,6 +2210,9 @@ static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd
     
     IWL_DEBUG_INFO(trans, "Setting HCMD_ACTIVE for command %s\n", iwl_get_cmd_string(trans, cmd->id));
     
+    cmd->resp_pkt = NULL;
+    cmd->_resp_alloc_failed = false;
+    
 //    if (pm_runtime_suspended(&trans_pcie->pci_dev->dev)) {
 //        ret = wait_event_timeout(trans_pcie->d0i3_waitq,
 //                                 pm_runtime_active(&trans_pcie->pci_dev->dev),
@@ -1660,7 +2272,7 @@ static int iwl_pcie_send_hcmd_sync(struct iwl_trans *trans, struct iwl_host_cmd
     if ((cmd->flags & CMD_WANT_SKB) && !cmd->resp_pkt) {
         IWL_ERR(trans, "Error: Response NULL in '%s'\n",
                 iwl_get_cmd_string(trans, cmd->id));
-        ret = -EIO;
+        ret = cmd->_resp_alloc_failed ? -ENOMEM : -EIO;
         goto cancel;
     }
     
@@ -1685,6 +2297,86 @@ cancel:
     return ret;
 }
 
+/* CUSTOM
+ * iwl_trans_pcie_wait_cmds - wait for pipelined host commands
+ *
+ * The commands were enqueued back to back with CMD_WANT_COMPLETION, so the
+ * firmware works through all of them while we sleep once per batch instead
+ * of once per command. All of them share a single deadline. A token whose
+ * slot was already reused by a later command is complete by definition.
+ */
+int iwl_trans_pcie_wait_cmds(struct iwl_trans *trans, const u32 *tokens, int n_tokens)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *txq = trans_pcie->txq[trans_pcie->cmd_queue];
+    AbsoluteTime deadline;
+    int ret = 0;
+    int i;
+    
+    clock_interval_to_deadline(HOST_COMPLETE_TIMEOUT * 2, kMillisecondScale, (UInt64 *) &deadline);
+    
+    IOLockLock(trans_pcie->wait_command_queue);
+    for (i = 0; i < n_tokens; i++) {
+        u32 idx = IWL_PCIE_CMD_TOKEN_IDX(tokens[i]);
+        u32 gen = IWL_PCIE_CMD_TOKEN_GEN(tokens[i]);
+        struct iwl_pcie_cmd_completion *comp;
+        
+        if (WARN_ON(idx >= TFD_CMD_SLOTS)) {
+            ret = -EINVAL;
+            break;
+        }
+        comp = &trans_pcie->cmd_completion[idx];
+        
+        while (comp->gen == gen && !comp->done) {
+            if (test_bit(STATUS_FW_ERROR, &trans->status)) {
+                ret = -EIO;
+                break;
+            }
+            if (test_bit(STATUS_RFKILL_OPMODE, &trans->status)) {
+                ret = -ERFKILL;
+                break;
+            }
+            if (IOLockSleepDeadline(trans_pcie->wait_command_queue, comp, deadline,
+                                    THREAD_INTERRUPTIBLE) != THREAD_AWAKENED) {
+                ret = -ETIMEDOUT;
+                break;
+            }
+        }
+        if (ret)
+            break;
+    }
+    IOLockUnlock(trans_pcie->wait_command_queue);
+    
+    if (ret == -ETIMEDOUT) {
+        IWL_ERR(trans, "Error waiting for %d pipelined commands: time out after %dms.\n",
+                n_tokens - i, HOST_COMPLETE_TIMEOUT);
+        IWL_ERR(trans, "Current CMD queue read_ptr %d write_ptr %d\n", txq->read_ptr, txq->write_ptr);
+        
+        iwl_force_nmi(trans);
+    } else if (ret == -EIO) {
+        IWL_ERR(trans, "FW error while waiting for pipelined commands\n");
+    } else if (ret == -ERFKILL) {
+        IWL_DEBUG_RF_KILL(trans, "RFKILL while waiting for pipelined commands\n");
+    }
+    
+    return ret;
+}
+
+/* CUSTOM
+ * Wake up everybody waiting for a pipelined command, used when the firmware
+ * is gone and the responses will never arrive.
+ */
+void iwl_pcie_cmd_completion_wake_all(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    int i;
+    
+    IOLockLock(trans_pcie->wait_command_queue);
+    for (i = 0; i < TFD_CMD_SLOTS; i++)
+        IOLockWakeup(trans_pcie->wait_command_queue, &trans_pcie->cmd_completion[i], false);
+    IOLockUnlock(trans_pcie->wait_command_queue);
+}
+
 
 
 // line 1935
@@ -1704,36 +2396,501 @@ int iwl_trans_pcie_send_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
 
 
 
-// line 2256
-int iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
-                      struct iwl_device_cmd *dev_cmd, int txq_id)
+/*
+ * iwl_fill_data_tbs - map the payload of an mbuf chain into the TFD
+ *
+ * The whole chain is described by the TX memory cursor and every physical
+ * segment goes into its own TB, nothing is copied. The 802.11 header was
+ * already copied into the TX command by the op mode, so the first @hdr_len
+ * bytes of the chain are skipped. A chain that needs more TBs than the TFD
+ * can hold is rejected instead of being linearized.
+ */
+static int iwl_fill_data_tbs(struct iwl_trans *trans, mbuf_t skb, struct iwl_txq *txq, u8 hdr_len,
+                             struct iwl_cmd_meta *out_meta)
 {
-    // TODO: Implement...
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    IOMbufNaturalMemoryCursor *curs = static_cast<IOMbufNaturalMemoryCursor *>(trans->tx_mbuf_cursor);
+    IOPhysicalSegment segs[IWL_TFH_NUM_TBS];
+    u32 skip = hdr_len;
+    UInt32 nsegs, i;
+    
+    /* TB0 and TB1 are taken by the TX command, the rest is for the data */
+    nsegs = curs->getPhysicalSegments(skb, segs, IWL_PCIE_MAX_FRAGS(trans_pcie) + 1);
+    if (!nsegs) {
+        IWL_ERR(trans, "Can't map mbuf chain of %lu bytes into %d TBs\n",
+                mbuf_pkthdr_len(skb), IWL_PCIE_MAX_FRAGS(trans_pcie) + 1);
+        return -EINVAL;
+    }
+    
+    for (i = 0; i < nsegs; i++) {
+        u64 tb_phys = segs[i].location;
+        u32 tb_len = segs[i].length;
+        int tb_idx;
+        
+        if (!iwl_tx_skip_seg(&skip, &tb_phys, &tb_len))
+            continue;
+        
+        tb_idx = iwl_pcie_txq_build_tfd(trans, txq, tb_phys, tb_len, false);
+        if (tb_idx < 0)
+            return tb_idx;
+        out_meta->tbs |= BIT(tb_idx);
+    }
     
     return 0;
+}
     
-//    mbuf_t mb;
-//    
-//    
-//    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
-////    struct ieee80211_hdr *hdr;
-//    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
-//    struct iwl_cmd_meta *out_meta;
-//    struct iwl_txq *txq;
-//    dma_addr_t tb0_phys, tb1_phys, scratch_phys;
-//    void *tb1_addr;
-//    void *tfd;
-//    u16 len, tb1_len;
-//    bool wait_write_ptr;
-//    __le16 fc;
-//    u8 hdr_len;
-//    u16 wifi_seq;
-//    bool amsdu;
-//    
-//    txq = trans_pcie->txq[txq_id];
-//
-//    if (!test_bit(txq_id, trans_pcie->queue_used))
-//        return -EINVAL;
+/*
+ * CUSTOM
+ */
+
+/*
+ * iwl_pcie_txq_reserve - make sure there is room for one more TFD
+ *
+ * Stops the queue when it crosses the high mark. Fails when the ring is
+ * really full. The byte limit is checked once the frame is on the ring, see
+ * iwl_pcie_tx_commit().
+ */
+static int iwl_pcie_txq_reserve(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    if (iwl_queue_space(txq) < txq->high_mark) {
+        iwl_stop_queue(trans, txq);
+        
+        /* don't put the packet on the ring, if there is no room */
+        if (unlikely(iwl_queue_space(txq) < 3))
+            return -ENOSPC;
+    }
+    
+    return 0;
+}
+
+/*
+ * iwl_pcie_tx_build_cmd_tbs - set up TB0 and TB1 of the TFD at write_ptr
+ *
+ * TB0 is the bi-directional first TB buffer, TB1 holds the remainder of the
+ * TX command and the 802.11 header. Both live in per-slot buffers that were
+ * mapped with the queue, nothing is mapped here.
+ */
+static int iwl_pcie_tx_build_cmd_tbs(struct iwl_trans *trans, struct iwl_txq *txq,
+                                     struct iwl_device_cmd *dev_cmd, u8 hdr_len, bool amsdu)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
+    dma_addr_t tb0_phys, scratch_phys;
+    u16 len, tb1_len;
+    
+    dev_cmd->hdr.sequence = cpu_to_le16((u16)(QUEUE_TO_SEQ(txq->id) | INDEX_TO_SEQ(txq->write_ptr)));
+    
+    tb0_phys = iwl_pcie_get_first_tb_dma(txq, txq->write_ptr);
+    scratch_phys = tb0_phys + sizeof(struct iwl_cmd_header) + offsetof(struct iwl_tx_cmd, scratch);
+    
+    tx_cmd->dram_lsb_ptr = cpu_to_le32(scratch_phys);
+    tx_cmd->dram_msb_ptr = iwl_get_dma_hi_addr(scratch_phys);
+    
+    /*
+     * The second TB (tb1) points to the remainder of the TX command
+     * and the 802.11 header - dword aligned size
+     * (This calculation modifies the TX command, so do it before the
+     * setup of the first TB)
+     */
+    len = sizeof(struct iwl_tx_cmd) + sizeof(struct iwl_cmd_header) + hdr_len - IWL_FIRST_TB_SIZE;
+    /* do not align A-MSDU to dword as the subframe header aligns it */
+    if (trans_pcie->sw_csum_tx || !amsdu) {
+        tb1_len = LNX_ALIGN(len, 4);
+        /* Tell NIC about any 2-byte padding after MAC header */
+        if (tb1_len != len)
+            tx_cmd->tx_flags |= cpu_to_le32(TX_CMD_FLG_MH_PAD);
+    } else {
+        tb1_len = len;
+    }
+    
+    /*
+     * The first TB points to bi-directional DMA data, we'll
+     * memcpy the data into it later.
+     */
+    iwl_pcie_txq_build_tfd(trans, txq, tb0_phys, IWL_FIRST_TB_SIZE, true);
+    
+    /* there must be data left over for TB1 or this code must be changed */
+    BUILD_BUG_ON(sizeof(struct iwl_tx_cmd) < IWL_FIRST_TB_SIZE);
+    
+    /* the largest 802.11 header must fit in the TB1 buffer */
+    BUILD_BUG_ON(LNX_ALIGN(sizeof(struct iwl_tx_cmd) + sizeof(struct iwl_cmd_header) +
+                           sizeof(struct ieee80211_hdr) + IEEE80211_QOS_CTL_LEN +
+                           IEEE80211_HT_CTL_LEN - IWL_FIRST_TB_SIZE, 4) > IWL_TB1_BUF_SIZE);
+    
+    if (WARN_ON(tb1_len > sizeof(struct iwl_pcie_tb1_buf)))
+        return -EINVAL;
+    
+    /* TB1 is copied into the pre-mapped buffer of this slot */
+    memcpy(txq->tb1_bufs[txq->write_ptr].buf, ((u8 *)&dev_cmd->hdr) + IWL_FIRST_TB_SIZE, tb1_len);
+    iwl_pcie_txq_build_tfd(trans, txq, iwl_pcie_get_tb1_dma(txq, txq->write_ptr), tb1_len, false);
+    
+    return 0;
+}
+
+/*
+ * iwl_pcie_tx_commit - hand the TFD at write_ptr over to the device
+ *
+ * Fills TB0, the byte count table and moves the write pointer. The doorbell
+ * is held back while the caller announces more frames, up to the batching
+ * limits.
+ */
+static void iwl_pcie_tx_commit(struct iwl_trans *trans, struct iwl_txq *txq,
+                               struct iwl_device_cmd *dev_cmd, u32 bytes,
+                               bool wait_write_ptr, bool xmit_more)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
+    void *tfd;
+    
+    memcpy(&txq->first_tb_bufs[txq->write_ptr], &dev_cmd->hdr, IWL_FIRST_TB_SIZE);
+    
+    tfd = iwl_pcie_get_tfd(trans_pcie, txq, txq->write_ptr);
+    /* Set up entry for this TFD in Tx byte-count array */
+    iwl_pcie_txq_update_byte_cnt_tbl(trans, txq, le16_to_cpu(tx_cmd->len),
+                                     iwl_pcie_tfd_get_num_tbs(trans, tfd));
+    
+    /* arm the stuck deadline if queue currently empty */
+    if (txq->read_ptr == txq->write_ptr) {
+        if (txq->wd_timeout) {
+            /*
+             * If the TXQ is active, then set the deadline, if not,
+             * keep it in the remainder so that the deadline will
+             * be armed with the right value when the station will
+             * wake up.
+             */
+            if (!txq->frozen)
+                txq->stuck_deadline = jiffies + txq->wd_timeout;
+            else
+                txq->frozen_expiry_remainder = txq->wd_timeout;
+        }
+        IWL_DEBUG_RPM(trans, "Q: %d first tx - take ref\n", txq->id);
+        iwl_trans_ref(trans);
+    }
+    
+    txq->entries[txq->write_ptr].bytes = bytes;
+    iwl_txq_bql_queued(&txq->bql, bytes);
+    
+    /*
+     * Like netdev_tx_sent_queue(): the frame goes out, but the stack has
+     * to wait for completions once the byte limit is used up.
+     */
+    if (iwl_txq_bql_avail(&txq->bql) < 0)
+        iwl_stop_queue(trans, txq);
+    
+    /* Tell device the write index *just past* this latest filled TFD */
+    txq->write_ptr = iwl_queue_inc_wrap(txq->write_ptr);
+    txq->db_pending_frames++;
+    txq->db_pending_bytes += bytes;
+    trans_pcie->tx_stats.packets++;
+    
+    /*
+     * Within a burst the write pointer is published once, when the caller
+     * stops announcing more frames or when too much is held back.
+     */
+    if (xmit_more && !wait_write_ptr &&
+        txq->db_pending_frames < trans_pcie->tx_db_batch_frames &&
+        txq->db_pending_bytes < trans_pcie->tx_db_batch_bytes) {
+        trans_pcie->tx_stats.deferred++;
+        wait_write_ptr = true;
+    }
+    
+    if (!wait_write_ptr)
+        iwl_pcie_txq_inc_wr_ptr(trans, txq);
+}
+
+static int iwl_pcie_txq_flush_amsdu(struct iwl_trans *trans, struct iwl_txq *txq, bool xmit_more);
+static int iwl_pcie_tx_amsdu_frame(struct iwl_trans *trans, struct iwl_txq *txq, mbuf_t head,
+                                   struct iwl_device_cmd *dev_cmd, u32 len, u8 n_subframes,
+                                   bool xmit_more);
+
+/*
+ * iwl_pcie_txq_overflow_push - hold a frame back until the queue has room
+ *
+ * Called with txq->lock held. @amsdu_len and @amsdu_subframes describe an
+ * A-MSDU, they are 0 for an 802.11 frame. Returns false if the overflow
+ * queue is full too.
+ */
+static bool iwl_pcie_txq_overflow_push(struct iwl_trans *trans, struct iwl_txq *txq,
+                                       mbuf_t skb, struct iwl_device_cmd *dev_cmd,
+                                       u32 amsdu_len, u8 amsdu_subframes)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq_overflow *ovf = &txq->overflow_q;
+    u32 head = ovf->head;
+    u32 depth = head - ovf->tail;
+    
+    if (depth >= IWL_TXQ_OVERFLOW_SIZE) {
+        trans_pcie->tx_stats.overflow_drops++;
+        return false;
+    }
+    
+    ovf->entries[head & (IWL_TXQ_OVERFLOW_SIZE - 1)].skb = skb;
+    ovf->entries[head & (IWL_TXQ_OVERFLOW_SIZE - 1)].dev_cmd = dev_cmd;
+    ovf->entries[head & (IWL_TXQ_OVERFLOW_SIZE - 1)].amsdu_len = amsdu_len;
+    ovf->entries[head & (IWL_TXQ_OVERFLOW_SIZE - 1)].amsdu_subframes = amsdu_subframes;
+    ovf->head = head + 1;
+    
+    trans_pcie->tx_stats.overflowed++;
+    if (depth + 1 > trans_pcie->tx_stats.overflow_max_depth)
+        trans_pcie->tx_stats.overflow_max_depth = depth + 1;
+    
+    return true;
+}
+
+/*
+ * iwl_pcie_tx_frame - put an 802.11 frame on the ring
+ *
+ * Called with txq->lock held. Returns -ENOSPC without touching the ring if
+ * there is no room for the frame.
+ */
+static int iwl_pcie_tx_frame(struct iwl_trans *trans, struct iwl_txq *txq, mbuf_t skb,
+                             struct iwl_device_cmd *dev_cmd, bool xmit_more)
+{
+    struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)mbuf_data(skb);
+    struct iwl_cmd_meta *out_meta;
+    __le16 fc = hdr->frame_control;
+    u8 hdr_len = ieee80211_hdrlen(fc);
+    u16 wifi_seq;
+    
+    if (iwl_pcie_txq_reserve(trans, txq))
+        return -ENOSPC;
+    
+    /* In AGG mode, the index in the ring must correspond to the WiFi
+     * sequence number. This is a HW requirements to help the SCD to parse
+     * the BA.
+     * Check here that the packets are in the right place on the ring.
+     */
+    if (txq->ampdu) {
+        /* CUSTOM: only QoS data goes to aggregation queues, it has a seq_ctrl */
+        wifi_seq = IEEE80211_SEQ_TO_SN(le16_to_cpu(hdr->seq_ctrl));
+        if ((wifi_seq & 0xff) != txq->write_ptr)
+            IWL_WARN(trans, "Q: %d WiFi Seq %d tfdNum %d", txq->id, wifi_seq, txq->write_ptr);
+    }
+    
+    /* Set up driver data for this TFD */
+    txq->entries[txq->write_ptr].skb = skb;
+    txq->entries[txq->write_ptr].cmd = dev_cmd;
+    
+    /* Set up first empty entry in queue's array of Tx/cmd buffers */
+    out_meta = &txq->entries[txq->write_ptr].meta;
+    memset(out_meta, 0, sizeof(*out_meta));
+    
+    /* A-MSDUs are built by iwl_pcie_tx_amsdu_frame, iwl_trans_pcie_tx refuses them */
+    if (unlikely(iwl_pcie_tx_build_cmd_tbs(trans, txq, dev_cmd, hdr_len, false)))
+        goto out_err;
+    
+    /* the payload is mapped straight from the mbuf chain */
+    if (unlikely(iwl_fill_data_tbs(trans, skb, txq, hdr_len, out_meta)))
+        goto out_err;
+    
+    iwl_pcie_tx_commit(trans, txq, dev_cmd, (u32)mbuf_pkthdr_len(skb),
+                       ieee80211_has_morefrags(fc), xmit_more);
+    return 0;
+out_err:
+    iwl_pcie_tfd_unmap(trans, out_meta, txq, txq->write_ptr);
+    txq->entries[txq->write_ptr].skb = NULL;
+    txq->entries[txq->write_ptr].cmd = NULL;
+    return -1;
+}
+
+/*
+ * iwl_pcie_txq_overflow_drain - send the frames held back on a full queue
+ *
+ * Called from the reclaim path without txq->lock, it is only taken to put
+ * one frame on the ring. The stack's queue is stopped, but a frame of the
+ * TX path may already be on its way. It finds the overflow queue not empty
+ * and goes to its end, as tail only moves once a frame is on the ring. An
+ * A-MSDU held back on the stage follows once the overflow queue is empty.
+ */
+static void iwl_pcie_txq_overflow_drain(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq_overflow *ovf = &txq->overflow_q;
+    
+    IOSimpleLockLock(txq->lock);
+    
+    while (ovf->tail != ovf->head) {
+        u32 idx = ovf->tail & (IWL_TXQ_OVERFLOW_SIZE - 1);
+        mbuf_t skb = ovf->entries[idx].skb;
+        struct iwl_device_cmd *dev_cmd = ovf->entries[idx].dev_cmd;
+        bool more = ovf->tail + 1 != ovf->head;
+        int ret;
+        
+        /*
+         * Note that we can very well be overflowing again.
+         * In that case, the frame stays where it is and iwl_queue_space
+         * will be small again so we won't wake the queue.
+         */
+        if (ovf->entries[idx].amsdu_subframes)
+            ret = iwl_pcie_tx_amsdu_frame(trans, txq, skb, dev_cmd, ovf->entries[idx].amsdu_len,
+                                          ovf->entries[idx].amsdu_subframes, more);
+        else
+            ret = iwl_pcie_tx_frame(trans, txq, skb, dev_cmd, more);
+        if (ret == -ENOSPC)
+            break;
+        
+        ovf->entries[idx].skb = NULL;
+        ovf->entries[idx].dev_cmd = NULL;
+        ovf->tail++;
+        if (ret)
+            trans_pcie->tx_stats.overflow_drops++;
+        
+        IOSimpleLockUnlock(txq->lock);
+        
+        if (ret) {
+            iwl_pcie_free_tx_mbuf(trans, skb);
+            iwl_trans_free_tx_cmd(trans, dev_cmd);
+        }
+        
+        IOSimpleLockLock(txq->lock);
+    }
+    
+    if (txq->amsdu.held && ovf->tail == ovf->head)
+        iwl_pcie_txq_flush_amsdu(trans, txq, false);
+    
+    if (txq->db_pending_frames)
+        iwl_pcie_txq_inc_wr_ptr(trans, txq);
+    
+    IOSimpleLockUnlock(txq->lock);
+}
+
+/*
+ * iwl_pcie_txq_overflow_free - drop the frames held back on a queue
+ *
+ * Called with txq->lock held.
+ */
+static void iwl_pcie_txq_overflow_free(struct iwl_trans *trans, struct iwl_txq *txq)
+{
+    struct iwl_txq_overflow *ovf = &txq->overflow_q;
+    
+    while (ovf->tail != ovf->head) {
+        u32 idx = ovf->tail & (IWL_TXQ_OVERFLOW_SIZE - 1);
+        
+        iwl_pcie_free_tx_mbuf(trans, ovf->entries[idx].skb);
+        iwl_trans_free_tx_cmd(trans, ovf->entries[idx].dev_cmd);
+        ovf->entries[idx].skb = NULL;
+        ovf->entries[idx].dev_cmd = NULL;
+        ovf->tail++;
+    }
+}
+
+/*
+ * Software TX checksum
+ *
+ * The driver advertises IPv4, TCP and UDP checksum offload to the stack,
+ * which none of the supported devices can do in hardware. The checksums
+ * are filled in here, right before the frame is put on the ring.
+ */
+
+/* one's complement sum of @len bytes of the chain starting at @off */
+static int iwl_csum_mbuf(mbuf_t m, u32 off, u32 len, u16 *csum)
+{
+    u64 sum = 0;
+    bool odd = false;
+    
+    for (; m && len; m = mbuf_next(m)) {
+        u32 mlen = (u32)mbuf_len(m);
+        u32 n;
+        u16 s;
+        
+        if (off >= mlen) {
+            off -= mlen;
+            continue;
+        }
+        
+        n = min_t(u32, mlen - off, len);
+        s = iwl_csum_block((u8 *)mbuf_data(m) + off, n);
+        /* a block starting at an odd offset has its bytes swapped */
+        if (odd)
+            s = (u16)((s << 8) | (s >> 8));
+        sum += s;
+        
+        odd ^= n & 1;
+        len -= n;
+        off = 0;
+    }
+    
+    if (len)
+        return -EINVAL;
+    
+    *csum = iwl_csum_fold(sum);
+    return 0;
+}
+
+/*
+ * iwl_pcie_tx_csum - fill in the checksums the stack left to the driver
+ * @l3_off: offset of the IPv4 header in the chain
+ *
+ * The stack already put the pseudo header sum into the TCP/UDP checksum
+ * field and passes the offset of that field in the checksum data.
+ */
+static int iwl_pcie_tx_csum(struct iwl_trans *trans, mbuf_t skb, u32 l3_off)
+{
+    mbuf_csum_request_flags_t request;
+    u32 value;
+    u8 iph[20];
+    u32 ihl, tot_len;
+    u16 csum;
+    
+    if (mbuf_get_csum_requested(skb, &request, &value) ||
+        !(request & (MBUF_CSUM_REQ_IP | MBUF_CSUM_REQ_TCP | MBUF_CSUM_REQ_UDP)))
+        return 0;
+    
+    if (mbuf_copydata(skb, l3_off, sizeof(iph), iph) || (iph[0] >> 4) != 4)
+        goto err;
+    
+    ihl = (iph[0] & 0xf) * 4;
+    tot_len = (iph[2] << 8) | iph[3];
+    if (ihl < sizeof(iph) || tot_len < ihl)
+        goto err;
+    
+    if (request & MBUF_CSUM_REQ_IP) {
+        csum = 0;
+        if (mbuf_copyback(skb, l3_off + 10, sizeof(csum), &csum, MBUF_DONTWAIT) ||
+            iwl_csum_mbuf(skb, l3_off, ihl, &csum))
+            goto err;
+        csum = ~csum;
+        if (mbuf_copyback(skb, l3_off + 10, sizeof(csum), &csum, MBUF_DONTWAIT))
+            goto err;
+    }
+    
+    if (request & (MBUF_CSUM_REQ_TCP | MBUF_CSUM_REQ_UDP)) {
+        u32 l4_off = l3_off + ihl;
+        
+        if (iwl_csum_mbuf(skb, l4_off, tot_len - ihl, &csum))
+            goto err;
+        csum = ~csum;
+        /* zero means no checksum for UDP */
+        if ((request & MBUF_CSUM_REQ_UDP) && !csum)
+            csum = 0xffff;
+        if (mbuf_copyback(skb, l4_off + (value & 0xffff), sizeof(csum), &csum, MBUF_DONTWAIT))
+            goto err;
+    }
+    
+    mbuf_clear_csum_requested(skb);
+    return 0;
+
+err:
+    IWL_DEBUG_TX(trans, "Can't compute checksum, request 0x%x\n", request);
+    return -EINVAL;
+}
+
+/* CUSTOM END */
+
+// line 2256
+int iwl_trans_pcie_tx(struct iwl_trans *trans, mbuf_t skb,
+                      struct iwl_device_cmd *dev_cmd, int txq_id, bool xmit_more)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct ieee80211_hdr *hdr;
+    struct iwl_txq *txq;
+    u8 hdr_len;
+    int ret;
+    
+    txq = trans_pcie->txq[txq_id];
+    
+    if (!test_bit(txq_id, trans_pcie->queue_used))
+        return -EINVAL;
 
 //    if (unlikely(trans_pcie->sw_csum_tx && skb->ip_summed == CHECKSUM_PARTIAL)) {
 //        int offs = skb_checksum_start_offset(skb);
@@ -1749,163 +2906,368 @@ int iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
 //        skb->ip_summed = CHECKSUM_UNNECESSARY;
 //    }
 
-//    if (skb_is_nonlinear(skb) &&
-//        skb_shinfo(skb)->nr_frags > IWL_PCIE_MAX_FRAGS(trans_pcie) &&
-//        __skb_linearize(skb))
-//        return -ENOMEM;
-//
     /* mac80211 always puts the full header into the SKB's head,
-     * so there's no need to check if it's readable there
+     * the same is expected from the first mbuf of the chain
      */
+    if (mbuf_len(skb) < sizeof(hdr->frame_control))
+        return -EINVAL;
     
-//    hdr = (struct ieee80211_hdr *)skb->data;
-//    fc = hdr->frame_control;
-//    hdr_len = ieee80211_hdrlen(fc);
-//
-//    spin_lock(&txq->lock);
-//
-//    if (iwl_queue_space(txq) < txq->high_mark) {
-//        iwl_stop_queue(trans, txq);
-//
-//        /* don't put the packet on the ring, if there is no room */
-//        if (unlikely(iwl_queue_space(txq) < 3)) {
-//            struct iwl_device_cmd **dev_cmd_ptr;
-//
-//            dev_cmd_ptr = (void *)((u8 *)skb->cb +
-//                                   trans_pcie->dev_cmd_offs);
-//
-//            *dev_cmd_ptr = dev_cmd;
-//            __skb_queue_tail(&txq->overflow_q, skb);
-//
-//            spin_unlock(&txq->lock);
-//            return 0;
-//        }
-//    }
+    hdr = (struct ieee80211_hdr *)mbuf_data(skb);
+    hdr_len = ieee80211_hdrlen(hdr->frame_control);
 
-//    /* In AGG mode, the index in the ring must correspond to the WiFi
-//     * sequence number. This is a HW requirements to help the SCD to parse
-//     * the BA.
-//     * Check here that the packets are in the right place on the ring.
-//     */
-//    wifi_seq = IEEE80211_SEQ_TO_SN(le16_to_cpu(hdr->seq_ctrl));
-//    WARN_ONCE(txq->ampdu &&
-//              (wifi_seq & 0xff) != txq->write_ptr,
-//              "Q: %d WiFi Seq %d tfdNum %d",
-//              txq_id, wifi_seq, txq->write_ptr);
-//
-//    /* Set up driver data for this TFD */
-//    txq->entries[txq->write_ptr].skb = skb;
-//    txq->entries[txq->write_ptr].cmd = dev_cmd;
-//
-//    dev_cmd->hdr.sequence =
-//    cpu_to_le16((u16)(QUEUE_TO_SEQ(txq_id) |
-//                      INDEX_TO_SEQ(txq->write_ptr)));
-//
-//    tb0_phys = iwl_pcie_get_first_tb_dma(txq, txq->write_ptr);
-//    scratch_phys = tb0_phys + sizeof(struct iwl_cmd_header) +
-//    offsetof(struct iwl_tx_cmd, scratch);
-//
-//    tx_cmd->dram_lsb_ptr = cpu_to_le32(scratch_phys);
-//    tx_cmd->dram_msb_ptr = iwl_get_dma_hi_addr(scratch_phys);
-//
-//    /* Set up first empty entry in queue's array of Tx/cmd buffers */
-//    out_meta = &txq->entries[txq->write_ptr].meta;
-//    out_meta->flags = 0;
-//
-//    /*
-//     * The second TB (tb1) points to the remainder of the TX command
-//     * and the 802.11 header - dword aligned size
-//     * (This calculation modifies the TX command, so do it before the
-//     * setup of the first TB)
-//     */
-//    len = sizeof(struct iwl_tx_cmd) + sizeof(struct iwl_cmd_header) +
-//    hdr_len - IWL_FIRST_TB_SIZE;
-//    /* do not align A-MSDU to dword as the subframe header aligns it */
-//    amsdu = ieee80211_is_data_qos(fc) &&
-//    (*ieee80211_get_qos_ctl(hdr) &
-//     IEEE80211_QOS_CTL_A_MSDU_PRESENT);
-//    if (trans_pcie->sw_csum_tx || !amsdu) {
-//        tb1_len = ALIGN(len, 4);
-//        /* Tell NIC about any 2-byte padding after MAC header */
-//        if (tb1_len != len)
-//            tx_cmd->tx_flags |= cpu_to_le32(TX_CMD_FLG_MH_PAD);
-//    } else {
-//        tb1_len = len;
-//    }
-//
-//    /*
-//     * The first TB points to bi-directional DMA data, we'll
-//     * memcpy the data into it later.
-//     */
-//    iwl_pcie_txq_build_tfd(trans, txq, tb0_phys,
-//                           IWL_FIRST_TB_SIZE, true);
-//
-//    /* there must be data left over for TB1 or this code must be changed */
-//    BUILD_BUG_ON(sizeof(struct iwl_tx_cmd) < IWL_FIRST_TB_SIZE);
-//
-//    /* map the data for TB1 */
-//    tb1_addr = ((u8 *)&dev_cmd->hdr) + IWL_FIRST_TB_SIZE;
-//    tb1_phys = dma_map_single(trans->dev, tb1_addr, tb1_len, DMA_TO_DEVICE);
-//    if (unlikely(dma_mapping_error(trans->dev, tb1_phys)))
-//        goto out_err;
-//    iwl_pcie_txq_build_tfd(trans, txq, tb1_phys, tb1_len, false);
-//
-//    if (amsdu) {
-//        if (unlikely(iwl_fill_data_tbs_amsdu(trans, skb, txq, hdr_len,
-//                                             out_meta, dev_cmd,
-//                                             tb1_len)))
-//            goto out_err;
-//    } else if (unlikely(iwl_fill_data_tbs(trans, skb, txq, hdr_len,
-//                                          out_meta, dev_cmd, tb1_len))) {
-//        goto out_err;
-//    }
-//
-//    /* building the A-MSDU might have changed this data, so memcpy it now */
-//    memcpy(&txq->first_tb_bufs[txq->write_ptr], &dev_cmd->hdr,
-//           IWL_FIRST_TB_SIZE);
-//
-//    tfd = iwl_pcie_get_tfd(trans_pcie, txq, txq->write_ptr);
-//    /* Set up entry for this TFD in Tx byte-count array */
-//    iwl_pcie_txq_update_byte_cnt_tbl(trans, txq, le16_to_cpu(tx_cmd->len),
-//                                     iwl_pcie_tfd_get_num_tbs(trans, tfd));
-//
-//    wait_write_ptr = ieee80211_has_morefrags(fc);
-//
-//    /* start timer if queue currently empty */
-//    if (txq->read_ptr == txq->write_ptr) {
-//        if (txq->wd_timeout) {
-//            /*
-//             * If the TXQ is active, then set the timer, if not,
-//             * set the timer in remainder so that the timer will
-//             * be armed with the right value when the station will
-//             * wake up.
-//             */
-//            if (!txq->frozen)
-//                mod_timer(&txq->stuck_timer,
-//                          jiffies + txq->wd_timeout);
-//            else
-//                txq->frozen_expiry_remainder = txq->wd_timeout;
-//        }
-//        IWL_DEBUG_RPM(trans, "Q: %d first tx - take ref\n", txq->id);
-//        iwl_trans_ref(trans);
-//    }
-//
-//    /* Tell device the write index *just past* this latest filled TFD */
-//    txq->write_ptr = iwl_queue_inc_wrap(txq->write_ptr);
-//    if (!wait_write_ptr)
-//        iwl_pcie_txq_inc_wr_ptr(trans, txq);
-//
-//    /*
-//     * At this point the frame is "transmitted" successfully
-//     * and we will get a TX status notification eventually.
-//     */
-//    spin_unlock(&txq->lock);
-//    return 0;
-//out_err:
-//    spin_unlock(&txq->lock);
-//    return -1;
+    if (mbuf_len(skb) < hdr_len)
+        return -EINVAL;
+    
+    /* CUSTOM: A-MSDUs are gathered from 802.3 frames by iwl_trans_tx_amsdu */
+    if (ieee80211_is_data_qos(hdr->frame_control) &&
+        (*ieee80211_get_qos_ctl(hdr) & IEEE80211_QOS_CTL_A_MSDU_PRESENT)) {
+        IWL_ERR(trans, "Q: %d refusing a ready-made A-MSDU\n", txq_id);
+        return -EINVAL;
+    }
+    
+    /* CUSTOM: the IPv4 header follows the LLC/SNAP header */
+    ret = iwl_pcie_tx_csum(trans, skb, hdr_len + IWL_AMSDU_SNAP_LEN);
+    if (ret)
+        return ret;
+    
+    IOSimpleLockLock(txq->lock);
+    
+    /* frames gathered for an A-MSDU go out first to keep the queue ordered */
+    if (txq->amsdu.head && iwl_pcie_txq_flush_amsdu(trans, txq, true)) {
+        IOSimpleLockUnlock(txq->lock);
+        return -ENOSPC;
+    }
+    
+    /* same for frames already waiting for room */
+    if (iwl_txq_overflow_depth(&txq->overflow_q))
+        ret = -ENOSPC;
+    else
+        ret = iwl_pcie_tx_frame(trans, txq, skb, dev_cmd, xmit_more);
+    
+    /* don't put the packet on the ring, if there is no room */
+    if (ret == -ENOSPC && iwl_pcie_txq_overflow_push(trans, txq, skb, dev_cmd, 0, 0))
+        ret = 0;
+    
+    /*
+     * At this point the frame is "transmitted" successfully
+     * and we will get a TX status notification eventually.
+     */
+    IOSimpleLockUnlock(txq->lock);
+    return ret;
+}
+
+/*
+ * CUSTOM
+ */
+
+static const u8 iwl_amsdu_rfc1042_header[] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00 };
+
+/* subframes are padded to a multiple of four bytes, except the last one */
+static inline u32 iwl_amsdu_pad(u32 len)
+{
+    return (4 - (len & 3)) & 3;
+}
+
+/*
+ * iwl_pcie_mbuf_max_tbs - worst case number of TBs for the payload
+ *
+ * Each mbuf of the chain is bounded on its own, see iwl_tx_max_tbs(). This
+ * is cheaper than asking the cursor and never under-estimates.
+ */
+static u8 iwl_pcie_mbuf_max_tbs(mbuf_t skb, u32 skip)
+{
+    u32 n_tbs = 0;
+    mbuf_t m;
+
+    for (m = skb; m; m = mbuf_next(m)) {
+        u32 len = (u32)mbuf_len(m);
+        
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        len -= skip;
+        skip = 0;
+        n_tbs += iwl_tx_max_tbs(len);
+    }
+    
+    return (u8)min_t(u32, n_tbs, 0xff);
+}
+
+/*
+ * iwl_pcie_tx_amsdu_frame - put an A-MSDU on the ring
+ *
+ * The QoS data header in @dev_cmd is used for the whole A-MSDU. Every
+ * subframe gets a TB pointing to its header in the pre-mapped header area
+ * (padding of the previous subframe, DA, SA, length, LLC/SNAP) followed by
+ * the TBs of its payload taken straight from the mbuf chain.
+ * Called with txq->lock held. Returns -ENOSPC without touching the ring if
+ * there is no room for the A-MSDU.
+ */
+static int iwl_pcie_tx_amsdu_frame(struct iwl_trans *trans, struct iwl_txq *txq, mbuf_t head,
+                                   struct iwl_device_cmd *dev_cmd, u32 len, u8 n_subframes,
+                                   bool xmit_more)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_tx_cmd *tx_cmd = (struct iwl_tx_cmd *)dev_cmd->payload;
+    struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)tx_cmd->payload;
+    struct iwl_cmd_meta *out_meta;
+    u8 hdr_len = ieee80211_hdrlen(hdr->frame_control);
+    size_t hdrs_offs;
+    u32 pad = 0;
+    mbuf_t m;
+    int i;
+    
+    if (iwl_pcie_txq_reserve(trans, txq))
+        return -ENOSPC;
+    
+    *ieee80211_get_qos_ctl(hdr) |= IEEE80211_QOS_CTL_A_MSDU_PRESENT;
+    tx_cmd->len = cpu_to_le16((u16)(hdr_len + len));
+    
+    /* Set up driver data for this TFD, the whole list is freed on reclaim */
+    txq->entries[txq->write_ptr].skb = head;
+    txq->entries[txq->write_ptr].cmd = dev_cmd;
+    
+    out_meta = &txq->entries[txq->write_ptr].meta;
+    memset(out_meta, 0, sizeof(*out_meta));
+    
+    if (unlikely(iwl_pcie_tx_build_cmd_tbs(trans, txq, dev_cmd, hdr_len, true)))
+        goto out_err;
+    
+    hdrs_offs = (size_t)txq->write_ptr * IWL_TRANS_AMSDU_MAX_SUBFRAMES * IWL_AMSDU_SUBFRAME_HDR_SIZE;
+    
+    for (m = head, i = 0; m; m = mbuf_nextpkt(m), i++) {
+        u8 *eth = (u8 *)mbuf_data(m);
+        u8 *sf_hdr = txq->amsdu_hdrs + hdrs_offs + i * IWL_AMSDU_SUBFRAME_HDR_SIZE;
+        dma_addr_t sf_hdr_dma = txq->amsdu_hdrs_dma + hdrs_offs + i * IWL_AMSDU_SUBFRAME_HDR_SIZE;
+        u16 msdu_len = (u16)(mbuf_pkthdr_len(m) - ETH_HLEN + IWL_AMSDU_SNAP_LEN);
+        u8 *p = sf_hdr;
+        int tb_idx;
+        
+        memset(p, 0, pad);
+        p += pad;
+        /* DA and SA are taken as is from the 802.3 header */
+        memcpy(p, eth, 2 * ETH_ALEN);
+        p += 2 * ETH_ALEN;
+        *(__be16 *)p = cpu_to_be16(msdu_len);
+        p += sizeof(__be16);
+        memcpy(p, iwl_amsdu_rfc1042_header, sizeof(iwl_amsdu_rfc1042_header));
+        p += sizeof(iwl_amsdu_rfc1042_header);
+        /* ethertype */
+        memcpy(p, eth + 2 * ETH_ALEN, sizeof(__be16));
+        p += sizeof(__be16);
+        
+        tb_idx = iwl_pcie_txq_build_tfd(trans, txq, sf_hdr_dma, (u16)(p - sf_hdr), false);
+        if (tb_idx < 0)
+            goto out_err;
+        
+        if (unlikely(iwl_fill_data_tbs(trans, m, txq, ETH_HLEN, out_meta)))
+            goto out_err;
+        
+        pad = iwl_amsdu_pad(ETH_HLEN + msdu_len);
+    }
+    
+    trans_pcie->tx_stats.amsdus++;
+    trans_pcie->tx_stats.amsdu_subframes += n_subframes;
+    
+    iwl_pcie_tx_commit(trans, txq, dev_cmd, len, false, xmit_more);
+    return 0;
+out_err:
+    iwl_pcie_tfd_unmap(trans, out_meta, txq, txq->write_ptr);
+    txq->entries[txq->write_ptr].skb = NULL;
+    txq->entries[txq->write_ptr].cmd = NULL;
+    IWL_ERR(trans, "Q: %d failed to build A-MSDU of %d subframes\n", txq->id, n_subframes);
+    return -1;
+}
+
+/*
+ * iwl_pcie_txq_send_amsdu - send the gathered frames as one A-MSDU
+ *
+ * The A-MSDU takes the same way as an 802.11 frame: behind the frames
+ * already waiting in the overflow queue, or into it when the ring is full.
+ * If the overflow queue is full too, the A-MSDU stays
+ * on the stage, marked as held, and -ENOSPC is returned. If the A-MSDU
+ * can't be built the error is returned and the frames stay on the stage,
+ * it is up to the caller to drop them.
+ * Called with txq->lock held.
+ */
+static int iwl_pcie_txq_send_amsdu(struct iwl_trans *trans, struct iwl_txq *txq, bool xmit_more)
+{
+    struct iwl_amsdu_stage *stage = &txq->amsdu;
+    int ret;
+    
+    if (iwl_txq_overflow_depth(&txq->overflow_q))
+        ret = -ENOSPC;
+    else
+        ret = iwl_pcie_tx_amsdu_frame(trans, txq, stage->head, stage->dev_cmd,
+                                      stage->len, stage->n_subframes, xmit_more);
+    
+    if (ret == -ENOSPC) {
+        if (!iwl_pcie_txq_overflow_push(trans, txq, stage->head, stage->dev_cmd,
+                                        stage->len, stage->n_subframes)) {
+            stage->held = true;
+            return -ENOSPC;
+        }
+    } else if (ret) {
+        return ret;
+    }
+    
+    iwl_pcie_amsdu_stage_reset(stage);
+    return 0;
 }
 
+/*
+ * iwl_pcie_txq_flush_amsdu - send the gathered frames, drop them if the
+ * A-MSDU can't be built
+ *
+ * Returns -ENOSPC if the A-MSDU is held on the stage for lack of room.
+ * Called with txq->lock held.
+ */
+static int iwl_pcie_txq_flush_amsdu(struct iwl_trans *trans, struct iwl_txq *txq, bool xmit_more)
+{
+    int ret = iwl_pcie_txq_send_amsdu(trans, txq, xmit_more);
+    
+    if (ret && ret != -ENOSPC) {
+        iwl_pcie_amsdu_stage_free(trans, txq);
+        return 0;
+    }
+    return ret;
+}
 
+/*
+ * iwl_trans_pcie_tx_amsdu - gather an 802.3 frame into the queue's A-MSDU
+ *
+ * Frames that can't be carried in an A-MSDU subframe are refused and stay
+ * with the caller, which should send them with iwl_trans_pcie_tx. So are
+ * frames that come while a complete A-MSDU finds no room (-ENOSPC). If the
+ * frame completes an A-MSDU that can't be sent, it is taken off the stage
+ * again and the error is returned. The frame and @dev_cmd belong to the
+ * transport when 0 or 1 is returned. 1 means the frame was appended to the
+ * A-MSDU of an earlier frame, whose TX command it goes out with, @dev_cmd
+ * is freed then.
+ */
+int iwl_trans_pcie_tx_amsdu(struct iwl_trans *trans, mbuf_t skb,
+                            struct iwl_device_cmd *dev_cmd, int txq_id, u8 tid, bool xmit_more)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *txq = trans_pcie->txq[txq_id];
+    struct iwl_amsdu_stage *stage = &txq->amsdu;
+    mbuf_t prev_tail = NULL;
+    u8 *eth;
+    u32 sf_len, pad = 0;
+    u8 n_tbs;
+    int ret;
+    
+    if (!test_bit(txq_id, trans_pcie->queue_used))
+        return -EINVAL;
+    
+    if (!trans_pcie->amsdu_max_subframes || !txq->amsdu_hdrs)
+        return -EOPNOTSUPP;
+    
+    if (mbuf_len(skb) < ETH_HLEN)
+        return -EINVAL;
+    
+    eth = (u8 *)mbuf_data(skb);
+    
+    /* only Ethernet II frames can be LLC/SNAP encapsulated */
+    if (be16_to_cpu(*(__be16 *)(eth + 2 * ETH_ALEN)) < ETH_P_802_3_MIN)
+        return -EINVAL;
+    
+    if (iwl_pcie_tx_csum(trans, skb, ETH_HLEN))
+        return -EINVAL;
+    
+    sf_len = (u32)(mbuf_pkthdr_len(skb) + IWL_AMSDU_SNAP_LEN);
+    if (sf_len > trans_pcie->amsdu_max_bytes)
+        return -EMSGSIZE;
+    
+    /* the subframe header TB and the payload */
+    n_tbs = 1 + iwl_pcie_mbuf_max_tbs(skb, ETH_HLEN);
+    /* TB0 and TB1 are taken by the TX command */
+    if (2 + n_tbs > trans_pcie->max_tbs)
+        return -EINVAL;
+    
+    IOSimpleLockLock(txq->lock);
+    
+    if (stage->head) {
+        pad = iwl_amsdu_pad(stage->len);
+        
+        if ((stage->held || !ether_addr_equal(stage->da, eth) || stage->tid != tid ||
+             stage->n_subframes >= trans_pcie->amsdu_max_subframes ||
+             stage->len + pad + sf_len > trans_pcie->amsdu_max_bytes ||
+             2 + stage->n_tbs + n_tbs > trans_pcie->max_tbs) &&
+            iwl_pcie_txq_flush_amsdu(trans, txq, true)) {
+            IOSimpleLockUnlock(txq->lock);
+            return -ENOSPC;
+        }
+    }
+    
+    if (!stage->head) {
+        stage->head = skb;
+        stage->tail = skb;
+        stage->dev_cmd = dev_cmd;
+        memcpy(stage->da, eth, ETH_ALEN);
+        stage->tid = tid;
+        stage->n_subframes = 1;
+        stage->n_tbs = n_tbs;
+        stage->len = sf_len;
+    } else {
+        prev_tail = stage->tail;
+        mbuf_setnextpkt(stage->tail, skb);
+        stage->tail = skb;
+        stage->n_subframes++;
+        stage->n_tbs += n_tbs;
+        stage->len += pad + sf_len;
+    }
+    
+    if (!xmit_more || stage->n_subframes >= trans_pcie->amsdu_max_subframes) {
+        ret = iwl_pcie_txq_send_amsdu(trans, txq, xmit_more);
+        if (ret) {
+            /* give the frame back, the frames before it are held or dropped */
+            if (!prev_tail) {
+                iwl_pcie_amsdu_stage_reset(stage);
+            } else {
+                mbuf_setnextpkt(prev_tail, NULL);
+                stage->tail = prev_tail;
+                stage->n_subframes--;
+                stage->n_tbs -= n_tbs;
+                stage->len -= pad + sf_len;
+                if (ret != -ENOSPC)
+                    iwl_pcie_amsdu_stage_free(trans, txq);
+            }
+            IOSimpleLockUnlock(txq->lock);
+            return ret;
+        }
+    }
+    
+    /* the A-MSDU goes out with the TX command of its first frame */
+    if (prev_tail)
+        iwl_trans_free_tx_cmd(trans, dev_cmd);
+    
+    IOSimpleLockUnlock(txq->lock);
+    return prev_tail ? 1 : 0;
+}
 
+/* CUSTOM END */
 
+/*
+ * iwl_trans_pcie_txq_push - publish frames held back by xmit_more
+ *
+ * Used by the caller to close a burst when the last frame couldn't be sent
+ * without the hint (e.g. it failed to be queued). A pending A-MSDU is sent
+ * as well, if there is no room for it it goes out from the reclaim path.
+ */
+void iwl_trans_pcie_txq_push(struct iwl_trans *trans, int txq_id)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    struct iwl_txq *txq = trans_pcie->txq[txq_id];
+    
+    if (!test_bit(txq_id, trans_pcie->queue_used))
+        return;
+    
+    IOSimpleLockLock(txq->lock);
+    if (txq->amsdu.head)
+        iwl_pcie_txq_flush_amsdu(trans, txq, false);
+    if (txq->db_pending_frames)
+        iwl_pcie_txq_inc_wr_ptr(trans, txq);
+    IOSimpleLockUnlock(txq->lock);
+}
@@ -33,6 +33,27 @@ void IwlDvmOpMode::rx(struct iwl_priv *priv, struct napi_struct *napi, struct iw
     iwl_rx_dispatch(this->priv, napi, rxb);
 }
 
+void IwlDvmOpMode::queue_full(struct iwl_priv *priv, int queue) {
+    iwl_stop_sw_queue(this->priv, queue);
+}
+
+void IwlDvmOpMode::queue_not_full(struct iwl_priv *priv, int queue) {
+    iwl_wake_sw_queue(this->priv, queue);
+}
+
+void IwlDvmOpMode::nic_error(struct iwl_priv *priv) {
+    iwl_nic_error(this->priv);
+}
+
+int IwlDvmOpMode::tx(struct iwl_priv *priv, mbuf_t *m, bool xmit_more) {
+    int ret = iwlagn_tx_skb(this->priv, m, xmit_more);
+    
+    /* the burst ends here, nothing more is sent until the queue is serviced again */
+    if (!xmit_more || ret)
+        iwlagn_tx_push(this->priv);
+    return ret;
+}
+
 IOReturn IwlDvmOpMode::getCARD_CAPABILITIES(IO80211Interface *interface,
                                             struct apple80211_capability_data *cd) {
     cd->version = APPLE80211_VERSION;
@@ -47,6 +47,10 @@ public:
     
     void stop(struct iwl_priv *priv) override;
     void rx(struct iwl_priv *priv, struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb) override;
+    void nic_error(struct iwl_priv *priv) override;
+    int tx(struct iwl_priv *priv, mbuf_t *m, bool xmit_more) override;
+    void queue_full(struct iwl_priv *priv, int queue) override;
+    void queue_not_full(struct iwl_priv *priv, int queue) override;
     
 //    void add_interface(struct ieee80211_vif *vif) override;
 //    void channel_switch(struct iwl_priv *priv, struct ieee80211_vif *vif, struct ieee80211_channel_switch *chsw) override;
@@ -62,6 +66,8 @@ public:
 private:
     // main.c
     void iwl_down(struct iwl_priv *priv); // line 916
+    void iwlagn_prepare_restart(struct iwl_priv *priv);
+    static IOReturn iwl_bg_restart(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3); // line 971
     struct iwl_priv *iwl_op_mode_dvm_start(struct iwl_trans *trans,
                                            const struct iwl_cfg *cfg,
                                            const struct iwl_fw *fw); // line 1232
@@ -83,7 +89,11 @@ private:
                                   enum iwl_ucode_type ucode_type);
     int iwl_run_init_ucode(struct iwl_priv *priv);
     int iwl_alive_notify(struct iwl_priv *priv);
+    void iwlagn_fw_error(struct iwl_priv *priv, bool ondemand); // line 1931
+    void iwl_nic_error(struct iwl_priv *priv); // line 1984
     void iwl_nic_config(struct iwl_priv *priv);
+    void iwl_stop_sw_queue(struct iwl_priv *priv, int queue);
+    void iwl_wake_sw_queue(struct iwl_priv *priv, int queue);
     static bool iwlagn_wait_calib(struct iwl_notif_wait_data *notif_wait,
                            struct iwl_rx_packet *pkt, void *data);
     
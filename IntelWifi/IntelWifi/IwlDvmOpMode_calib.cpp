@@ -102,21 +102,30 @@ int iwl_send_calib_results(struct iwl_priv *priv)
         .id = REPLY_PHY_CALIBRATION_CMD,
     };
     struct iwl_calib_result *res;
+    /* CUSTOM */
+    struct iwl_dvm_cmd_batch batch;
+    int ret;
+    
+    /* the results are independent, send them all and wait once */
+    iwl_dvm_cmd_batch_begin(priv, &batch);
+    /* CUSTOM END */
     
     STAILQ_FOREACH(res, &priv->calib_results, list) {
-        int ret;
-        
         hcmd.len[0] = res->cmd_len;
         hcmd.data[0] = &res->hdr;
         hcmd.dataflags[0] = IWL_HCMD_DFL_NOCOPY;
         ret = iwl_dvm_send_cmd(priv, &hcmd);
         if (ret) {
             IWL_ERR(priv, "Error %d on calib cmd %d\n", ret, res->hdr.op_code);
+            iwl_dvm_cmd_batch_end(priv, &batch);
             return ret;
         }
     }
     
-    return 0;
+    ret = iwl_dvm_cmd_batch_end(priv, &batch);
+    if (ret)
+        IWL_ERR(priv, "Error %d on calib cmds\n", ret);
+    return ret;
 }
 
 
@@ -105,6 +105,37 @@ int iwlagn_hwrate_to_mac80211_idx(u32 rate_n_flags, enum nl80211_band band)
     return -1;
 }
 
+// line 131
+int iwlagn_txfifo_flush(struct iwl_priv *priv, u32 scd_q_msk)
+{
+    struct iwl_txfifo_flush_cmd_v3 flush_cmd_v3 = {
+        .flush_control = cpu_to_le16(IWL_DROP_ALL),
+    };
+    struct iwl_txfifo_flush_cmd_v2 flush_cmd_v2 = {
+        .flush_control = cpu_to_le16(IWL_DROP_ALL),
+    };
+
+    u32 queue_control = IWL_SCD_VO_MSK | IWL_SCD_VI_MSK | IWL_SCD_BE_MSK | IWL_SCD_BK_MSK | IWL_SCD_MGMT_MSK;
+
+    if ((priv->valid_contexts != BIT(IWL_RXON_CTX_BSS)))
+        queue_control |= IWL_PAN_SCD_VO_MSK | IWL_PAN_SCD_VI_MSK | IWL_PAN_SCD_BE_MSK | IWL_PAN_SCD_BK_MSK |
+                         IWL_PAN_SCD_MGMT_MSK | IWL_PAN_SCD_MULTICAST_MSK;
+
+    if (priv->nvm_data->sku_cap_11n_enable)
+        queue_control |= IWL_AGG_TX_QUEUE_MSK;
+
+    if (scd_q_msk)
+        queue_control = scd_q_msk;
+
+    IWL_DEBUG_INFO(priv, "queue control: 0x%x\n", queue_control);
+    flush_cmd_v3.queue_control = cpu_to_le32(queue_control);
+    flush_cmd_v2.queue_control = cpu_to_le16((u16)queue_control);
+
+    if (IWL_UCODE_API(priv->fw->ucode_ver) > 2)
+        return iwl_dvm_send_cmd_pdu(priv, REPLY_TXFIFO_FLUSH, 0, sizeof(flush_cmd_v3), &flush_cmd_v3);
+    return iwl_dvm_send_cmd_pdu(priv, REPLY_TXFIFO_FLUSH, 0, sizeof(flush_cmd_v2), &flush_cmd_v2);
+}
+
 
 /*
  * BT coex
@@ -411,6 +442,93 @@ u8 iwl_toggle_tx_ant(struct iwl_priv *priv, u8 ant, u8 valid)
 
 
 
+/* CUSTOM */
+static int iwl_dvm_cmd_batch_flush(struct iwl_priv *priv, struct iwl_dvm_cmd_batch *batch)
+{
+    int ret;
+    
+    if (!batch->n_cmds)
+        return 0;
+    
+    ret = iwl_trans_wait_cmds(priv->trans, batch->tokens, batch->n_cmds);
+    batch->n_cmds = 0;
+    batch->n_waits++;
+    
+    if (ret && !batch->ret)
+        batch->ret = ret;
+    return ret;
+}
+
+/*
+ * Send a synchronous command as part of the open batch: it is enqueued
+ * asynchronously and only waited for when the batch fills up or ends.
+ */
+static int iwl_dvm_send_cmd_batched(struct iwl_priv *priv, struct iwl_dvm_cmd_batch *batch,
+                                    struct iwl_host_cmd *cmd)
+{
+    u32 flags = cmd->flags;
+    int ret;
+    
+    if (batch->n_cmds == IWL_DVM_CMD_BATCH_MAX) {
+        ret = iwl_dvm_cmd_batch_flush(priv, batch);
+        if (ret)
+            return ret;
+    }
+    
+    cmd->flags |= CMD_ASYNC | CMD_WANT_COMPLETION;
+    ret = iwl_trans_send_cmd(priv->trans, cmd);
+    cmd->flags = flags;
+    
+    if (ret) {
+        if (!batch->ret)
+            batch->ret = ret;
+        return ret;
+    }
+    
+    batch->tokens[batch->n_cmds++] = cmd->token;
+    batch->n_sent++;
+    return 0;
+}
+
+/**
+ * iwl_dvm_cmd_batch_begin - start pipelining synchronous host commands
+ *
+ * Until iwl_dvm_cmd_batch_end(), synchronous commands that don't want the
+ * response are sent without waiting for the firmware to answer each one.
+ * Only use this for commands that don't depend on each other's result.
+ * Only the commands of the calling thread are batched. Batches don't nest.
+ */
+void iwl_dvm_cmd_batch_begin(struct iwl_priv *priv, struct iwl_dvm_cmd_batch *batch)
+{
+    WARN_ON(priv->cmd_batch);
+    
+    memset(batch, 0, sizeof(*batch));
+    priv->cmd_batch = batch;
+    priv->cmd_batch_owner = current_thread();
+}
+
+/**
+ * iwl_dvm_cmd_batch_end - wait for all commands of the batch
+ *
+ * Returns the first error of any command in the batch.
+ */
+int iwl_dvm_cmd_batch_end(struct iwl_priv *priv, struct iwl_dvm_cmd_batch *batch)
+{
+    priv->cmd_batch_owner = NULL;
+    priv->cmd_batch = NULL;
+    
+    iwl_dvm_cmd_batch_flush(priv, batch);
+    
+    /* every command would have been a round-trip of its own */
+    if (batch->n_sent > batch->n_waits)
+        priv->hcmd_rtt_saved += batch->n_sent - batch->n_waits;
+    
+    IWL_DEBUG_INFO(priv, "Command batch: %u sent, %u waits\n", batch->n_sent, batch->n_waits);
+    
+    return batch->ret;
+}
+/* CUSTOM END */
+
 // line 1237
 int iwl_dvm_send_cmd(struct iwl_priv *priv, struct iwl_host_cmd *cmd)
 {
@@ -443,6 +561,14 @@ int iwl_dvm_send_cmd(struct iwl_priv *priv, struct iwl_host_cmd *cmd)
 //    if (!(cmd->flags & CMD_ASYNC))
 //        lockdep_assert_held(&priv->mutex);
     
+    /*
+     * CUSTOM: only the thread that opened the batch ever sees itself as
+     * the owner, so it is the only one reading cmd_batch.
+     */
+    if (priv->cmd_batch_owner == current_thread() && !(cmd->flags & (CMD_ASYNC | CMD_WANT_SKB)))
+        return iwl_dvm_send_cmd_batched(priv, priv->cmd_batch, cmd);
+    /* CUSTOM END */
+    
     return iwl_trans_send_cmd(priv->trans, cmd);
 }
 
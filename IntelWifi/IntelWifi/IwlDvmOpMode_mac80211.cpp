@@ -321,6 +321,9 @@ void IwlDvmOpMode::iwlagn_mac_stop(struct iwl_priv *priv)
     
     priv->is_open = 0;
     
+    /* CUSTOM: held frames can't be passed up any more */
+    iwl_rx_reorder_release_all(priv);
+    
     IOLockLock(priv->mutex);
     iwl_down(priv);
     IOLockUnlock(priv->mutex);
@@ -356,6 +356,10 @@ int iwl_alive_start(struct iwl_priv *priv)
 {
     int ret = 0;
     struct iwl_rxon_context *ctx = &priv->contexts[IWL_RXON_CTX_BSS];
+    /* CUSTOM */
+    struct iwl_dvm_cmd_batch batch;
+    u32 rtt_saved = priv->hcmd_rtt_saved;
+    /* CUSTOM END */
     
     IWL_DEBUG_INFO(priv, "Runtime Alive received.\n");
     
@@ -371,6 +375,12 @@ int iwl_alive_start(struct iwl_priv *priv)
         //mod_timer(&priv->ucode_trace, jiffies);
     }
     
+    /*
+     * CUSTOM: none of the commands up to the RXON depend on each
+     * other's response, pipeline them and wait once.
+     */
+    iwl_dvm_cmd_batch_begin(priv, &batch);
+    
     /* download priority table before any calibration request */
     if (priv->lib->bt_params && priv->lib->bt_params->advanced_bt_coexist) {
         /* Configure Bluetooth device coexistence support */
@@ -391,10 +401,10 @@ int iwl_alive_start(struct iwl_priv *priv)
         /* FIXME: w/a to force change uCode BT state machine */
         ret = iwl_send_bt_env(priv, IWL_BT_COEX_ENV_OPEN, BT_COEX_PRIO_TBL_EVT_INIT_CALIB2);
         if (ret)
-            return ret;
+            goto out_batch;
         ret = iwl_send_bt_env(priv, IWL_BT_COEX_ENV_CLOSE, BT_COEX_PRIO_TBL_EVT_INIT_CALIB2);
         if (ret)
-            return ret;
+            goto out_batch;
     } else if (priv->lib->bt_params) {
         /*
          * default is 2-wire BT coexexistence support
@@ -432,6 +442,10 @@ int iwl_alive_start(struct iwl_priv *priv)
         iwl_reset_run_time_calib(priv);
     }
     
+    ret = iwl_dvm_cmd_batch_end(priv, &batch);
+    if (ret)
+        return ret;
+    
     set_bit(STATUS_READY, &priv->status);
     
     /* Configure the adapter for unassociated operation */
@@ -442,9 +456,14 @@ int iwl_alive_start(struct iwl_priv *priv)
     /* At this point, the NIC is initialized and operational */
     iwl_rf_kill_ct_config(priv);
     
-    IWL_DEBUG_INFO(priv, "ALIVE processing complete.\n");
+    IWL_DEBUG_INFO(priv, "ALIVE processing complete, %u host command round-trips saved.\n",
+                   priv->hcmd_rtt_saved - rtt_saved);
     
     return iwl_power_update_mode(priv, true);
+    
+out_batch:
+    iwl_dvm_cmd_batch_end(priv, &batch);
+    return ret;
 }
 
 /** line 882
@@ -459,8 +478,14 @@ int iwl_alive_start(struct iwl_priv *priv)
 static void iwl_clear_driver_stations(struct iwl_priv *priv)
 {
     struct iwl_rxon_context *ctx;
+    int i;
     
     //IOSimpleLockLock(priv->sta_lock);
+    /* CUSTOM: the BA sessions go with the stations, nobody else stops them */
+    for (i = 0; i < IWLAGN_STATION_COUNT; i++)
+        iwlagn_tx_agg_release(priv, i);
+    memset(priv->tid_data, 0, sizeof(priv->tid_data));
+    
     memset(priv->stations, 0, sizeof(priv->stations));
     priv->num_stations = 0;
     
@@ -535,6 +560,86 @@ void IwlDvmOpMode::iwl_down(struct iwl_priv *priv)
     //priv->beacon_skb = NULL;
 }
 
+void IwlDvmOpMode::iwlagn_prepare_restart(struct iwl_priv *priv)
+{
+    bool bt_full_concurrent;
+    u8 bt_ci_compliance;
+    u8 bt_load;
+    u8 bt_status;
+    bool bt_is_sco;
+    int i;
+    
+    //lockdep_assert_held(&priv->mutex);
+    
+    priv->is_open = 0;
+    
+    /*
+     * __iwl_down() will clear the BT status variables,
+     * which is correct, but when we restart we really
+     * want to keep them so restore them afterwards.
+     *
+     * The restart process will later pick them up and
+     * re-configure the hw when we reconfigure the BT
+     * command.
+     */
+    bt_full_concurrent = priv->bt_full_concurrent;
+    bt_ci_compliance = priv->bt_ci_compliance;
+    bt_load = priv->bt_traffic_load;
+    bt_status = priv->bt_status;
+    bt_is_sco = priv->bt_is_sco;
+    
+    iwl_down(priv);
+    
+    priv->bt_full_concurrent = bt_full_concurrent;
+    priv->bt_ci_compliance = bt_ci_compliance;
+    priv->bt_traffic_load = bt_load;
+    priv->bt_status = bt_status;
+    priv->bt_is_sco = bt_is_sco;
+    
+    /* reset aggregation queues */
+    for (i = IWLAGN_FIRST_AMPDU_QUEUE; i < IWL_MAX_HW_QUEUES; i++)
+        priv->queue_to_mac80211[i] = IWL_INVALID_MAC80211_QUEUE;
+    /* and stop counts */
+    for (i = 0; i < IWL_MAX_HW_QUEUES; i++)
+        priv->queue_stop_count[i] = 0;
+    /* CUSTOM: the stop bits live next to the counts */
+    priv->transport_queue_stop = 0;
+    
+    memset(priv->agg_q_alloc, 0, sizeof(priv->agg_q_alloc));
+}
+
+// line 971
+IOReturn IwlDvmOpMode::iwl_bg_restart(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    struct iwl_priv *priv = (struct iwl_priv *)arg0;
+    IwlDvmOpMode *me = (IwlDvmOpMode *)arg1;
+    bool was_open;
+    
+    if (test_bit(STATUS_EXIT_PENDING, &priv->status))
+        return kIOReturnSuccess;
+    
+    if (test_and_clear_bit(STATUS_FW_ERROR, &priv->status)) {
+        was_open = priv->is_open;
+        
+        /* CUSTOM: held frames can't be passed up any more */
+        iwl_rx_reorder_release_all(priv);
+        
+        IOLockLock(priv->mutex);
+        me->iwlagn_prepare_restart(priv);
+        IOLockUnlock(priv->mutex);
+        // TODO: Implement
+//        iwl_cancel_deferred_work(priv);
+        
+        /* CUSTOM: there is no ieee80211_restart_hw(), bring the device back up ourselves */
+        if (was_open && me->iwlagn_mac_start(priv))
+            IWL_ERR(priv, "Cannot restart the device after a firmware error\n");
+    } else {
+        WARN_ON(1);
+    }
+    
+    return kIOReturnSuccess;
+}
+
 
 // line 1112
 static int iwl_init_drv(struct iwl_priv *priv)
@@ -754,16 +859,22 @@ struct iwl_priv *IwlDvmOpMode::iwl_op_mode_dvm_start(struct iwl_trans *trans, co
         case IWL_AMSDU_DEF:
         case IWL_AMSDU_4K:
             trans_cfg.rx_buf_size = IWL_AMSDU_4K;
+            trans_cfg.tx_amsdu_max_bytes = IEEE80211_MAX_MPDU_LEN_HT_3839;
             break;
         case IWL_AMSDU_8K:
             trans_cfg.rx_buf_size = IWL_AMSDU_8K;
+            trans_cfg.tx_amsdu_max_bytes = IEEE80211_MAX_MPDU_LEN_HT_7935;
             break;
         case IWL_AMSDU_12K:
         default:
             trans_cfg.rx_buf_size = IWL_AMSDU_4K;
+            trans_cfg.tx_amsdu_max_bytes = IEEE80211_MAX_MPDU_LEN_HT_3839;
             TraceLog("Unsupported amsdu_size: %d\n", iwlwifi_mod_params.amsdu_size);
     }
     
+    if (!(iwlwifi_mod_params.disable_11n & IWL_DISABLE_HT_TXAGG))
+        trans_cfg.tx_amsdu_max_subframes = IWL_TRANS_AMSDU_MAX_SUBFRAMES;
+    
     trans_cfg.cmd_q_wdg_timeout = IWL_WATCHDOG_DISABLED;
     
     trans_cfg.command_groups = iwl_dvm_groups;
@@ -904,6 +1015,13 @@ struct iwl_priv *IwlDvmOpMode::iwl_op_mode_dvm_start(struct iwl_trans *trans, co
      ********************/
 //    iwl_setup_deferred_work(priv);
     iwl_setup_rx_handlers(priv);
+    /* CUSTOM: the reorder and ADDBA timers are all that iwl_setup_deferred_work sets up here */
+    if (iwl_rx_reorder_init(priv))
+        goto out_uninit_drv;
+    if (iwlagn_tx_agg_init(priv)) {
+        iwl_rx_reorder_exit(priv);
+        goto out_uninit_drv;
+    }
     iwl_power_initialize(priv);
     iwl_tt_initialize(priv);
 
@@ -935,8 +1053,11 @@ out_mac80211_unregister:
 out_destroy_workqueue:
     iwl_tt_exit(priv);
 //    iwl_cancel_deferred_work(priv);
+    iwl_rx_reorder_exit(priv);
+    iwlagn_tx_agg_exit(priv);
 //    destroy_workqueue(priv->workqueue);
     priv->workqueue = NULL;
+out_uninit_drv:
     iwl_uninit_drv(priv);
 out_free_eeprom_blob:
     iwh_free(priv->eeprom_blob);
@@ -958,6 +1079,11 @@ void IwlDvmOpMode::iwl_op_mode_dvm_stop(struct iwl_priv* priv)
 
     iwl_tt_exit(priv);
 
+    /* CUSTOM: iwlagn_mac_stop may not have run */
+    iwl_rx_reorder_release_all(priv);
+    iwl_rx_reorder_exit(priv);
+    iwlagn_tx_agg_exit(priv);
+
     iwh_free((void *)priv->eeprom_blob);
     iwh_free(priv->nvm_data);
 
@@ -979,6 +1105,398 @@ void IwlDvmOpMode::iwl_op_mode_dvm_stop(struct iwl_priv* priv)
     //ieee80211_free_hw(priv->hw);
 }
 
+/******************************************************************************
+ *
+ * uCode error/event log dumps
+ *
+ ******************************************************************************/
+
+#define EVENT_START_OFFSET  (4 * sizeof(u32))
+
+static int iwlagn_hw_valid_rtc_data_addr(u32 addr)
+{
+    return (addr >= IWLAGN_RTC_DATA_LOWER_BOUND) &&
+        (addr < IWLAGN_RTC_DATA_UPPER_BOUND);
+}
+
+static const char *const desc_lookup_text[] = {
+    "OK",
+    "FAIL",
+    "BAD_PARAM",
+    "BAD_CHECKSUM",
+    "NMI_INTERRUPT_WDG",
+    "SYSASSERT",
+    "FATAL_ERROR",
+    "BAD_COMMAND",
+    "HW_ERROR_TUNE_LOCK",
+    "HW_ERROR_TEMPERATURE",
+    "ILLEGAL_CHAN_FREQ",
+    "VCC_NOT_STABLE",
+    "FH_ERROR",
+    "NMI_INTERRUPT_HOST",
+    "NMI_INTERRUPT_ACTION_PT",
+    "NMI_INTERRUPT_UNKNOWN",
+    "UCODE_VERSION_MISMATCH",
+    "HW_ERROR_ABS_LOCK",
+    "HW_ERROR_CAL_LOCK_FAIL",
+    "NMI_INTERRUPT_INST_ACTION_PT",
+    "NMI_INTERRUPT_DATA_ACTION_PT",
+    "NMI_TRM_HW_ER",
+    "NMI_INTERRUPT_TRM",
+    "NMI_INTERRUPT_BREAK_POINT",
+    "DEBUG_0",
+    "DEBUG_1",
+    "DEBUG_2",
+    "DEBUG_3",
+};
+
+static struct { const char *name; u8 num; } advanced_lookup[] = {
+    { "NMI_INTERRUPT_WDG", 0x34 },
+    { "SYSASSERT", 0x35 },
+    { "UCODE_VERSION_MISMATCH", 0x37 },
+    { "BAD_COMMAND", 0x38 },
+    { "NMI_INTERRUPT_DATA_ACTION_PT", 0x3C },
+    { "FATAL_ERROR", 0x3D },
+    { "NMI_TRM_HW_ERR", 0x46 },
+    { "NMI_INTERRUPT_TRM", 0x4C },
+    { "NMI_INTERRUPT_BREAK_POINT", 0x54 },
+    { "NMI_INTERRUPT_WDG_RXF_FULL", 0x5C },
+    { "NMI_INTERRUPT_WDG_NO_RBD_RXF_FULL", 0x64 },
+    { "NMI_INTERRUPT_HOST", 0x66 },
+    { "NMI_INTERRUPT_ACTION_PT", 0x7C },
+    { "NMI_INTERRUPT_UNKNOWN", 0x84 },
+    { "NMI_INTERRUPT_INST_ACTION_PT", 0x86 },
+    { "ADVANCED_SYSASSERT", 0 },
+};
+
+static const char *desc_lookup(u32 num)
+{
+    int i;
+    int max = ARRAY_SIZE(desc_lookup_text);
+    
+    if (num < max)
+        return desc_lookup_text[num];
+    
+    max = ARRAY_SIZE(advanced_lookup) - 1;
+    for (i = 0; i < max; i++) {
+        if (advanced_lookup[i].num == num)
+            break;
+    }
+    return advanced_lookup[i].name;
+}
+
+#define ERROR_START_OFFSET  (1 * sizeof(u32))
+#define ERROR_ELEM_SIZE     (7 * sizeof(u32))
+
+static void iwl_dump_nic_error_log(struct iwl_priv *priv)
+{
+    struct iwl_trans *trans = priv->trans;
+    u32 base;
+    struct iwl_error_event_table table;
+    
+    base = priv->device_pointers.error_event_table;
+    if (priv->cur_ucode == IWL_UCODE_INIT) {
+        if (!base)
+            base = priv->fw->init_errlog_ptr;
+    } else {
+        if (!base)
+            base = priv->fw->inst_errlog_ptr;
+    }
+    
+    if (!iwlagn_hw_valid_rtc_data_addr(base)) {
+        IWL_ERR(priv,
+                "Not valid error log pointer 0x%08X for %s uCode\n",
+                base,
+                (priv->cur_ucode == IWL_UCODE_INIT)
+                ? "Init" : "RT");
+        return;
+    }
+    
+    /*TODO: Update dbgfs with ISR error stats obtained below */
+    iwl_trans_read_mem_bytes(trans, base, &table, sizeof(table));
+    
+    if (ERROR_START_OFFSET <= table.valid * ERROR_ELEM_SIZE) {
+        IWL_ERR(trans, "Start IWL Error Log Dump:\n");
+        IWL_ERR(trans, "Status: 0x%08lX, count: %d\n",
+                priv->status, table.valid);
+    }
+    
+    //trace_iwlwifi_dev_ucode_error(...);
+    IWL_ERR(priv, "0x%08X | %-28s\n", table.error_id,
+            desc_lookup(table.error_id));
+    IWL_ERR(priv, "0x%08X | uPc\n", table.pc);
+    IWL_ERR(priv, "0x%08X | branchlink1\n", table.blink1);
+    IWL_ERR(priv, "0x%08X | branchlink2\n", table.blink2);
+    IWL_ERR(priv, "0x%08X | interruptlink1\n", table.ilink1);
+    IWL_ERR(priv, "0x%08X | interruptlink2\n", table.ilink2);
+    IWL_ERR(priv, "0x%08X | data1\n", table.data1);
+    IWL_ERR(priv, "0x%08X | data2\n", table.data2);
+    IWL_ERR(priv, "0x%08X | line\n", table.line);
+    IWL_ERR(priv, "0x%08X | beacon time\n", table.bcon_time);
+    IWL_ERR(priv, "0x%08X | tsf low\n", table.tsf_low);
+    IWL_ERR(priv, "0x%08X | tsf hi\n", table.tsf_hi);
+    IWL_ERR(priv, "0x%08X | time gp1\n", table.gp1);
+    IWL_ERR(priv, "0x%08X | time gp2\n", table.gp2);
+    IWL_ERR(priv, "0x%08X | time gp3\n", table.gp3);
+    IWL_ERR(priv, "0x%08X | uCode version\n", table.ucode_ver);
+    IWL_ERR(priv, "0x%08X | hw version\n", table.hw_ver);
+    IWL_ERR(priv, "0x%08X | board version\n", table.brd_ver);
+    IWL_ERR(priv, "0x%08X | hcmd\n", table.hcmd);
+    IWL_ERR(priv, "0x%08X | isr0\n", table.isr0);
+    IWL_ERR(priv, "0x%08X | isr1\n", table.isr1);
+    IWL_ERR(priv, "0x%08X | isr2\n", table.isr2);
+    IWL_ERR(priv, "0x%08X | isr3\n", table.isr3);
+    IWL_ERR(priv, "0x%08X | isr4\n", table.isr4);
+    IWL_ERR(priv, "0x%08X | isr_pref\n", table.isr_pref);
+    IWL_ERR(priv, "0x%08X | wait_event\n", table.wait_event);
+    IWL_ERR(priv, "0x%08X | l2p_control\n", table.l2p_control);
+    IWL_ERR(priv, "0x%08X | l2p_duration\n", table.l2p_duration);
+    IWL_ERR(priv, "0x%08X | l2p_mhvalid\n", table.l2p_mhvalid);
+    IWL_ERR(priv, "0x%08X | l2p_addr_match\n", table.l2p_addr_match);
+    IWL_ERR(priv, "0x%08X | lmpm_pmg_sel\n", table.lmpm_pmg_sel);
+    IWL_ERR(priv, "0x%08X | timestamp\n", table.u_timestamp);
+    IWL_ERR(priv, "0x%08X | flow_handler\n", table.flow_handler);
+}
+
+/*
+ * CUSTOM: there is no debugfs, so the buf/bufsz plumbing of the Linux
+ * event log dump is gone and every entry goes straight to the log.
+ */
+
+/**
+ * iwl_print_event_log - Dump error event log to syslog
+ */
+static void iwl_print_event_log(struct iwl_priv *priv, u32 start_idx,
+                                u32 num_events, u32 mode)
+{
+    u32 i;
+    u32 base;       /* SRAM byte address of event log header */
+    u32 event_size; /* 2 u32s, or 3 u32s if timestamp recorded */
+    u32 ptr;        /* SRAM byte address of log data */
+    u32 ev, time, data; /* event log data */
+    IOInterruptState reg_flags;
+    
+    struct iwl_trans *trans = priv->trans;
+    
+    if (num_events == 0)
+        return;
+    
+    base = priv->device_pointers.log_event_table;
+    if (priv->cur_ucode == IWL_UCODE_INIT) {
+        if (!base)
+            base = priv->fw->init_evtlog_ptr;
+    } else {
+        if (!base)
+            base = priv->fw->inst_evtlog_ptr;
+    }
+    
+    if (mode == 0)
+        event_size = 2 * sizeof(u32);
+    else
+        event_size = 3 * sizeof(u32);
+    
+    ptr = base + EVENT_START_OFFSET + (start_idx * event_size);
+    
+    /* Make sure device is powered up for SRAM reads */
+    if (!iwl_trans_grab_nic_access(trans, &reg_flags))
+        return;
+    
+    /* Set starting address; reads will auto-increment */
+    iwl_write32(trans, HBUS_TARG_MEM_RADDR, ptr);
+    
+    /* "time" is actually "data" for mode 0 (no timestamp).
+     * place event id # at far right for easier visual parsing. */
+    for (i = 0; i < num_events; i++) {
+        ev = iwl_read32(trans, HBUS_TARG_MEM_RDAT);
+        time = iwl_read32(trans, HBUS_TARG_MEM_RDAT);
+        if (mode == 0) {
+            /* data, ev */
+            IWL_ERR(priv, "EVT_LOG:0x%08x:%04u\n", time, ev);
+        } else {
+            data = iwl_read32(trans, HBUS_TARG_MEM_RDAT);
+            IWL_ERR(priv, "EVT_LOGT:%010u:0x%08x:%04u\n",
+                    time, data, ev);
+        }
+    }
+    
+    /* Allow device to power down */
+    iwl_trans_release_nic_access(trans, &reg_flags);
+}
+
+/**
+ * iwl_print_last_event_logs - Dump the newest # of event log to syslog
+ */
+static void iwl_print_last_event_logs(struct iwl_priv *priv, u32 capacity,
+                                      u32 num_wraps, u32 next_entry,
+                                      u32 size, u32 mode)
+{
+    /*
+     * display the newest DEFAULT_LOG_ENTRIES entries
+     * i.e the entries just before the next ont that uCode would fill.
+     */
+    if (num_wraps) {
+        if (next_entry < size) {
+            iwl_print_event_log(priv, capacity - (size - next_entry),
+                                size - next_entry, mode);
+            iwl_print_event_log(priv, 0, next_entry, mode);
+        } else
+            iwl_print_event_log(priv, next_entry - size, size, mode);
+    } else {
+        if (next_entry < size) {
+            iwl_print_event_log(priv, 0, next_entry, mode);
+        } else {
+            iwl_print_event_log(priv, next_entry - size, size, mode);
+        }
+    }
+}
+
+#define DEFAULT_DUMP_EVENT_LOG_ENTRIES (20)
+
+static int iwl_dump_nic_event_log(struct iwl_priv *priv, bool full_log)
+{
+    u32 base;       /* SRAM byte address of event log header */
+    u32 capacity;   /* event log capacity in # entries */
+    u32 mode;       /* 0 - no timestamp, 1 - timestamp recorded */
+    u32 num_wraps;  /* # times uCode wrapped to top of log */
+    u32 next_entry; /* index of next entry to be written by uCode */
+    u32 size;       /* # entries that we'll print */
+    u32 logsize;
+    struct iwl_trans *trans = priv->trans;
+    
+    base = priv->device_pointers.log_event_table;
+    if (priv->cur_ucode == IWL_UCODE_INIT) {
+        logsize = priv->fw->init_evtlog_size;
+        if (!base)
+            base = priv->fw->init_evtlog_ptr;
+    } else {
+        logsize = priv->fw->inst_evtlog_size;
+        if (!base)
+            base = priv->fw->inst_evtlog_ptr;
+    }
+    
+    if (!iwlagn_hw_valid_rtc_data_addr(base)) {
+        IWL_ERR(priv,
+                "Invalid event log pointer 0x%08X for %s uCode\n",
+                base,
+                (priv->cur_ucode == IWL_UCODE_INIT)
+                ? "Init" : "RT");
+        return -EINVAL;
+    }
+    
+    /* event log header */
+    capacity = iwl_trans_read_mem32(trans, base);
+    mode = iwl_trans_read_mem32(trans, base + (1 * sizeof(u32)));
+    num_wraps = iwl_trans_read_mem32(trans, base + (2 * sizeof(u32)));
+    next_entry = iwl_trans_read_mem32(trans, base + (3 * sizeof(u32)));
+    
+    if (capacity > logsize) {
+        IWL_ERR(priv, "Log capacity %d is bogus, limit to %d "
+                "entries\n", capacity, logsize);
+        capacity = logsize;
+    }
+    
+    if (next_entry > logsize) {
+        IWL_ERR(priv, "Log write index %d is bogus, limit to %d\n",
+                next_entry, logsize);
+        next_entry = logsize;
+    }
+    
+    size = num_wraps ? capacity : next_entry;
+    
+    /* bail out if nothing in log */
+    if (size == 0) {
+        IWL_ERR(trans, "Start IWL Event Log Dump: nothing in log\n");
+        return 0;
+    }
+    
+    if (!(iwl_have_debug_level(IWL_DL_FW_ERRORS)) && !full_log)
+        size = (size > DEFAULT_DUMP_EVENT_LOG_ENTRIES)
+        ? DEFAULT_DUMP_EVENT_LOG_ENTRIES : size;
+    IWL_ERR(priv, "Start IWL Event Log Dump: display last %u entries\n",
+            size);
+    
+    if (iwl_have_debug_level(IWL_DL_FW_ERRORS) || full_log) {
+        /*
+         * if uCode has wrapped back to top of log,
+         * start at the oldest entry,
+         * i.e the next one that uCode would fill.
+         */
+        if (num_wraps)
+            iwl_print_event_log(priv, next_entry,
+                                capacity - next_entry, mode);
+        /* (then/else) start at top of log */
+        iwl_print_event_log(priv, 0, next_entry, mode);
+    } else
+        iwl_print_last_event_logs(priv, capacity, num_wraps,
+                                  next_entry, size, mode);
+    return 0;
+}
+
+// line 1931
+void IwlDvmOpMode::iwlagn_fw_error(struct iwl_priv *priv, bool ondemand)
+{
+    unsigned int reload_msec;
+    unsigned long reload_jiffies;
+    
+    // TODO: Implement
+//    if (iwl_have_debug_level(IWL_DL_FW_ERRORS))
+//        iwl_print_rx_config_cmd(priv, IWL_RXON_CTX_BSS);
+    
+    /* uCode is no longer loaded. */
+    priv->ucode_loaded = false;
+    
+    /* Set the FW error flag -- cleared on iwl_down */
+    set_bit(STATUS_FW_ERROR, &priv->status);
+    
+    iwl_abort_notification_waits(&priv->notif_wait);
+    
+    /* Keep the restart process from trying to send host
+     * commands by clearing the ready bit */
+    clear_bit(STATUS_READY, &priv->status);
+    
+    if (!ondemand) {
+        /*
+         * If firmware keep reloading, then it indicate something
+         * serious wrong and firmware having problem to recover
+         * from it. Instead of keep trying which will fill the syslog
+         * and hang the system, let's just stop it
+         */
+        reload_jiffies = jiffies;
+        reload_msec = (unsigned int)jiffies_to_msecs((long) reload_jiffies - (long) priv->reload_jiffies);
+        priv->reload_jiffies = reload_jiffies;
+        if (reload_msec <= IWL_MIN_RELOAD_DURATION) {
+            priv->reload_count++;
+            if (priv->reload_count >= IWL_MAX_CONTINUE_RELOAD_CNT) {
+                IWL_ERR(priv, "BUG_ON, Stop restarting\n");
+                return;
+            }
+        } else
+            priv->reload_count = 0;
+    }
+    
+    if (!test_bit(STATUS_EXIT_PENDING, &priv->status)) {
+        if (iwlwifi_mod_params.fw_restart) {
+            IWL_DEBUG_FW_ERRORS(priv, "Restarting adapter due to uCode error.\n");
+            //queue_work(priv->workqueue, &priv->restart);
+            IOCommandGate *gate = static_cast<IOCommandGate *>(priv->trans->gate);
+            gate->attemptAction(iwl_bg_restart, priv, this);
+        } else
+            IWL_DEBUG_FW_ERRORS(priv, "Detected FW error, but not restarting\n");
+    }
+}
+
+// line 1984
+void IwlDvmOpMode::iwl_nic_error(struct iwl_priv *priv)
+{
+    //struct iwl_priv *priv = IWL_OP_MODE_GET_DVM(op_mode);
+    
+    IWL_ERR(priv, "Loaded firmware version: %s\n", priv->fw->fw_version);
+    
+    iwl_dump_nic_error_log(priv);
+    iwl_dump_nic_event_log(priv, false);
+    
+    iwlagn_fw_error(priv, false);
+}
 
 #define EEPROM_RF_CONFIG_TYPE_MAX      0x3
 
@@ -1034,5 +1552,44 @@ void IwlDvmOpMode::iwl_nic_config(struct iwl_priv *priv)
         priv->lib->nic_config(priv);
 }
 
+void IwlDvmOpMode::iwl_stop_sw_queue(struct iwl_priv *priv, int queue)
+{
+    //struct iwl_priv *priv = IWL_OP_MODE_GET_DVM(op_mode);
+    int mq = priv->queue_to_mac80211[queue];
+    
+    if (WARN_ON_ONCE(mq == IWL_INVALID_MAC80211_QUEUE))
+        return;
+    
+    /* OSIncrementAtomic returns the old value */
+    if (OSIncrementAtomic((SInt32 *)&priv->queue_stop_count[mq]) + 1 > 1) {
+        IWL_DEBUG_TX_QUEUES(priv, "queue %d (mac80211 %d) already stopped\n", queue, mq);
+        return;
+    }
+    
+    /* CUSTOM: iwlagn_tx_skb stalls the output queue while the bit is set */
+    set_bit(mq, &priv->transport_queue_stop);
+    //ieee80211_stop_queue(priv->hw, mq);
+}
+
+void IwlDvmOpMode::iwl_wake_sw_queue(struct iwl_priv *priv, int queue)
+{
+    //struct iwl_priv *priv = IWL_OP_MODE_GET_DVM(op_mode);
+    int mq = priv->queue_to_mac80211[queue];
+    
+    if (WARN_ON_ONCE(mq == IWL_INVALID_MAC80211_QUEUE))
+        return;
+    
+    if (OSDecrementAtomic((SInt32 *)&priv->queue_stop_count[mq]) - 1 > 0) {
+        IWL_DEBUG_TX_QUEUES(priv, "queue %d (mac80211 %d) already awake\n", queue, mq);
+        return;
+    }
+    
+    clear_bit(mq, &priv->transport_queue_stop);
+    
+    if (!priv->passive_no_rx)
+        //ieee80211_wake_queue(priv->hw, mq);
+        iwlagn_wake_output_queue(priv);
+}
+
 
 
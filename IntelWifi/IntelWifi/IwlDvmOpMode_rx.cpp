@@ -45,9 +45,12 @@ extern "C" {
 #include <sys/kpi_mbuf.h>
 #include <IOKit/network/IOEthernetController.h>
 #include <IOKit/IOCommandGate.h>
+#include <IOKit/IOTimerEventSource.h>
 
 #include "IwlDvmOpMode.hpp"
 
+#include <linux/etherdevice.h>
+
 /******************************************************************************
  *
  * Generic RX handler implementations
@@ -609,6 +612,402 @@ static int iwlagn_set_decrypted_flag(struct iwl_priv *priv,
     return 0;
 }
 
+/*
+ * CUSTOM
+ * RX block ack reordering, after mac80211's ieee80211_sta_manage_reorder_buf.
+ *
+ * The frames of an aggregation arrive with holes whenever a subframe has to
+ * be retried, and the stack must not see them out of order. A session is
+ * opened by the ADDBA request of the peer and closed by its DELBA, a BAR
+ * moves the window. A frame finds its slot as (sn & slot_mask) and each
+ * held frame is released exactly once, either in order or when it waited
+ * longer than rx_reorder_timeout; only a hole about to time out costs a
+ * walk over the window.
+ */
+static void iwl_rx_reorder_deliver(struct iwl_priv *priv, mbuf_t p)
+{
+    IO80211Controller* dev = static_cast<IO80211Controller*>(priv->trans->dev);
+    
+    dev->getNetworkInterface()->inputPacket(p);
+}
+
+static void iwl_rx_reorder_release_frame(struct iwl_priv *priv, struct iwl_rx_reorder_buf *buf,
+                                         bool deliver)
+{
+    int index = buf->head_sn & buf->slot_mask;
+    mbuf_t p = buf->frames[index];
+    
+    buf->head_sn = ieee80211_sn_inc(buf->head_sn);
+    if (!p)
+        return;
+    
+    buf->frames[index] = NULL;
+    buf->num_stored--;
+    if (deliver)
+        iwl_rx_reorder_deliver(priv, p);
+    else
+        mbuf_freem(p);
+}
+
+/* Move the window up to @head_sn, releasing whatever was held before it */
+static void iwl_rx_reorder_release_until(struct iwl_priv *priv, struct iwl_rx_reorder_buf *buf, u16 head_sn)
+{
+    /* held frames are all inside the window, so this runs buf_size times at most */
+    while (buf->num_stored && ieee80211_sn_less(buf->head_sn, head_sn))
+        iwl_rx_reorder_release_frame(priv, buf, true);
+    
+    /* an old BAR must not move the window back */
+    if (ieee80211_sn_less(buf->head_sn, head_sn))
+        buf->head_sn = head_sn;
+}
+
+static void iwl_rx_reorder_release_in_order(struct iwl_priv *priv, struct iwl_rx_reorder_buf *buf)
+{
+    while (buf->frames[buf->head_sn & buf->slot_mask])
+        iwl_rx_reorder_release_frame(priv, buf, true);
+}
+
+/*
+ * Give up on a hole once a frame behind it has waited long enough. The
+ * frames after it are newer, so the scan stops at the first one that is
+ * still within its time. Returns true if frames are still held, with
+ * @expires set to the jiffies at which the first of them times out.
+ */
+static bool iwl_rx_reorder_check_timeout(struct iwl_priv *priv, struct iwl_rx_reorder_buf *buf,
+                                         unsigned long *expires)
+{
+    unsigned long timeout = msecs_to_jiffies(iwlwifi_mod_params.rx_reorder_timeout);
+    u16 sn;
+    int i;
+    
+    for (i = 1; i < buf->buf_size && buf->num_stored; i++) {
+        sn = ieee80211_sn_add(buf->head_sn, i);
+        if (!buf->frames[sn & buf->slot_mask])
+            continue;
+        
+        if (!time_after(jiffies, buf->reorder_time[sn & buf->slot_mask] + timeout)) {
+            *expires = buf->reorder_time[sn & buf->slot_mask] + timeout + 1;
+            return true;
+        }
+        
+        IWL_DEBUG_HT(priv, "RX reorder: timed out waiting for SN %d, releasing up to %d\n",
+                     buf->head_sn, sn);
+        iwl_rx_reorder_release_until(priv, buf, sn);
+        iwl_rx_reorder_release_in_order(priv, buf);
+        i = 0;
+    }
+    return false;
+}
+
+/*
+ * One timer serves all sessions, like the reorder timer of a mac80211
+ * session. An armed timer always waits for a frame that was held earlier,
+ * so it is only moved when it is idle.
+ */
+static void iwl_rx_reorder_arm_timer(struct iwl_priv *priv, unsigned long expires)
+{
+    IOTimerEventSource *timer = static_cast<IOTimerEventSource *>(priv->reorder_timer);
+    
+    if (!timer || priv->reorder_timer_armed)
+        return;
+    
+    priv->reorder_timer_armed = true;
+    timer->setTimeoutMS(time_after(expires, jiffies) ? (u32)jiffies_to_msecs(expires - jiffies) : 1);
+}
+
+/* Runs on the work loop, so it is serialized with the RX path */
+static void iwl_rx_reorder_timer_fired(OSObject *owner, IOTimerEventSource *sender)
+{
+    struct iwl_priv *priv = static_cast<struct iwl_priv *>(sender->getRefcon());
+    unsigned long expires, next = 0;
+    bool held = false;
+    int sta_id, tid;
+    
+    priv->reorder_timer_armed = false;
+    
+    for (sta_id = 0; sta_id < IWLAGN_STATION_COUNT; sta_id++) {
+        for (tid = 0; tid < IWL_MAX_TID_COUNT; tid++) {
+            if (!priv->reorder_buf[sta_id][tid].num_stored)
+                continue;
+            if (!iwl_rx_reorder_check_timeout(priv, &priv->reorder_buf[sta_id][tid], &expires))
+                continue;
+            if (!held || time_before(expires, next))
+                next = expires;
+            held = true;
+        }
+    }
+    
+    if (held)
+        iwl_rx_reorder_arm_timer(priv, next);
+}
+
+static void iwl_rx_reorder_stop(struct iwl_priv *priv, struct iwl_rx_reorder_buf *buf, bool deliver)
+{
+    if (!buf->valid)
+        return;
+    
+    while (buf->num_stored)
+        iwl_rx_reorder_release_frame(priv, buf, deliver);
+    
+    iwh_free(buf->frames);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static void iwl_rx_reorder_start(struct iwl_priv *priv, int sta_id, int tid, u16 ssn, u16 buf_size)
+{
+    struct iwl_rx_reorder_buf *buf = &priv->reorder_buf[sta_id][tid];
+    u16 slots = 1;
+    
+    /* a repeated ADDBA request restarts the session */
+    iwl_rx_reorder_stop(priv, buf, true);
+    
+    if (iwlwifi_mod_params.disable_11n & IWL_DISABLE_HT_RXAGG)
+        return;
+    
+    if (!buf_size || buf_size > IEEE80211_MAX_AMPDU_BUF)
+        buf_size = IEEE80211_MAX_AMPDU_BUF;
+    if (iwlwifi_mod_params.rx_reorder_win && buf_size > iwlwifi_mod_params.rx_reorder_win)
+        buf_size = iwlwifi_mod_params.rx_reorder_win;
+    
+    /* a power of two divides the SN space, so the slots don't jump when the SN wraps */
+    while (slots < buf_size)
+        slots <<= 1;
+    
+    buf->frames = (mbuf_t *)iwh_zalloc(slots * (sizeof(mbuf_t) + sizeof(unsigned long)));
+    if (!buf->frames) {
+        IWL_ERR(priv, "No memory for the RX reorder buffer of STA/TID %d/%d\n", sta_id, tid);
+        return;
+    }
+    buf->reorder_time = (unsigned long *)(buf->frames + slots);
+    buf->head_sn = ssn;
+    buf->buf_size = buf_size;
+    buf->slot_mask = slots - 1;
+    buf->valid = true;
+    
+    IWL_DEBUG_HT(priv, "RX reorder session on STA/TID %d/%d, SSN %d, window %d\n",
+                 sta_id, tid, ssn, buf_size);
+}
+
+/* station of a transmitter address, the last match is tried first */
+static int iwl_rx_reorder_find_sta(struct iwl_priv *priv, const u8 *addr)
+{
+    int i;
+    
+    if ((priv->stations[priv->reorder_sta_id].used & IWL_STA_UCODE_ACTIVE) &&
+        ether_addr_equal(priv->stations[priv->reorder_sta_id].sta.sta.addr, addr))
+        return priv->reorder_sta_id;
+    
+    for (i = 0; i < IWLAGN_STATION_COUNT; i++) {
+        if ((priv->stations[i].used & IWL_STA_UCODE_ACTIVE) &&
+            ether_addr_equal(priv->stations[i].sta.sta.addr, addr)) {
+            priv->reorder_sta_id = i;
+            return i;
+        }
+    }
+    return IWL_INVALID_STATION;
+}
+
+/*
+ * ADDBA requests of the peer open a receive session, its ADDBA responses
+ * answer ours for a transmit session, and a DELBA closes either
+ */
+static void iwl_rx_reorder_action(struct iwl_priv *priv, struct ieee80211_mgmt *mgmt, u16 len)
+{
+    int sta_id, tid;
+    u16 capab, params;
+    
+    if (len < offsetof(struct ieee80211_mgmt, u.action.u.delba) + sizeof(mgmt->u.action.u.delba) ||
+        mgmt->u.action.category != WLAN_CATEGORY_BACK)
+        return;
+    
+    sta_id = iwl_rx_reorder_find_sta(priv, mgmt->sa);
+    if (sta_id == IWL_INVALID_STATION)
+        return;
+    
+    switch (mgmt->u.action.u.addba_req.action_code) {
+        case WLAN_ACTION_ADDBA_REQ:
+            if (len < offsetof(struct ieee80211_mgmt, u.action.u.addba_req) + sizeof(mgmt->u.action.u.addba_req))
+                return;
+            capab = le16_to_cpu(mgmt->u.action.u.addba_req.capab);
+            tid = (capab & IEEE80211_ADDBA_PARAM_TID_MASK) >> 2;
+            if (tid >= IWL_MAX_TID_COUNT)
+                return;
+            iwl_rx_reorder_start(priv, sta_id, tid,
+                                 IEEE80211_SEQ_TO_SN(le16_to_cpu(mgmt->u.action.u.addba_req.start_seq_num)),
+                                 (capab & IEEE80211_ADDBA_PARAM_BUF_SIZE_MASK) >> 6);
+            break;
+        case WLAN_ACTION_ADDBA_RESP:
+            iwlagn_tx_agg_addba_resp(priv, sta_id, mgmt, len);
+            break;
+        case WLAN_ACTION_DELBA:
+            params = le16_to_cpu(mgmt->u.action.u.delba.params);
+            tid = (params & IEEE80211_DELBA_PARAM_TID_MASK) >> 12;
+            if (tid >= IWL_MAX_TID_COUNT)
+                return;
+            /* the recipient's DELBA ends our transmit session, the originator's our receive session */
+            if (!(params & IEEE80211_DELBA_PARAM_INITIATOR_MASK)) {
+                iwlagn_tx_agg_delba(priv, sta_id, tid);
+                return;
+            }
+            IWL_DEBUG_HT(priv, "RX reorder session on STA/TID %d/%d stopped\n", sta_id, tid);
+            iwl_rx_reorder_stop(priv, &priv->reorder_buf[sta_id][tid], true);
+            break;
+        default:
+            break;
+    }
+}
+
+/* A BAR tells us the originator gave up on everything before its SSN */
+static void iwl_rx_reorder_bar(struct iwl_priv *priv, struct ieee80211_bar *bar, u16 len)
+{
+    struct iwl_rx_reorder_buf *buf;
+    int sta_id, tid;
+    
+    if (len < sizeof(*bar))
+        return;
+    
+    sta_id = iwl_rx_reorder_find_sta(priv, bar->ta);
+    if (sta_id == IWL_INVALID_STATION)
+        return;
+    
+    tid = (le16_to_cpu(bar->control) & IEEE80211_BAR_CTRL_TID_INFO_MASK) >> IEEE80211_BAR_CTRL_TID_INFO_SHIFT;
+    if (tid >= IWL_MAX_TID_COUNT)
+        return;
+    
+    buf = &priv->reorder_buf[sta_id][tid];
+    if (!buf->valid)
+        return;
+    
+    iwl_rx_reorder_release_until(priv, buf, IEEE80211_SEQ_TO_SN(le16_to_cpu(bar->start_seq_num)));
+    iwl_rx_reorder_release_in_order(priv, buf);
+}
+
+/* returns the session of a unicast QoS data frame and its SN, NULL if it has none */
+static struct iwl_rx_reorder_buf *iwl_rx_reorder_get_buf(struct iwl_priv *priv, struct ieee80211_hdr *hdr, u16 *sn)
+{
+    struct iwl_rx_reorder_buf *buf;
+    int sta_id, tid;
+    u8 *qc;
+    
+    if (!ieee80211_is_data_qos(hdr->frame_control) || ieee80211_is_qos_nullfunc(hdr->frame_control) ||
+        is_multicast_ether_addr(hdr->addr1))
+        return NULL;
+    
+    qc = ieee80211_get_qos_ctl(hdr);
+    if ((qc[0] & IEEE80211_QOS_CTL_ACK_POLICY_MASK) == IEEE80211_QOS_CTL_ACK_POLICY_NOACK)
+        return NULL;
+    
+    tid = qc[0] & IEEE80211_QOS_CTL_TID_MASK;
+    if (tid >= IWL_MAX_TID_COUNT)
+        return NULL;
+    
+    sta_id = iwl_rx_reorder_find_sta(priv, hdr->addr2);
+    if (sta_id == IWL_INVALID_STATION)
+        return NULL;
+    
+    buf = &priv->reorder_buf[sta_id][tid];
+    if (!buf->valid)
+        return NULL;
+    
+    *sn = IEEE80211_SEQ_TO_SN(le16_to_cpu(hdr->seq_ctrl));
+    return buf;
+}
+
+/* returns true when the frame was held or dropped, false to pass it up now */
+static bool iwl_rx_reorder_frame(struct iwl_priv *priv, struct iwl_rx_reorder_buf *buf, u16 sn, mbuf_t p)
+{
+    unsigned long expires;
+    int index;
+    
+    /* frame with out of date sequence number, or a duplicate */
+    if (ieee80211_sn_less(sn, buf->head_sn)) {
+        mbuf_freem(p);
+        return true;
+    }
+    
+    /* a frame beyond the window pushes it, and releases what falls out */
+    if (!ieee80211_sn_less(sn, ieee80211_sn_add(buf->head_sn, buf->buf_size))) {
+        iwl_rx_reorder_release_until(priv, buf, ieee80211_sn_inc(ieee80211_sn_sub(sn, buf->buf_size)));
+        iwl_rx_reorder_release_in_order(priv, buf);
+    }
+    
+    /* in order and nothing held: no need to buffer it */
+    if (sn == buf->head_sn && !buf->num_stored) {
+        buf->head_sn = ieee80211_sn_inc(buf->head_sn);
+        return false;
+    }
+    
+    index = sn & buf->slot_mask;
+    if (buf->frames[index]) {
+        mbuf_freem(p);
+        return true;
+    }
+    
+    buf->frames[index] = p;
+    buf->reorder_time[index] = jiffies;
+    buf->num_stored++;
+    iwl_rx_reorder_release_in_order(priv, buf);
+    if (iwl_rx_reorder_check_timeout(priv, buf, &expires))
+        iwl_rx_reorder_arm_timer(priv, expires);
+    return true;
+}
+
+int iwl_rx_reorder_init(struct iwl_priv *priv)
+{
+    IOCommandGate *gate = static_cast<IOCommandGate *>(priv->trans->gate);
+    IOTimerEventSource *timer;
+    
+    timer = IOTimerEventSource::timerEventSource(static_cast<OSObject *>(priv->trans->dev),
+                                                 iwl_rx_reorder_timer_fired);
+    if (!timer)
+        return -ENOMEM;
+    
+    timer->setRefcon(priv);
+    if (gate->getWorkLoop()->addEventSource(timer) != kIOReturnSuccess) {
+        timer->release();
+        return -ENOMEM;
+    }
+    priv->reorder_timer = timer;
+    priv->reorder_timer_armed = false;
+    return 0;
+}
+
+void iwl_rx_reorder_exit(struct iwl_priv *priv)
+{
+    IOTimerEventSource *timer = static_cast<IOTimerEventSource *>(priv->reorder_timer);
+    
+    if (!timer)
+        return;
+    
+    timer->cancelTimeout();
+    timer->getWorkLoop()->removeEventSource(timer);
+    timer->release();
+    priv->reorder_timer = NULL;
+    priv->reorder_timer_armed = false;
+}
+
+/* The station is gone, its held frames are dropped */
+void iwl_rx_reorder_release_sta(struct iwl_priv *priv, int sta_id)
+{
+    int tid;
+    
+    for (tid = 0; tid < IWL_MAX_TID_COUNT; tid++)
+        iwl_rx_reorder_stop(priv, &priv->reorder_buf[sta_id][tid], false);
+}
+
+void iwl_rx_reorder_release_all(struct iwl_priv *priv)
+{
+    int sta_id;
+    
+    for (sta_id = 0; sta_id < IWLAGN_STATION_COUNT; sta_id++)
+        iwl_rx_reorder_release_sta(priv, sta_id);
+    
+    if (priv->reorder_timer)
+        static_cast<IOTimerEventSource *>(priv->reorder_timer)->cancelTimeout();
+    priv->reorder_timer_armed = false;
+}
+/* CUSTOM END */
+
 // line 622
 static void iwlagn_pass_packet_to_mac80211(struct iwl_priv *priv,
                                            struct ieee80211_hdr *hdr,
@@ -629,9 +1028,40 @@ static void iwlagn_pass_packet_to_mac80211(struct iwl_priv *priv,
     if (!iwlwifi_mod_params.swcrypto && iwlagn_set_decrypted_flag(priv, hdr, ampdu_status, stats))
         return;
 
+    /* CUSTOM: block ack bookkeeping, mac80211 does this in ieee80211_rx_h_ctrl / _action */
+    if (unlikely(ieee80211_is_back_req(hdr->frame_control))) {
+        iwl_rx_reorder_bar(priv, (struct ieee80211_bar *)hdr, len);
+        return;
+    }
+    if (unlikely(ieee80211_is_action(hdr->frame_control)))
+        iwl_rx_reorder_action(priv, (struct ieee80211_mgmt *)hdr, len);
+    
+    u16 sn = 0;
+    struct iwl_rx_reorder_buf *reorder_buf = iwl_rx_reorder_get_buf(priv, hdr, &sn);
+    /* CUSTOM END */
+    
     IO80211Controller* dev = static_cast<IO80211Controller*>(priv->trans->dev);
     
-    mbuf_t p = rxb_steal_page(rxb);
+    /*
+     * CUSTOM: the RB is a DMA buffer of the transport, not an mbuf. The frame
+     * is copied into a right-sized mbuf and the RB goes straight back on
+     * rx_free without a new page allocation.
+     */
+    mbuf_t p = dev->allocatePacket(len);
+    
+    if (!p) {
+        IWL_DEBUG_DROP_LIMIT(priv, "Dropping packet, no mbuf.\n");
+        return;
+    }
+    if (mbuf_copyback(p, 0, len, hdr, MBUF_DONTWAIT)) {
+        IWL_DEBUG_DROP_LIMIT(priv, "Dropping packet, can't copy it into the mbuf.\n");
+        dev->freePacket(p);
+        return;
+    }
+    
+    if (reorder_buf && iwl_rx_reorder_frame(priv, reorder_buf, sn, p))
+        return;
+    
     dev->getNetworkInterface()->inputPacket(p);
     
     
@@ -933,9 +1363,9 @@ void iwl_setup_rx_handlers(struct iwl_priv *priv)
     handlers[REPLY_RX_MPDU_CMD] = iwlagn_rx_reply_rx;
 
     /* block ack */
-    ///handlers[REPLY_COMPRESSED_BA] = iwlagn_rx_reply_compressed_ba;
+    handlers[REPLY_COMPRESSED_BA] = iwlagn_rx_reply_compressed_ba;
 
-//    priv->rx_handlers[REPLY_TX] = iwlagn_rx_reply_tx;
+    priv->rx_handlers[REPLY_TX] = iwlagn_rx_reply_tx;
 
     /* set up notification wait support */
     iwl_notification_wait_init(&priv->notif_wait);
@@ -86,6 +86,11 @@ static int iwl_send_scan_abort(struct iwl_priv *priv)
         .flags = CMD_WANT_SKB,
     };
     __le32 *status;
+    /* CUSTOM: the reply is a single status word, keep it on the stack */
+    u32 resp_buf[4];
+    
+    cmd.resp_buf = resp_buf;
+    cmd.resp_buf_len = sizeof(resp_buf);
     
     /* Exit instantly with error when device is not ready
      * to receive scan abort command or it does not perform
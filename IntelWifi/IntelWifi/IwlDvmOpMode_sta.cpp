@@ -135,12 +135,16 @@ int iwl_send_add_sta(struct iwl_priv *priv, struct iwl_addsta_cmd *sta, u8 flags
     u8 sta_id  = sta->sta.sta_id;
     struct iwl_rx_packet *pkt;
     struct iwl_add_sta_resp *add_sta_resp;
+    /* CUSTOM: the reply is tiny, have it copied to the stack */
+    u32 resp_buf[4];
     
     IWL_DEBUG_INFO(priv, "Adding sta %u (" MAC_FMT ") %ssynchronously\n",
                    sta_id, MAC_BYTES(sta->sta.addr), flags & CMD_ASYNC ?  "a" : "");
     
     if (!(flags & CMD_ASYNC)) {
         cmd.flags |= CMD_WANT_SKB;
+        cmd.resp_buf = resp_buf;
+        cmd.resp_buf_len = sizeof(resp_buf);
         might_sleep();
     }
     
@@ -335,12 +339,15 @@ u8 iwl_prep_station(struct iwl_priv *priv, struct iwl_rxon_context *ctx, const u
     station->sta.sta.sta_id = sta_id;
     station->sta.station_flags = ctx->station_flags;
     station->ctxid = ctx->ctxid;
+    station->ieee_sta = sta;
     
     if (sta) {
         struct iwl_station_priv *sta_priv;
         
         sta_priv = (struct iwl_station_priv *)sta->drv_priv;
         sta_priv->ctx = ctx;
+        /* CUSTOM: iwlagn_mac_sta_add sets this in Linux, the BA sessions need it */
+        sta_priv->sta_id = sta_id;
     }
     
     /*
@@ -432,6 +439,8 @@ static int iwl_send_remove_station(struct iwl_priv *priv, const u8 *addr, int st
     int ret;
     struct iwl_rem_sta_cmd rm_sta_cmd;
     struct iwl_rem_sta_resp *rem_sta_resp;
+    /* CUSTOM: the reply is tiny, have it copied to the stack */
+    u32 resp_buf[4];
     
     struct iwl_host_cmd cmd = {
         .id = REPLY_REMOVE_STA,
@@ -444,6 +453,8 @@ static int iwl_send_remove_station(struct iwl_priv *priv, const u8 *addr, int st
     memcpy(&rm_sta_cmd.addr, addr, ETH_ALEN);
     
     cmd.flags |= CMD_WANT_SKB;
+    cmd.resp_buf = resp_buf;
+    cmd.resp_buf_len = sizeof(resp_buf);
     
     ret = iwl_dvm_send_cmd(priv, &cmd);
     
@@ -512,10 +523,15 @@ int iwl_remove_station(struct iwl_priv *priv, const u8 sta_id, const u8 *addr)
         priv->stations[sta_id].lq = NULL;
     }
     
+    /* CUSTOM: no mac80211 to tear the BA sessions down first */
+    iwlagn_tx_agg_release(priv, sta_id);
+    iwl_rx_reorder_release_sta(priv, sta_id);
+    
     for (tid = 0; tid < IWL_MAX_TID_COUNT; tid++)
         memset(&priv->tid_data[sta_id][tid], 0, sizeof(priv->tid_data[sta_id][tid]));
     
     priv->stations[sta_id].used &= ~IWL_STA_DRIVER_ACTIVE;
+    priv->stations[sta_id].ieee_sta = NULL;
     
     priv->num_stations--;
     
@@ -549,11 +565,15 @@ void iwl_deactivate_station(struct iwl_priv *priv, const u8 sta_id, const u8 *ad
     
     //WARN_ON_ONCE(!(priv->stations[sta_id].used & IWL_STA_DRIVER_ACTIVE));
     
+    /* CUSTOM: no mac80211 to tear the BA sessions down first */
+    iwlagn_tx_agg_release(priv, sta_id);
+    
     for (tid = 0; tid < IWL_MAX_TID_COUNT; tid++)
         memset(&priv->tid_data[sta_id][tid], 0, sizeof(priv->tid_data[sta_id][tid]));
     
     priv->stations[sta_id].used &= ~IWL_STA_DRIVER_ACTIVE;
     priv->stations[sta_id].used &= ~IWL_STA_UCODE_INPROGRESS;
+    priv->stations[sta_id].ieee_sta = NULL;
     
     priv->num_stations--;
     
@@ -1293,3 +1313,22 @@ int iwl_update_bcast_station(struct iwl_priv *priv, struct iwl_rxon_context *ctx
     return 0;
 }
 
+// line 1356
+int iwl_sta_tx_modify_enable_tid(struct iwl_priv *priv, int sta_id, int tid)
+{
+    struct iwl_addsta_cmd sta_cmd;
+    
+    // TODO: Implement
+    //lockdep_assert_held(&priv->mutex);
+    
+    /* Remove "disable" flag, to enable Tx for this TID */
+    //IOSimpleLockLock(priv->sta_lock);
+    priv->stations[sta_id].sta.sta.modify_mask = STA_MODIFY_TID_DISABLE_TX;
+    priv->stations[sta_id].sta.tid_disable_tx &= cpu_to_le16(~(1 << tid));
+    priv->stations[sta_id].sta.mode = STA_CONTROL_MODIFY_MSK;
+    memcpy(&sta_cmd, &priv->stations[sta_id].sta, sizeof(struct iwl_addsta_cmd));
+    //IOSimpleLockUnlock(priv->sta_lock);
+    
+    return iwl_send_add_sta(priv, &sta_cmd, 0);
+}
+
@@ -0,0 +1,1363 @@
+/******************************************************************************
+ *
+ * GPL LICENSE SUMMARY
+ *
+ * Copyright(c) 2008 - 2014 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110,
+ * USA
+ *
+ * The full GNU General Public License is included in this distribution
+ * in the file called COPYING.
+ *
+ * Contact Information:
+ *  Intel Linux Wireless <linuxwifi@intel.com>
+ * Intel Corporation, 5200 N.E. Elam Young Parkway, Hillsboro, OR 97124-6497
+ *
+ *****************************************************************************/
+
+
+#include <linux/kernel.h>
+#include <linux/mac80211.h>
+extern "C" {
+#include "iwl-trans.h"
+#include "iwl-debug.h"
+#include "agn.h"
+#include "dev.h"
+#include "commands.h"
+}
+
+
+#include "IwlDvmOpMode.hpp"
+
+#include <linux/etherdevice.h>
+#include <IOKit/IOCommandGate.h>
+#include <IOKit/IOTimerEventSource.h>
+
+
+// line 45
+static const u8 tid_to_ac[] = {
+    IEEE80211_AC_BE,
+    IEEE80211_AC_BK,
+    IEEE80211_AC_BK,
+    IEEE80211_AC_BE,
+    IEEE80211_AC_VI,
+    IEEE80211_AC_VI,
+    IEEE80211_AC_VO,
+    IEEE80211_AC_VO,
+};
+
+/* CUSTOM */
+/*
+ * iwl_rxon_ctx_from_vif() is not wired up to the IO80211 interface yet,
+ * so resolve the context from the station table entry instead.
+ */
+static inline struct iwl_rxon_context *iwlagn_agg_ctx(struct iwl_priv *priv, int sta_id)
+{
+    return &priv->contexts[priv->stations[sta_id].ctxid];
+}
+/* CUSTOM END */
+
+/*
+ * The frames sent by the driver are all unicast, to the AP: data of the
+ * network stack and the block ack action frames. mac80211 would have set up
+ * the rest of the tx info for us.
+ */
+static void iwlagn_tx_cmd_build_basic(struct iwl_priv *priv,
+                                      struct iwl_tx_cmd *tx_cmd,
+                                      struct ieee80211_hdr *hdr, u8 sta_id, bool is_agg)
+{
+    __le16 fc = hdr->frame_control;
+    __le32 tx_flags = tx_cmd->tx_flags;
+
+    tx_cmd->stop_time.life_time = TX_CMD_LIFE_TIME_INFINITE;
+
+    //if (!(info->flags & IEEE80211_TX_CTL_NO_ACK))
+    tx_flags |= TX_CMD_FLG_ACK_MSK;
+
+    tx_cmd->sta_id = sta_id;
+    if (ieee80211_has_morefrags(fc))
+        tx_flags |= TX_CMD_FLG_MORE_FRAG_MSK;
+
+    if (ieee80211_is_data_qos(fc)) {
+        u8 *qc = ieee80211_get_qos_ctl(hdr);
+        tx_cmd->tid_tspec = qc[0] & 0xf;
+        tx_flags &= ~TX_CMD_FLG_SEQ_CTL_MSK;
+    } else {
+        tx_cmd->tid_tspec = IWL_TID_NON_QOS;
+        /* CUSTOM: nobody else assigns sequence numbers to non-QoS data */
+        tx_flags |= TX_CMD_FLG_SEQ_CTL_MSK;
+    }
+
+    /* iwl_tx_cmd_protection() */
+    if (is_agg)
+        tx_flags |= TX_CMD_FLG_PROT_REQUIRE_MSK;
+
+    tx_flags &= ~(TX_CMD_FLG_ANT_SEL_MSK);
+    if (ieee80211_is_mgmt(fc))
+        tx_cmd->timeout.pm_frame_timeout = cpu_to_le16(2);
+    else
+        tx_cmd->timeout.pm_frame_timeout = 0;
+
+    tx_cmd->driver_txop = 0;
+    tx_cmd->tx_flags = tx_flags;
+    tx_cmd->next_frame_len = 0;
+}
+
+static void iwlagn_tx_cmd_build_rate(struct iwl_priv *priv,
+                                     struct iwl_tx_cmd *tx_cmd,
+                                     __le16 fc)
+{
+    u32 rate_flags;
+    int rate_idx;
+    u8 rts_retry_limit;
+    u8 data_retry_limit;
+    u8 rate_plcp;
+
+    if (priv->wowlan) {
+        rts_retry_limit = IWLAGN_LOW_RETRY_LIMIT;
+        data_retry_limit = IWLAGN_LOW_RETRY_LIMIT;
+    } else {
+        /* Set retry limit on RTS packets */
+        rts_retry_limit = IWLAGN_RTS_DFAULT_RETRY_LIMIT;
+
+        /* Set retry limit on DATA packets and Probe Responses*/
+        data_retry_limit = IWLAGN_DEFAULT_TX_RETRY;
+    }
+
+    tx_cmd->data_retry_limit = data_retry_limit;
+    tx_cmd->rts_retry_limit = rts_retry_limit;
+
+    /* DATA packets will use the uCode station table for rate/antenna
+     * selection */
+    if (ieee80211_is_data(fc)) {
+        tx_cmd->initial_rate_index = 0;
+        tx_cmd->tx_flags |= TX_CMD_FLG_STA_RATE_MSK;
+        return;
+    }
+
+    /* CUSTOM: there is no rate control to pick a rate, use the lowest one of the band */
+    rate_idx = priv->band == NL80211_BAND_5GHZ ? IWL_FIRST_OFDM_RATE : IWL_RATE_1M_INDEX;
+    /* Get PLCP rate for tx_cmd->rate_n_flags */
+    rate_plcp = iwl_rates[rate_idx].plcp;
+    /* Zero out flags for this packet */
+    rate_flags = 0;
+
+    /* Set CCK flag as needed */
+    if ((rate_idx >= IWL_FIRST_CCK_RATE) && (rate_idx <= IWL_LAST_CCK_RATE))
+        rate_flags |= RATE_MCS_CCK_MSK;
+
+    /* Set up antennas */
+    if (priv->lib->bt_params && priv->lib->bt_params->advanced_bt_coexist && priv->bt_full_concurrent) {
+        /* operated as 1x1 in full concurrency mode */
+        priv->mgmt_tx_ant = iwl_toggle_tx_ant(priv, priv->mgmt_tx_ant,
+                                              first_antenna(priv->nvm_data->valid_tx_ant));
+    } else
+        priv->mgmt_tx_ant = iwl_toggle_tx_ant(priv, priv->mgmt_tx_ant, priv->nvm_data->valid_tx_ant);
+    rate_flags |= iwl_ant_idx_to_flags(priv->mgmt_tx_ant);
+
+    /* Set the rate in the TX cmd */
+    tx_cmd->rate_n_flags = iwl_hw_set_rate_n_flags(rate_plcp, rate_flags);
+}
+
+/* CUSTOM */
+static const u8 iwlagn_rfc1042_header[] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00 };
+
+/* the TID mac80211 would take from the 802.1d priority of the frame */
+static u8 iwlagn_tx_tid(mbuf_t m)
+{
+    switch (mbuf_get_traffic_class(m)) {
+        case MBUF_TC_BK:
+            return 1;
+        case MBUF_TC_VI:
+            return 5;
+        case MBUF_TC_VO:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * iwlagn_tx_encap - turn an 802.3 frame into an 802.11 data frame to the AP
+ *
+ * This is what ieee80211_subif_start_xmit does before the frame gets to the
+ * driver. The Ethernet header is replaced by the 802.11 header and, for an
+ * Ethernet II frame, an LLC/SNAP header. On failure *m may have been freed
+ * and set to NULL.
+ */
+static int iwlagn_tx_encap(struct iwl_rxon_context *ctx, mbuf_t *m, u8 tid)
+{
+    struct ieee80211_qos_hdr *hdr;
+    bool qos = tid != IWL_TID_NON_QOS;
+    size_t hdr_len = qos ? sizeof(struct ieee80211_qos_hdr) : sizeof(struct ieee80211_hdr_3addr);
+    size_t snap_len = 0;
+    u8 eth[ETH_HLEN];
+    
+    if (mbuf_pkthdr_len(*m) < ETH_HLEN || mbuf_copydata(*m, 0, ETH_HLEN, eth))
+        return -EINVAL;
+    
+    if (((eth[2 * ETH_ALEN] << 8) | eth[2 * ETH_ALEN + 1]) >= ETH_P_802_3_MIN) {
+        /* the ethertype stays, behind the LLC/SNAP header */
+        mbuf_adj(*m, 2 * ETH_ALEN);
+        snap_len = sizeof(iwlagn_rfc1042_header);
+    } else {
+        /* 802.3 frames carry their LLC header already */
+        mbuf_adj(*m, ETH_HLEN);
+    }
+    
+    if (mbuf_prepend(m, hdr_len + snap_len, MBUF_DONTWAIT))
+        return -ENOMEM;
+    
+    hdr = (struct ieee80211_qos_hdr *)mbuf_data(*m);
+    memset(hdr, 0, hdr_len);
+    hdr->frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA | IEEE80211_FCTL_TODS |
+                                     (qos ? IEEE80211_STYPE_QOS_DATA : IEEE80211_STYPE_DATA));
+    memcpy(hdr->addr1, ctx->active.bssid_addr, ETH_ALEN);
+    memcpy(hdr->addr2, ctx->active.node_addr, ETH_ALEN);
+    memcpy(hdr->addr3, eth, ETH_ALEN);
+    if (qos)
+        hdr->qos_ctrl = cpu_to_le16(tid);
+    memcpy((u8 *)hdr + hdr_len, iwlagn_rfc1042_header, snap_len);
+    
+    return 0;
+}
+
+/*
+ * iwlagn_tx_build_cmd - the TX command of an 802.11 frame of @len bytes
+ *
+ * Shared by single frames and A-MSDUs. @tid_data is NULL for frames without a
+ * QoS sequence number, otherwise the sequence number goes into @hdr and the
+ * one after it into *next_seq, for the caller to take once the frame is
+ * queued.
+ */
+static struct iwl_device_cmd *iwlagn_tx_build_cmd(struct iwl_priv *priv, struct ieee80211_hdr *hdr, u16 len,
+                                                  u8 sta_id, struct iwl_tid_data *tid_data, bool is_agg,
+                                                  u16 *next_seq)
+{
+    struct iwl_device_cmd *dev_cmd;
+    struct iwl_tx_cmd *tx_cmd;
+    __le16 fc = hdr->frame_control;
+    u8 hdr_len = ieee80211_hdrlen(fc);
+    u16 seq_number = 0;
+
+    dev_cmd = iwl_trans_alloc_tx_cmd(priv->trans);
+
+    if (unlikely(!dev_cmd))
+        return NULL;
+
+    memset(dev_cmd, 0, sizeof(*dev_cmd));
+    dev_cmd->hdr.cmd = REPLY_TX;
+    tx_cmd = (struct iwl_tx_cmd *) dev_cmd->payload;
+
+    /* Total # bytes to be transmitted */
+    tx_cmd->len = cpu_to_le16(len);
+
+    //if (info->control.hw_key)
+    //    iwlagn_tx_cmd_build_hwcrypto(priv, info, tx_cmd, skb);
+
+    /* TODO need this for burst mode later on */
+    iwlagn_tx_cmd_build_basic(priv, tx_cmd, hdr, sta_id, is_agg);
+
+    iwlagn_tx_cmd_build_rate(priv, tx_cmd, fc);
+
+    if (tid_data) {
+        seq_number = tid_data->seq_number;
+        seq_number &= IEEE80211_SCTL_SEQ;
+        hdr->seq_ctrl &= cpu_to_le16(IEEE80211_SCTL_FRAG);
+        hdr->seq_ctrl |= cpu_to_le16(seq_number);
+        seq_number += 0x10;
+    }
+    *next_seq = seq_number;
+
+    /* Copy MAC header from skb into command buffer */
+    memcpy(tx_cmd->hdr, hdr, hdr_len);
+
+    return dev_cmd;
+}
+
+/*
+ * iwlagn_tx_frame - hand an 802.11 frame to the transport
+ *
+ * The second half of iwlagn_tx_skb, shared with the frames the driver builds
+ * itself. @tid_data is NULL for frames without a QoS sequence number. The
+ * frame belongs to the transport only if 0 is returned.
+ */
+static int iwlagn_tx_frame(struct iwl_priv *priv, mbuf_t m, u8 sta_id, struct iwl_tid_data *tid_data,
+                           int txq_id, bool is_agg, bool xmit_more)
+{
+    struct iwl_device_cmd *dev_cmd;
+    struct ieee80211_hdr *hdr = (struct ieee80211_hdr *)mbuf_data(m);
+    __le16 fc = hdr->frame_control;
+    u16 seq_number;
+    int ret;
+
+    //IOSimpleLockLock(priv->sta_lock);
+
+    dev_cmd = iwlagn_tx_build_cmd(priv, hdr, (u16)mbuf_pkthdr_len(m), sta_id, tid_data, is_agg, &seq_number);
+    if (unlikely(!dev_cmd))
+        return -ENOMEM;
+
+    IWL_DEBUG_TX(priv, "TX to [%d|%d] Q:%d - seq: 0x%x\n", sta_id,
+                 ((struct iwl_tx_cmd *)dev_cmd->payload)->tid_tspec, txq_id, seq_number);
+
+    ret = iwl_trans_tx(priv->trans, m, dev_cmd, txq_id, xmit_more);
+    if (ret) {
+        iwl_trans_free_tx_cmd(priv->trans, dev_cmd);
+        //IOSimpleLockUnlock(priv->sta_lock);
+        return ret;
+    }
+
+    if (tid_data && !ieee80211_has_morefrags(fc))
+        tid_data->seq_number = seq_number;
+
+    //IOSimpleLockUnlock(priv->sta_lock);
+
+    return 0;
+}
+
+/*
+ * iwlagn_tx_amsdu - hand an 802.3 frame to the transport for an A-MSDU
+ *
+ * mac80211 builds A-MSDUs itself in Linux, here the transport gathers the
+ * consecutive frames of a burst on an aggregation queue. The QoS data
+ * header built here is only used by the first frame of an A-MSDU, which is
+ * also the only one that takes a sequence number. The frame belongs to the
+ * transport only if 0 is returned. -EBUSY means it is to be retried once
+ * the queue has room.
+ */
+static int iwlagn_tx_amsdu(struct iwl_priv *priv, struct iwl_rxon_context *ctx, mbuf_t m, u8 sta_id, u8 tid,
+                           int txq_id, bool xmit_more)
+{
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+    struct iwl_device_cmd *dev_cmd;
+    struct ieee80211_qos_hdr hdr;
+    u16 seq_number;
+    int ret;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA | IEEE80211_FCTL_TODS | IEEE80211_STYPE_QOS_DATA);
+    memcpy(hdr.addr1, ctx->active.bssid_addr, ETH_ALEN);
+    memcpy(hdr.addr2, ctx->active.node_addr, ETH_ALEN);
+    /* the DA is in the subframe headers, addr3 of an A-MSDU is the BSSID */
+    memcpy(hdr.addr3, ctx->active.bssid_addr, ETH_ALEN);
+    hdr.qos_ctrl = cpu_to_le16(tid);
+
+    /* the transport sets the length once the A-MSDU is complete */
+    dev_cmd = iwlagn_tx_build_cmd(priv, (struct ieee80211_hdr *)&hdr, (u16)(sizeof(hdr) + mbuf_pkthdr_len(m)),
+                                  sta_id, tid_data, true, &seq_number);
+    if (unlikely(!dev_cmd))
+        return -ENOMEM;
+
+    ret = iwl_trans_tx_amsdu(priv->trans, m, dev_cmd, txq_id, tid, xmit_more);
+    if (ret < 0) {
+        iwl_trans_free_tx_cmd(priv->trans, dev_cmd);
+        /* the A-MSDU before it is waiting for room on the ring */
+        return ret == -ENOSPC ? -EBUSY : ret;
+    }
+
+    /* an appended frame goes out under the sequence number of the first one */
+    if (ret == 0)
+        tid_data->seq_number = seq_number;
+
+    return 0;
+}
+
+/*
+ * The block ack session handshake. mac80211 starts the sessions in Linux,
+ * sends the ADDBA request and the DELBA and times out the response
+ * (agg-tx.c), iwlagn_tx_agg_* only run the queue side of it. With no
+ * mac80211 here, the driver does it for the AP station itself.
+ */
+#define IWL_ADDBA_RESP_TIMEOUT	(HZ)	/* ADDBA_RESP_INTERVAL */
+#define IWL_ADDBA_MAX_FAILURES	3
+
+/* on the VO queue, iwlagn_tx_cmd_build_rate picks the lowest rate for it */
+static int iwlagn_tx_mgmt(struct iwl_priv *priv, u8 sta_id, mbuf_t m)
+{
+    struct iwl_rxon_context *ctx = iwlagn_agg_ctx(priv, sta_id);
+    int txq_id = ctx->ac_to_queue[IEEE80211_AC_VO];
+    int ret;
+
+    if (test_bit(priv->queue_to_mac80211[txq_id], &priv->transport_queue_stop))
+        ret = -EBUSY;
+    else
+        ret = iwlagn_tx_frame(priv, m, sta_id, NULL, txq_id, false, false);
+
+    if (ret)
+        mbuf_freem(m);
+    return ret;
+}
+
+static mbuf_t iwlagn_alloc_back_action(struct iwl_priv *priv, u8 sta_id, size_t len)
+{
+    IO80211Controller *dev = static_cast<IO80211Controller *>(priv->trans->dev);
+    struct iwl_rxon_context *ctx = iwlagn_agg_ctx(priv, sta_id);
+    struct ieee80211_mgmt *mgmt;
+    mbuf_t m;
+
+    m = dev->allocatePacket((UInt32)len);
+    if (!m)
+        return NULL;
+
+    mgmt = (struct ieee80211_mgmt *)mbuf_data(m);
+    memset(mgmt, 0, len);
+    mgmt->frame_control = cpu_to_le16(IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_ACTION);
+    memcpy(mgmt->da, priv->stations[sta_id].sta.sta.addr, ETH_ALEN);
+    memcpy(mgmt->sa, ctx->active.node_addr, ETH_ALEN);
+    memcpy(mgmt->bssid, ctx->active.bssid_addr, ETH_ALEN);
+    mgmt->u.action.category = WLAN_CATEGORY_BACK;
+
+    return m;
+}
+
+/* ieee80211_send_addba_request() */
+static int iwlagn_send_addba_req(struct iwl_priv *priv, u8 sta_id, int tid)
+{
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+    struct ieee80211_mgmt *mgmt;
+    u16 capab;
+    mbuf_t m;
+
+    m = iwlagn_alloc_back_action(priv, sta_id, offsetof(struct ieee80211_mgmt, u.action.u.addba_req) +
+                                 sizeof(mgmt->u.action.u.addba_req));
+    if (!m)
+        return -ENOMEM;
+
+    mgmt = (struct ieee80211_mgmt *)mbuf_data(m);
+    mgmt->u.action.u.addba_req.action_code = WLAN_ACTION_ADDBA_REQ;
+    mgmt->u.action.u.addba_req.dialog_token = tid_data->addba_token;
+
+    /* A-MSDUs in the A-MPDUs, see iwlagn_tx_amsdu */
+    capab = IEEE80211_ADDBA_PARAM_AMSDU_MASK;
+    capab |= IEEE80211_ADDBA_PARAM_POLICY_MASK; /* immediate block ack */
+    capab |= (u16)(tid << 2) & IEEE80211_ADDBA_PARAM_TID_MASK;
+    capab |= (u16)(LINK_QUAL_AGG_FRAME_LIMIT_DEF << 6) & IEEE80211_ADDBA_PARAM_BUF_SIZE_MASK;
+    mgmt->u.action.u.addba_req.capab = cpu_to_le16(capab);
+    mgmt->u.action.u.addba_req.timeout = 0;
+    mgmt->u.action.u.addba_req.start_seq_num = cpu_to_le16(tid_data->agg.ssn << 4);
+
+    IWL_DEBUG_HT(priv, "ADDBA request on STA/TID %d/%d, SSN %d\n", sta_id, tid, tid_data->agg.ssn);
+
+    return iwlagn_tx_mgmt(priv, sta_id, m);
+}
+
+/* ieee80211_send_delba(), we are the originator */
+static int iwlagn_send_delba(struct iwl_priv *priv, u8 sta_id, int tid)
+{
+    struct ieee80211_mgmt *mgmt;
+    u16 params;
+    mbuf_t m;
+
+    m = iwlagn_alloc_back_action(priv, sta_id, offsetof(struct ieee80211_mgmt, u.action.u.delba) +
+                                 sizeof(mgmt->u.action.u.delba));
+    if (!m)
+        return -ENOMEM;
+
+    mgmt = (struct ieee80211_mgmt *)mbuf_data(m);
+    mgmt->u.action.u.delba.action_code = WLAN_ACTION_DELBA;
+
+    params = (u16)(tid << 12) | IEEE80211_DELBA_PARAM_INITIATOR_MASK;
+    mgmt->u.action.u.delba.params = cpu_to_le16(params);
+    mgmt->u.action.u.delba.reason_code = cpu_to_le16(WLAN_REASON_QSTA_NOT_USE);
+
+    return iwlagn_tx_mgmt(priv, sta_id, m);
+}
+
+static void iwlagn_tx_agg_arm_timer(struct iwl_priv *priv, unsigned long expires)
+{
+    IOTimerEventSource *timer = static_cast<IOTimerEventSource *>(priv->addba_timer);
+
+    if (!timer || priv->addba_timer_armed)
+        return;
+
+    priv->addba_timer_armed = true;
+    timer->setTimeoutMS(time_after(expires, jiffies) ? (u32)jiffies_to_msecs(expires - jiffies) : 1);
+}
+
+/* ieee80211_start_tx_ba_cb(): the queue is ready, ask the peer */
+static void iwlagn_tx_agg_start_cb(struct iwl_priv *priv, int sta_id, int tid)
+{
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+
+    tid_data->addba_token++;
+    tid_data->addba_time = jiffies;
+
+    /* a request that didn't go out times out like an unanswered one */
+    if (iwlagn_send_addba_req(priv, sta_id, tid))
+        IWL_DEBUG_HT(priv, "Couldn't send the ADDBA request on STA/TID %d/%d\n", sta_id, tid);
+
+    iwlagn_tx_agg_arm_timer(priv, tid_data->addba_time + IWL_ADDBA_RESP_TIMEOUT);
+}
+
+/* ieee80211_stop_tx_ba_cb(): the session is off, the TID is sent on its AC queue again */
+static void iwlagn_tx_agg_stop_cb(struct iwl_priv *priv, int sta_id, int tid)
+{
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+
+    if (tid_data->addba_delba) {
+        tid_data->addba_delba = false;
+        iwlagn_send_delba(priv, sta_id, tid);
+    }
+
+    IWL_DEBUG_HT(priv, "TX AGG stopped on STA/TID %d/%d\n", sta_id, tid);
+
+    iwlagn_wake_output_queue(priv);
+}
+
+/* a session that didn't come up is tried again later, and not at all after a few failures */
+static void iwlagn_tx_agg_abort(struct iwl_priv *priv, int sta_id, int tid, bool delba)
+{
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+
+    tid_data->addba_failures++;
+    tid_data->addba_time = jiffies;
+    tid_data->addba_delba = delba;
+    iwlagn_tx_agg_stop(priv, NULL, priv->stations[sta_id].ieee_sta, tid);
+}
+
+/* ieee80211_start_tx_ba_session(), for a TID of an HT station that has traffic */
+static void iwlagn_tx_agg_check(struct iwl_priv *priv, u8 sta_id, u8 tid)
+{
+    struct ieee80211_sta *sta = priv->stations[sta_id].ieee_sta;
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+    u16 ssn;
+
+    if (!sta || !sta->ht_cap.ht_supported || !priv->nvm_data->sku_cap_11n_enable ||
+        (iwlwifi_mod_params.disable_11n & IWL_DISABLE_HT_TXAGG))
+        return;
+
+    if (tid_data->addba_failures >= IWL_ADDBA_MAX_FAILURES ||
+        (tid_data->addba_failures &&
+         time_before(jiffies, tid_data->addba_time + (HZ << tid_data->addba_failures))))
+        return;
+
+    tid_data->addba_time = jiffies;
+    tid_data->addba_delba = false;
+    if (iwlagn_tx_agg_start(priv, NULL, sta, tid, &ssn)) {
+        tid_data->addba_failures++;
+        return;
+    }
+
+    /* the AC queue is drained first, iwlagn_check_ratid_empty sends the request then */
+    if (tid_data->agg.state == IWL_EMPTYING_HW_QUEUE_ADDBA)
+        iwlagn_tx_agg_arm_timer(priv, tid_data->addba_time + IWL_ADDBA_RESP_TIMEOUT);
+}
+
+/* sta_addba_resp_timer_expired() */
+static void iwlagn_tx_agg_timer_fired(OSObject *owner, IOTimerEventSource *sender)
+{
+    struct iwl_priv *priv = static_cast<struct iwl_priv *>(sender->getRefcon());
+    struct iwl_tid_data *tid_data;
+    unsigned long expires, next = 0;
+    bool pending = false;
+    int sta_id, tid;
+
+    priv->addba_timer_armed = false;
+
+    for (sta_id = 0; sta_id < IWLAGN_STATION_COUNT; sta_id++) {
+        for (tid = 0; tid < IWL_MAX_TID_COUNT; tid++) {
+            tid_data = &priv->tid_data[sta_id][tid];
+            if (tid_data->agg.state != IWL_AGG_STARTING &&
+                tid_data->agg.state != IWL_EMPTYING_HW_QUEUE_ADDBA)
+                continue;
+
+            expires = tid_data->addba_time + IWL_ADDBA_RESP_TIMEOUT;
+            if (time_before(jiffies, expires)) {
+                if (!pending || time_before(expires, next))
+                    next = expires;
+                pending = true;
+                continue;
+            }
+
+            IWL_DEBUG_HT(priv, "No ADDBA response on STA/TID %d/%d (%d)\n",
+                         sta_id, tid, tid_data->agg.state);
+            /* only a request that went out is taken back */
+            iwlagn_tx_agg_abort(priv, sta_id, tid, tid_data->agg.state == IWL_AGG_STARTING);
+        }
+    }
+
+    if (pending)
+        iwlagn_tx_agg_arm_timer(priv, next);
+}
+
+/* ieee80211_process_addba_resp() */
+void iwlagn_tx_agg_addba_resp(struct iwl_priv *priv, int sta_id, struct ieee80211_mgmt *mgmt, u16 len)
+{
+    struct iwl_tid_data *tid_data;
+    u16 capab, status, buf_size;
+    int tid;
+
+    if (len < offsetof(struct ieee80211_mgmt, u.action.u.addba_resp) + sizeof(mgmt->u.action.u.addba_resp))
+        return;
+
+    capab = le16_to_cpu(mgmt->u.action.u.addba_resp.capab);
+    tid = (capab & IEEE80211_ADDBA_PARAM_TID_MASK) >> 2;
+    if (tid >= IWL_MAX_TID_COUNT || !priv->stations[sta_id].ieee_sta)
+        return;
+
+    tid_data = &priv->tid_data[sta_id][tid];
+    if (tid_data->agg.state != IWL_AGG_STARTING ||
+        mgmt->u.action.u.addba_resp.dialog_token != tid_data->addba_token) {
+        IWL_DEBUG_HT(priv, "Unexpected ADDBA response on STA/TID %d/%d\n", sta_id, tid);
+        return;
+    }
+
+    status = le16_to_cpu(mgmt->u.action.u.addba_resp.status);
+    if (status != WLAN_STATUS_SUCCESS) {
+        IWL_DEBUG_HT(priv, "ADDBA on STA/TID %d/%d declined (%d)\n", sta_id, tid, status);
+        iwlagn_tx_agg_abort(priv, sta_id, tid, false);
+        return;
+    }
+
+    /* the window the recipient can take, what we asked for if it doesn't say */
+    buf_size = (capab & IEEE80211_ADDBA_PARAM_BUF_SIZE_MASK) >> 6;
+    if (!buf_size || buf_size > LINK_QUAL_AGG_FRAME_LIMIT_DEF)
+        buf_size = LINK_QUAL_AGG_FRAME_LIMIT_DEF;
+
+    tid_data->addba_failures = 0;
+    tid_data->addba_amsdu = capab & IEEE80211_ADDBA_PARAM_AMSDU_MASK;
+    iwlagn_tx_agg_oper(priv, NULL, priv->stations[sta_id].ieee_sta, tid, (u8)buf_size);
+    iwlagn_wake_output_queue(priv);
+}
+
+/* ieee80211_process_delba() of the recipient, and the stop part of iwlagn_mac_ampdu_action() */
+void iwlagn_tx_agg_delba(struct iwl_priv *priv, int sta_id, int tid)
+{
+    struct ieee80211_sta *sta = priv->stations[sta_id].ieee_sta;
+    struct iwl_station_priv *sta_priv;
+    bool was_on;
+
+    if (!sta || priv->tid_data[sta_id][tid].agg.state == IWL_AGG_OFF)
+        return;
+
+    IWL_DEBUG_HT(priv, "Peer stopped TX AGG on STA/TID %d/%d\n", sta_id, tid);
+
+    sta_priv = (struct iwl_station_priv *)sta->drv_priv;
+    was_on = priv->tid_data[sta_id][tid].agg.state == IWL_AGG_ON;
+    priv->tid_data[sta_id][tid].addba_delba = false;
+
+    if (iwlagn_tx_agg_stop(priv, NULL, sta, tid) == 0 && was_on && priv->agg_tids_count > 0) {
+        priv->agg_tids_count--;
+        IWL_DEBUG_HT(priv, "priv->agg_tids_count = %u\n", priv->agg_tids_count);
+    }
+    if (was_on && !priv->agg_tids_count && priv->hw_params.use_rts_for_aggregation) {
+        /*
+         * switch off RTS/CTS if it was previously enabled
+         */
+        sta_priv->lq_sta.lq.general_params.flags &= ~LINK_QUAL_FLAGS_SET_STA_TLC_RTS_MSK;
+        iwl_send_lq_cmd(priv, iwlagn_agg_ctx(priv, sta_id), &sta_priv->lq_sta.lq, CMD_ASYNC, false);
+    }
+}
+
+int iwlagn_tx_agg_init(struct iwl_priv *priv)
+{
+    IOCommandGate *gate = static_cast<IOCommandGate *>(priv->trans->gate);
+    IOTimerEventSource *timer;
+
+    timer = IOTimerEventSource::timerEventSource(static_cast<OSObject *>(priv->trans->dev),
+                                                 iwlagn_tx_agg_timer_fired);
+    if (!timer)
+        return -ENOMEM;
+
+    timer->setRefcon(priv);
+    if (gate->getWorkLoop()->addEventSource(timer) != kIOReturnSuccess) {
+        timer->release();
+        return -ENOMEM;
+    }
+    priv->addba_timer = timer;
+    priv->addba_timer_armed = false;
+    return 0;
+}
+
+void iwlagn_tx_agg_exit(struct iwl_priv *priv)
+{
+    IOTimerEventSource *timer = static_cast<IOTimerEventSource *>(priv->addba_timer);
+
+    if (!timer)
+        return;
+
+    timer->cancelTimeout();
+    timer->getWorkLoop()->removeEventSource(timer);
+    timer->release();
+    priv->addba_timer = NULL;
+    priv->addba_timer_armed = false;
+}
+/* CUSTOM END */
+
+/*
+ * Takes an 802.3 frame of the network stack, there is no mac80211 to build
+ * the 802.11 frame and pick the station and queue for it. The frame belongs
+ * to the transport only if 0 is returned.
+ */
+int iwlagn_tx_skb(struct iwl_priv *priv, mbuf_t *m, bool xmit_more)
+{
+    struct iwl_rxon_context *ctx = &priv->contexts[IWL_RXON_CTX_BSS];
+    struct iwl_tid_data *tid_data = NULL;
+    u8 sta_id, tid = IWL_TID_NON_QOS;
+    bool is_agg = false;
+    int txq_id, ret;
+
+    if (iwl_is_rfkill(priv)) {
+        IWL_DEBUG_DROP(priv, "Dropping - RF KILL\n");
+        return -ENETDOWN;
+    }
+
+    /* CUSTOM: station mode only, all data goes to the AP */
+    sta_id = ctx->ap_sta_id;
+    if (!iwl_is_associated_ctx(ctx) || sta_id == IWL_INVALID_STATION ||
+        !(priv->stations[sta_id].used & IWL_STA_UCODE_ACTIVE)) {
+        IWL_DEBUG_DROP(priv, "Dropping - not associated\n");
+        return -ENETDOWN;
+    }
+
+    if (ctx->qos_data.qos_active) {
+        tid = iwlagn_tx_tid(*m);
+        tid_data = &priv->tid_data[sta_id][tid];
+
+        /* CUSTOM: mac80211 would have started the BA session */
+        if (tid_data->agg.state == IWL_AGG_OFF)
+            iwlagn_tx_agg_check(priv, sta_id, tid);
+
+        /* We can receive packets from the stack in IWL_AGG_{ON,OFF}
+         * only. Check this here.
+         */
+        if (tid_data->agg.state != IWL_AGG_ON && tid_data->agg.state != IWL_AGG_OFF) {
+            /* CUSTOM: mac80211 holds them back, the output queue is woken when the session is up or off */
+            IWL_DEBUG_TX_QUEUES(priv, "Tx while agg.state = %d, stalling the output queue\n",
+                                tid_data->agg.state);
+            return -EBUSY;
+        }
+        is_agg = tid_data->agg.state == IWL_AGG_ON;
+    }
+
+    if (is_agg)
+        txq_id = tid_data->agg.txq_id;
+    else
+        txq_id = ctx->ac_to_queue[tid_data ? tid_to_ac[tid] : IEEE80211_AC_BE];
+
+    /* CUSTOM: ieee80211_stop_queue(), the frame is retried when the queue is woken */
+    if (test_bit(priv->queue_to_mac80211[txq_id], &priv->transport_queue_stop)) {
+        IWL_DEBUG_TX_QUEUES(priv, "Q: %d stopped, stalling the output queue\n", txq_id);
+        return -EBUSY;
+    }
+
+    /* CUSTOM: A-MSDUs if the peer takes them, frames the transport can't carry in one go out on their own */
+    if (is_agg && tid_data->addba_amsdu)
+        ret = iwlagn_tx_amsdu(priv, ctx, *m, sta_id, tid, txq_id, xmit_more);
+    else
+        ret = -EOPNOTSUPP;
+
+    if (ret == -EOPNOTSUPP || ret == -EINVAL || ret == -EMSGSIZE) {
+        ret = iwlagn_tx_encap(ctx, m, tid);
+        if (ret)
+            return ret;
+
+        ret = iwlagn_tx_frame(priv, *m, sta_id, tid_data, txq_id, is_agg, xmit_more);
+    }
+    if (ret)
+        return ret;
+
+    /* CUSTOM: the doorbell of this queue may be waiting for the next frame */
+    if (xmit_more)
+        set_bit(txq_id, priv->tx_push_queues);
+
+    return 0;
+}
+
+/* CUSTOM */
+/*
+ * End of a TX burst: publish the frames held back on the queues it used.
+ * The last frame only does that for its own queue, and not at all if it
+ * couldn't be sent.
+ */
+void iwlagn_tx_push(struct iwl_priv *priv)
+{
+    int q;
+
+    for_each_set_bit(q, priv->tx_push_queues, IWL_MAX_HW_QUEUES) {
+        clear_bit(q, priv->tx_push_queues);
+        iwl_trans_txq_push(priv->trans, q);
+    }
+}
+
+/*
+ * ieee80211_wake_queue(): frames of a stalled output queue are sent again.
+ * Asynchronously, the transport calls in with the lock of a queue held.
+ */
+void iwlagn_wake_output_queue(struct iwl_priv *priv)
+{
+    IO80211Controller *dev = static_cast<IO80211Controller *>(priv->trans->dev);
+    IOOutputQueue *queue = dev->getOutputQueue();
+
+    if (queue)
+        queue->service(IOOutputQueue::kServiceAsync);
+}
+/* CUSTOM END */
+
+// line 477
+static int iwlagn_alloc_agg_txq(struct iwl_priv *priv, int mq)
+{
+    int q;
+
+    for (q = IWLAGN_FIRST_AMPDU_QUEUE; q < priv->cfg->base_params->num_of_queues; q++) {
+        if (!test_and_set_bit(q, priv->agg_q_alloc)) {
+            priv->queue_to_mac80211[q] = mq;
+            return q;
+        }
+    }
+
+    return -ENOSPC;
+}
+
+// line 492
+static void iwlagn_dealloc_agg_txq(struct iwl_priv *priv, int q)
+{
+    clear_bit(q, priv->agg_q_alloc);
+    priv->queue_to_mac80211[q] = IWL_INVALID_MAC80211_QUEUE;
+}
+
+// line 498
+int iwlagn_tx_agg_stop(struct iwl_priv *priv, struct ieee80211_vif *vif,
+                       struct ieee80211_sta *sta, u16 tid)
+{
+    struct iwl_tid_data *tid_data;
+    int sta_id, txq_id;
+    enum iwl_agg_state agg_state;
+
+    sta_id = iwl_sta_id(sta);
+
+    if (sta_id == IWL_INVALID_STATION) {
+        IWL_ERR(priv, "Invalid station for AGG tid %d\n", tid);
+        return -ENXIO;
+    }
+
+    //IOSimpleLockLock(priv->sta_lock);
+
+    tid_data = &priv->tid_data[sta_id][tid];
+    txq_id = tid_data->agg.txq_id;
+
+    switch (tid_data->agg.state) {
+        case IWL_EMPTYING_HW_QUEUE_ADDBA:
+            /*
+             * This can happen if the peer stops aggregation
+             * again before we've had a chance to drain the
+             * queue we selected previously, i.e. before the
+             * session was really started completely.
+             */
+            IWL_DEBUG_HT(priv, "AGG stop before setup done\n");
+            goto turn_off;
+        case IWL_AGG_STARTING:
+            /*
+             * This can happen when the session is stopped before
+             * we receive ADDBA response
+             */
+            IWL_DEBUG_HT(priv, "AGG stop before AGG became operational\n");
+            goto turn_off;
+        case IWL_AGG_ON:
+            break;
+        default:
+            IWL_WARN(priv, "Stopping AGG while state not ON or starting for %d on %d (%d)\n",
+                     sta_id, tid, tid_data->agg.state);
+            //IOSimpleLockUnlock(priv->sta_lock);
+            return 0;
+    }
+
+    tid_data->agg.ssn = IEEE80211_SEQ_TO_SN(tid_data->seq_number);
+
+    /* There are still packets for this RA / TID in the HW */
+    if (!test_bit(txq_id, priv->agg_q_alloc)) {
+        IWL_DEBUG_TX_QUEUES(priv, "stopping AGG on STA/TID %d/%d but hwq %d not used\n",
+                            sta_id, tid, txq_id);
+    } else if (tid_data->agg.ssn != tid_data->next_reclaimed) {
+        IWL_DEBUG_TX_QUEUES(priv, "Can't proceed: ssn %d, next_recl = %d\n",
+                            tid_data->agg.ssn, tid_data->next_reclaimed);
+        tid_data->agg.state = IWL_EMPTYING_HW_QUEUE_DELBA;
+        //IOSimpleLockUnlock(priv->sta_lock);
+        return 0;
+    }
+
+    IWL_DEBUG_TX_QUEUES(priv, "Can proceed: ssn = next_recl = %d\n", tid_data->agg.ssn);
+turn_off:
+    agg_state = tid_data->agg.state;
+    tid_data->agg.state = IWL_AGG_OFF;
+
+    //IOSimpleLockUnlock(priv->sta_lock);
+
+    if (test_bit(txq_id, priv->agg_q_alloc)) {
+        /*
+         * If the transport didn't know that we wanted to start
+         * agreggation, don't tell it that we want to stop them.
+         * This can happen when we don't get the addBA response on
+         * time, or we hadn't time to drain the AC queues.
+         */
+        if (agg_state == IWL_AGG_ON)
+            iwl_trans_txq_disable(priv->trans, txq_id, true);
+        else
+            IWL_DEBUG_TX_QUEUES(priv, "Don't disable tx agg: %d\n", agg_state);
+        iwlagn_dealloc_agg_txq(priv, txq_id);
+    }
+
+    //ieee80211_stop_tx_ba_cb_irqsafe(vif, sta->addr, tid);
+    iwlagn_tx_agg_stop_cb(priv, sta_id, tid);
+
+    return 0;
+}
+
+// line 581
+int iwlagn_tx_agg_start(struct iwl_priv *priv, struct ieee80211_vif *vif,
+                        struct ieee80211_sta *sta, u16 tid, u16 *ssn)
+{
+    struct iwl_rxon_context *ctx;
+    struct iwl_tid_data *tid_data;
+    int sta_id, txq_id, ret;
+
+    IWL_DEBUG_HT(priv, "TX AGG request on ra = %pM tid = %d\n", sta->addr, tid);
+
+    sta_id = iwl_sta_id(sta);
+    if (sta_id == IWL_INVALID_STATION) {
+        IWL_ERR(priv, "Start AGG on invalid station\n");
+        return -ENXIO;
+    }
+    if (unlikely(tid >= IWL_MAX_TID_COUNT))
+        return -EINVAL;
+
+    if (priv->tid_data[sta_id][tid].agg.state != IWL_AGG_OFF) {
+        IWL_ERR(priv, "Start AGG when state is not IWL_AGG_OFF !\n");
+        return -ENXIO;
+    }
+
+    ctx = iwlagn_agg_ctx(priv, sta_id);
+
+    txq_id = iwlagn_alloc_agg_txq(priv, ctx->ac_to_queue[tid_to_ac[tid]]);
+    if (txq_id < 0) {
+        IWL_DEBUG_TX_QUEUES(priv, "No free aggregation queue for %pM/%d\n", sta->addr, tid);
+        return txq_id;
+    }
+
+    ret = iwl_sta_tx_modify_enable_tid(priv, sta_id, tid);
+    if (ret) {
+        /* CUSTOM: don't leak the queue we just took */
+        iwlagn_dealloc_agg_txq(priv, txq_id);
+        return ret;
+    }
+
+    //IOSimpleLockLock(priv->sta_lock);
+    tid_data = &priv->tid_data[sta_id][tid];
+    tid_data->agg.ssn = IEEE80211_SEQ_TO_SN(tid_data->seq_number);
+    tid_data->agg.txq_id = txq_id;
+
+    *ssn = tid_data->agg.ssn;
+
+    if (*ssn == tid_data->next_reclaimed) {
+        IWL_DEBUG_TX_QUEUES(priv, "Can proceed: ssn = next_recl = %d\n", tid_data->agg.ssn);
+        tid_data->agg.state = IWL_AGG_STARTING;
+        //ieee80211_start_tx_ba_cb_irqsafe(vif, sta->addr, tid);
+        iwlagn_tx_agg_start_cb(priv, sta_id, tid);
+    } else {
+        IWL_DEBUG_TX_QUEUES(priv, "Can't proceed: ssn %d, next_reclaimed = %d\n",
+                            tid_data->agg.ssn, tid_data->next_reclaimed);
+        tid_data->agg.state = IWL_EMPTYING_HW_QUEUE_ADDBA;
+    }
+    //IOSimpleLockUnlock(priv->sta_lock);
+
+    return ret;
+}
+
+// line 640
+int iwlagn_tx_agg_flush(struct iwl_priv *priv, struct ieee80211_vif *vif,
+                        struct ieee80211_sta *sta, u16 tid)
+{
+    struct iwl_tid_data *tid_data;
+    enum iwl_agg_state agg_state;
+    int sta_id, txq_id;
+    sta_id = iwl_sta_id(sta);
+
+    if (sta_id == IWL_INVALID_STATION)
+        return -ENXIO;
+
+    /*
+     * First set the agg state to OFF to avoid calling
+     * ieee80211_stop_tx_ba_cb in iwlagn_check_ratid_empty.
+     */
+    //IOSimpleLockLock(priv->sta_lock);
+
+    tid_data = &priv->tid_data[sta_id][tid];
+    txq_id = tid_data->agg.txq_id;
+    agg_state = tid_data->agg.state;
+    IWL_DEBUG_TX_QUEUES(priv, "Flush AGG: sta %d tid %d q %d state %d\n",
+                        sta_id, tid, txq_id, tid_data->agg.state);
+
+    tid_data->agg.state = IWL_AGG_OFF;
+
+    //IOSimpleLockUnlock(priv->sta_lock);
+
+    if (iwlagn_txfifo_flush(priv, BIT(txq_id)))
+        IWL_ERR(priv, "Couldn't flush the AGG queue\n");
+
+    if (test_bit(txq_id, priv->agg_q_alloc)) {
+        /*
+         * If the transport didn't know that we wanted to start
+         * agreggation, don't tell it that we want to stop them.
+         * This can happen when we don't get the addBA response on
+         * time, or we hadn't time to drain the AC queues.
+         */
+        if (agg_state == IWL_AGG_ON)
+            iwl_trans_txq_disable(priv->trans, txq_id, true);
+        else
+            IWL_DEBUG_TX_QUEUES(priv, "Don't disable tx agg: %d\n", agg_state);
+        iwlagn_dealloc_agg_txq(priv, txq_id);
+    }
+
+    return 0;
+}
+
+// line 683
+int iwlagn_tx_agg_oper(struct iwl_priv *priv, struct ieee80211_vif *vif,
+                       struct ieee80211_sta *sta, u16 tid, u8 buf_size)
+{
+    struct iwl_station_priv *sta_priv = (struct iwl_station_priv *)sta->drv_priv;
+    struct iwl_rxon_context *ctx = iwlagn_agg_ctx(priv, sta_priv->sta_id);
+    int q, fifo;
+    u16 ssn;
+
+    buf_size = min_t(int, buf_size, LINK_QUAL_AGG_FRAME_LIMIT_DEF);
+
+    //IOSimpleLockLock(priv->sta_lock);
+    ssn = priv->tid_data[sta_priv->sta_id][tid].agg.ssn;
+    q = priv->tid_data[sta_priv->sta_id][tid].agg.txq_id;
+    priv->tid_data[sta_priv->sta_id][tid].agg.state = IWL_AGG_ON;
+    //IOSimpleLockUnlock(priv->sta_lock);
+
+    fifo = ctx->ac_to_fifo[tid_to_ac[tid]];
+
+    /*
+     * Program the scheduler: this binds the queue to the RA/TID pair,
+     * sets the window (frame limit) and starts it at the agreed SSN.
+     */
+    iwl_trans_txq_enable(priv->trans, q, fifo, sta_priv->sta_id, tid, buf_size, ssn, 0);
+
+    /*
+     * If the limit is 0, then it wasn't initialised yet,
+     * use the default. We can do that since we take the
+     * minimum below, and we don't want to go above our
+     * default due to hardware restrictions.
+     */
+    if (sta_priv->max_agg_bufsize == 0)
+        sta_priv->max_agg_bufsize = LINK_QUAL_AGG_FRAME_LIMIT_DEF;
+
+    /*
+     * Even though in theory the peer could have different
+     * aggregation reorder buffer sizes for different sessions,
+     * our ucode doesn't allow for that and has a global limit
+     * for each station. Therefore, use the minimum of all the
+     * aggregation sessions and our default value.
+     */
+    sta_priv->max_agg_bufsize = min_t(u8, sta_priv->max_agg_bufsize, buf_size);
+
+    if (priv->hw_params.use_rts_for_aggregation) {
+        /*
+         * switch to RTS/CTS if it is the prefer protection
+         * method for HT traffic
+         */
+        sta_priv->lq_sta.lq.general_params.flags |= LINK_QUAL_FLAGS_SET_STA_TLC_RTS_MSK;
+    }
+    priv->agg_tids_count++;
+    IWL_DEBUG_HT(priv, "priv->agg_tids_count = %u\n", priv->agg_tids_count);
+
+    sta_priv->lq_sta.lq.agg_params.agg_frame_cnt_limit = sta_priv->max_agg_bufsize;
+
+    IWL_DEBUG_HT(priv, "Tx aggregation enabled on ra = %pM tid = %d\n", sta->addr, tid);
+
+    return iwl_send_lq_cmd(priv, ctx, &sta_priv->lq_sta.lq, CMD_ASYNC, false);
+}
+
+// line 744
+void iwlagn_check_ratid_empty(struct iwl_priv *priv, int sta_id, u8 tid)
+{
+    struct iwl_tid_data *tid_data = &priv->tid_data[sta_id][tid];
+
+    // TODO: Implement
+    //lockdep_assert_held(&priv->sta_lock);
+
+    switch (priv->tid_data[sta_id][tid].agg.state) {
+        case IWL_EMPTYING_HW_QUEUE_DELBA:
+            /* There are no packets for this RA / TID in the HW any more */
+            if (tid_data->agg.ssn == tid_data->next_reclaimed) {
+                IWL_DEBUG_TX_QUEUES(priv, "Can continue DELBA flow ssn = next_recl = %d\n",
+                                    tid_data->next_reclaimed);
+                iwl_trans_txq_disable(priv->trans, tid_data->agg.txq_id, true);
+                iwlagn_dealloc_agg_txq(priv, tid_data->agg.txq_id);
+                tid_data->agg.state = IWL_AGG_OFF;
+                //ieee80211_stop_tx_ba_cb_irqsafe(vif, addr, tid);
+                iwlagn_tx_agg_stop_cb(priv, sta_id, tid);
+            }
+            break;
+        case IWL_EMPTYING_HW_QUEUE_ADDBA:
+            /* There are no packets for this RA / TID in the HW any more */
+            if (tid_data->agg.ssn == tid_data->next_reclaimed) {
+                IWL_DEBUG_TX_QUEUES(priv, "Can continue ADDBA flow ssn = next_recl = %d\n",
+                                    tid_data->next_reclaimed);
+                tid_data->agg.state = IWL_AGG_STARTING;
+                //ieee80211_start_tx_ba_cb_irqsafe(vif, addr, tid);
+                iwlagn_tx_agg_start_cb(priv, sta_id, tid);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static inline u32 iwlagn_get_scd_ssn(struct iwlagn_tx_resp *tx_resp)
+{
+    return le32_to_cpup((__le32 *)&tx_resp->status + tx_resp->frame_count) & IEEE80211_MAX_SN;
+}
+
+static void iwl_rx_reply_tx_agg(struct iwl_priv *priv, struct iwlagn_tx_resp *tx_resp)
+{
+    struct agg_tx_status *frame_status = &tx_resp->status;
+    int tid = (tx_resp->ra_tid & IWLAGN_TX_RES_TID_MSK) >> IWLAGN_TX_RES_TID_POS;
+    int sta_id = (tx_resp->ra_tid & IWLAGN_TX_RES_RA_MSK) >> IWLAGN_TX_RES_RA_POS;
+    struct iwl_ht_agg *agg = &priv->tid_data[sta_id][tid].agg;
+    u32 status = le16_to_cpu(tx_resp->status.status);
+    int i;
+
+    WARN_ON(tid == IWL_TID_NON_QOS);
+
+    if (agg->wait_for_ba)
+        IWL_DEBUG_TX_REPLY(priv, "got tx response w/o block-ack\n");
+
+    agg->rate_n_flags = le32_to_cpu(tx_resp->rate_n_flags);
+    agg->wait_for_ba = (tx_resp->frame_count > 1);
+
+    /*
+     * If the BT kill count is non-zero, we'll get this
+     * notification again.
+     */
+    if (tx_resp->bt_kill_count && tx_resp->frame_count == 1 &&
+        priv->lib->bt_params && priv->lib->bt_params->advanced_bt_coexist) {
+        IWL_DEBUG_COEX(priv, "receive reply tx w/ bt_kill\n");
+    }
+
+    if (tx_resp->frame_count == 1)
+        return;
+
+    IWL_DEBUG_TX_REPLY(priv, "TXQ %d initial_rate 0x%x ssn %d frm_cnt %d\n",
+                       agg->txq_id, le32_to_cpu(tx_resp->rate_n_flags),
+                       iwlagn_get_scd_ssn(tx_resp), tx_resp->frame_count);
+
+    /* Construct bit-map of pending frames within Tx window */
+    for (i = 0; i < tx_resp->frame_count; i++) {
+        u16 fstatus = le16_to_cpu(frame_status[i].status);
+        u8 retry_cnt = (fstatus & AGG_TX_TRY_MSK) >> AGG_TX_TRY_POS;
+
+        //if (status & AGG_TX_STATUS_MSK)
+        //    iwlagn_count_agg_tx_err_status(priv, fstatus);
+
+        if (status & (AGG_TX_STATE_FEW_BYTES_MSK | AGG_TX_STATE_ABORT_MSK))
+            continue;
+
+        if (status & AGG_TX_STATUS_MSK || retry_cnt > 1)
+            IWL_DEBUG_TX_REPLY(priv, "%d: status 0x%04x, try-count (0x%01x)\n",
+                               i, fstatus & AGG_TX_STATUS_MSK, retry_cnt);
+    }
+}
+
+/*
+ * There is no one to report the TX status to, the frames are only reclaimed
+ * and freed by the transport.
+ */
+void iwlagn_rx_reply_tx(struct iwl_priv *priv, struct iwl_rx_cmd_buffer *rxb)
+{
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(rxb);
+    u16 sequence = le16_to_cpu(pkt->hdr.sequence);
+    int txq_id = SEQ_TO_QUEUE(sequence);
+    struct iwlagn_tx_resp *tx_resp = (struct iwlagn_tx_resp *)pkt->data;
+    u32 status = le16_to_cpu(tx_resp->status.status);
+    u16 ssn = iwlagn_get_scd_ssn(tx_resp);
+    int tid;
+    int sta_id;
+    bool is_agg = (txq_id >= IWLAGN_FIRST_AMPDU_QUEUE);
+
+    tid = (tx_resp->ra_tid & IWLAGN_TX_RES_TID_MSK) >> IWLAGN_TX_RES_TID_POS;
+    sta_id = (tx_resp->ra_tid & IWLAGN_TX_RES_RA_MSK) >> IWLAGN_TX_RES_RA_POS;
+
+    //IOSimpleLockLock(priv->sta_lock);
+
+    if (is_agg) {
+        WARN_ON_ONCE(sta_id >= IWLAGN_STATION_COUNT || tid >= IWL_MAX_TID_COUNT);
+        if (txq_id != priv->tid_data[sta_id][tid].agg.txq_id)
+            IWL_ERR(priv, "txq_id mismatch: %d %d\n", txq_id, priv->tid_data[sta_id][tid].agg.txq_id);
+        iwl_rx_reply_tx_agg(priv, tx_resp);
+    }
+
+    if (tx_resp->frame_count == 1) {
+        u16 next_reclaimed = le16_to_cpu(tx_resp->seq_ctl);
+        next_reclaimed = IEEE80211_SEQ_TO_SN(next_reclaimed + 0x10);
+
+        if (is_agg) {
+            /* If this is an aggregation queue, we can rely on the
+             * ssn since the wifi sequence number corresponds to
+             * the index in the TFD ring (%256).
+             * The seq_ctl is the sequence control of the packet
+             * to which this Tx response relates. But if there is a
+             * hole in the bitmap of the BA we received, this Tx
+             * response may allow to reclaim the hole and all the
+             * subsequent packets that were already acked.
+             * In that case, seq_ctl != ssn, and the next packet
+             * to be reclaimed will be ssn and not seq_ctl.
+             */
+            next_reclaimed = ssn;
+        }
+
+        if (tid != IWL_TID_NON_QOS) {
+            priv->tid_data[sta_id][tid].next_reclaimed = next_reclaimed;
+            IWL_DEBUG_TX_REPLY(priv, "Next reclaimed packet:%d\n", next_reclaimed);
+            iwlagn_check_ratid_empty(priv, sta_id, tid);
+        }
+
+        IWL_DEBUG_TX_REPLY(priv, "TXQ %d status 0x%x ssn %d\n", txq_id, status, ssn);
+
+        iwl_trans_reclaim(priv->trans, txq_id, ssn);
+    }
+
+    //iwl_check_abort_status(priv, tx_resp->frame_count, status);
+    //IOSimpleLockUnlock(priv->sta_lock);
+}
+
+/**
+ * iwlagn_rx_reply_compressed_ba - Handler for REPLY_COMPRESSED_BA
+ *
+ * Handles block-acknowledge notification from device, which reports success
+ * of frames sent via aggregation.
+ */
+void iwlagn_rx_reply_compressed_ba(struct iwl_priv *priv, struct iwl_rx_cmd_buffer *rxb)
+{
+    struct iwl_rx_packet *pkt = (struct iwl_rx_packet *)rxb_addr(rxb);
+    struct iwl_compressed_ba_resp *ba_resp = (struct iwl_compressed_ba_resp *)pkt->data;
+    struct iwl_ht_agg *agg;
+    int sta_id;
+    int tid;
+
+    /* "flow" corresponds to Tx queue */
+    u16 scd_flow = le16_to_cpu(ba_resp->scd_flow);
+
+    /* "ssn" is start of block-ack Tx window, corresponds to index
+     * (in Tx queue's circular buffer) of first TFD/frame in window */
+    u16 ba_resp_scd_ssn = le16_to_cpu(ba_resp->scd_ssn);
+
+    if (scd_flow >= priv->cfg->base_params->num_of_queues) {
+        IWL_ERR(priv, "BUG_ON scd_flow is bigger than number of queues\n");
+        return;
+    }
+
+    sta_id = ba_resp->sta_id;
+    tid = ba_resp->tid;
+    /* CUSTOM: don't index tid_data with what the firmware made up */
+    if (sta_id >= IWLAGN_STATION_COUNT || tid >= IWL_MAX_TID_COUNT) {
+        IWL_ERR(priv, "BA for invalid STA/TID %d/%d\n", sta_id, tid);
+        return;
+    }
+    agg = &priv->tid_data[sta_id][tid].agg;
+
+    //IOSimpleLockLock(priv->sta_lock);
+
+    if (unlikely(!agg->wait_for_ba)) {
+        if (unlikely(ba_resp->bitmap))
+            IWL_ERR(priv, "Received BA when not expected\n");
+        //IOSimpleLockUnlock(priv->sta_lock);
+        return;
+    }
+
+    if (unlikely(scd_flow != agg->txq_id)) {
+        /*
+         * FIXME: this is a uCode bug which need to be addressed,
+         * log the information and return for now.
+         * Since it is can possibly happen very often and in order
+         * not to fill the syslog, don't use IWL_ERR or IWL_WARN
+         */
+        IWL_DEBUG_TX_QUEUES(priv, "Bad queue mapping txq_id=%d, agg_txq[sta:%d,tid:%d]=%d\n",
+                            scd_flow, sta_id, tid, agg->txq_id);
+        //IOSimpleLockUnlock(priv->sta_lock);
+        return;
+    }
+
+    /* Release all TFDs before the SSN, i.e. all TFDs in front of
+     * block-ack window (we assume that they've been successfully
+     * transmitted ... if not, it's too late anyway). */
+    iwl_trans_reclaim(priv->trans, scd_flow, ba_resp_scd_ssn);
+
+    IWL_DEBUG_TX_REPLY(priv, "REPLY_COMPRESSED_BA [%d] Received from %pM, sta_id = %d\n",
+                       agg->wait_for_ba, (u8 *) &ba_resp->sta_addr_lo32, ba_resp->sta_id);
+    IWL_DEBUG_TX_REPLY(priv, "TID = %d, SeqCtl = %d, bitmap = 0x%llx, scd_flow = %d, scd_ssn = %d sent:%d, acked:%d\n",
+                       ba_resp->tid, le16_to_cpu(ba_resp->seq_ctl),
+                       (unsigned long long)le64_to_cpu(ba_resp->bitmap),
+                       scd_flow, ba_resp_scd_ssn, ba_resp->txed, ba_resp->txed_2_done);
+
+    /* Mark that the expected block-ack response arrived */
+    agg->wait_for_ba = false;
+
+    /* Sanity check values reported by uCode */
+    if (ba_resp->txed_2_done > ba_resp->txed) {
+        IWL_DEBUG_TX_REPLY(priv, "bogus sent(%d) and ack(%d) count\n",
+                           ba_resp->txed, ba_resp->txed_2_done);
+        /*
+         * set txed_2_done = txed,
+         * so it won't impact rate scale
+         */
+        ba_resp->txed = ba_resp->txed_2_done;
+    }
+
+    priv->tid_data[sta_id][tid].next_reclaimed = ba_resp_scd_ssn;
+
+    iwlagn_check_ratid_empty(priv, sta_id, tid);
+
+    //IOSimpleLockUnlock(priv->sta_lock);
+}
+
+/* CUSTOM */
+/*
+ * Release every aggregation queue still held by a station. mac80211 would
+ * normally stop the BA sessions before removing the station; nothing does
+ * that for us here, so the queues would otherwise stay allocated in
+ * agg_q_alloc forever.
+ */
+void iwlagn_tx_agg_release(struct iwl_priv *priv, int sta_id)
+{
+    struct iwl_tid_data *tid_data;
+    int tid;
+
+    for (tid = 0; tid < IWL_MAX_TID_COUNT; tid++) {
+        tid_data = &priv->tid_data[sta_id][tid];
+
+        if (tid_data->agg.state == IWL_AGG_OFF)
+            continue;
+
+        IWL_DEBUG_TX_QUEUES(priv, "Releasing AGG queue %d for STA/TID %d/%d (%d)\n",
+                            tid_data->agg.txq_id, sta_id, tid, tid_data->agg.state);
+
+        if (test_bit(tid_data->agg.txq_id, priv->agg_q_alloc)) {
+            if (tid_data->agg.state == IWL_AGG_ON ||
+                tid_data->agg.state == IWL_EMPTYING_HW_QUEUE_DELBA)
+                iwl_trans_txq_disable(priv->trans, tid_data->agg.txq_id, true);
+            iwlagn_dealloc_agg_txq(priv, tid_data->agg.txq_id);
+        }
+
+        if (tid_data->agg.state == IWL_AGG_ON && priv->agg_tids_count > 0)
+            priv->agg_tids_count--;
+
+        tid_data->agg.state = IWL_AGG_OFF;
+    }
+}
+/* CUSTOM END */
@@ -246,6 +246,9 @@ int IwlDvmOpMode::iwl_alive_notify(struct iwl_priv *priv)
     
     priv->passive_no_rx = false;
     priv->transport_queue_stop = 0;
+    /* CUSTOM: the transport forgot about stopped queues, so do we */
+    memset(priv->queue_stop_count, 0, sizeof(priv->queue_stop_count));
+    iwlagn_wake_output_queue(priv);
     
     ret = iwl_send_wimax_coex(priv);
     if (ret)
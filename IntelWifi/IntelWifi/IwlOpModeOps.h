@@ -40,6 +40,24 @@ public:
     virtual void nic_config(struct iwl_priv *priv) = 0;
     virtual void stop(struct iwl_priv *priv) = 0;
     virtual void rx(struct iwl_priv *priv, struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb) = 0;
+#ifdef CONFIG_IWLMVM
+    /*
+     * Data queue RX notification, only RSS queues of MSI-X devices other
+     * than the default one end up here.
+     */
+    virtual void rx_rss(struct iwl_priv *priv, struct napi_struct *napi, struct iwl_rx_cmd_buffer *rxb,
+                        unsigned int queue) = 0;
+#endif
+    virtual void nic_error(struct iwl_priv *priv) = 0;
+    /*
+     * Send an 802.3 frame of the network stack. Returns -EBUSY if the frame
+     * should be retried later, it is left untouched then. On any other error
+     * the frame is the caller's to free, *m is NULL if it is already gone.
+     */
+    virtual int tx(struct iwl_priv *priv, mbuf_t *m, bool xmit_more) = 0;
+    /* called by the transport with the lock of @queue held */
+    virtual void queue_full(struct iwl_priv *priv, int queue) = 0;
+    virtual void queue_not_full(struct iwl_priv *priv, int queue) = 0;
     
     
     // IOCTLs
@@ -57,12 +75,8 @@ public:
 //    virtual void add_interface(struct ieee80211_vif *vif) = 0;
 //    virtual void channel_switch(struct iwl_priv *priv, struct ieee80211_vif *vif, struct ieee80211_channel_switch *chsw) = 0;
 
-//    void (*rx_rss)(struct iwl_op_mode *op_mode, struct napi_struct *napi,
-//                   struct iwl_rx_cmd_buffer *rxb, unsigned int queue);
 //    void (*async_cb)(struct iwl_op_mode *op_mode,
 //                     const struct iwl_device_cmd *cmd);
-//    void (*queue_full)(struct iwl_op_mode *op_mode, int queue);
-//    void (*queue_not_full)(struct iwl_op_mode *op_mode, int queue);
 //    bool (*hw_rf_kill)(struct iwl_op_mode *op_mode, bool state);
 //    void (*free_skb)(struct iwl_op_mode *op_mode, struct sk_buff *skb);
 //    void (*nic_error)(struct iwl_op_mode *op_mode);
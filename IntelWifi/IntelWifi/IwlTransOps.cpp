@@ -30,4 +30,6 @@ void IwlTransOps::op_mode_leave(struct iwl_trans *trans) {
 void IwlTransOps::stop_device(struct iwl_trans *trans, bool low_power) {
     iw->iwl_trans_pcie_stop_device(trans, low_power);
     trans->state = IWL_TRANS_NO_FW;
+    /* CUSTOM: the error that stopped the firmware has been handled, let the next one through */
+    clear_bit(STATUS_FW_ERROR, &trans->status);
 }
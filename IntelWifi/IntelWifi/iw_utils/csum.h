@@ -0,0 +1,62 @@
+//
+//  csum.h
+//  IntelWifi
+//
+//  Helper functions that were not present in original sources: the one's
+//  complement sum (RFC 1071) of the software TX checksum.
+//
+
+#ifndef csum_h
+#define csum_h
+
+/* fold a 64 bit one's complement sum into 16 bits */
+static inline u16 iwl_csum_fold(u64 sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (u16)sum;
+}
+
+/*
+ * One's complement sum of a buffer in memory order. The sum is independent
+ * of the byte order (RFC 1071), so 32 bit words are added up in a 64 bit
+ * accumulator, four independent ones per iteration so the compiler can
+ * keep them in vector registers, and the carries are folded at the end.
+ */
+static inline u16 iwl_csum_block(const u8 *p, u32 len)
+{
+    u64 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    u32 w[4];
+    u16 h;
+    
+    for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+        memcpy(w, p, sizeof(w));
+        s0 += w[0];
+        s1 += w[1];
+        s2 += w[2];
+        s3 += w[3];
+    }
+    for (; len >= sizeof(w[0]); p += sizeof(w[0]), len -= sizeof(w[0])) {
+        memcpy(w, p, sizeof(w[0]));
+        s0 += w[0];
+    }
+    if (len >= sizeof(h)) {
+        memcpy(&h, p, sizeof(h));
+        s1 += h;
+        p += sizeof(h);
+        len -= sizeof(h);
+    }
+    if (len) {
+        /* the last odd byte is the first byte of a zero padded word */
+        h = 0;
+        memcpy(&h, p, 1);
+        s2 += h;
+    }
+    
+    return iwl_csum_fold(s0 + s1 + s2 + s3);
+}
+
+#endif /* csum_h */
@@ -0,0 +1,55 @@
+//
+//  msix_sched.h
+//  IntelWifi
+//
+//  Helper functions that were not present in original sources: which RX
+//  queues an MSI-X vector serves, and the budgeted passes over them. A queue
+//  that uses its whole budget keeps its vector masked and the event source
+//  of the vector is signalled again, so no handler spins on a busy queue.
+//
+//  BIT(), the MSIX_FH_INT_CAUSES_* causes of iwl-csr.h and
+//  enum iwl_shared_irq_flags have to be defined before this file is included.
+//
+
+#ifndef msix_sched_h
+#define msix_sched_h
+
+/* RX queue of a dedicated vector, inverse of iwl_pcie_map_rx_causes() */
+static inline int iwl_msix_entry_to_queue(u32 shared_vec_mask, int entry)
+{
+    return entry + (shared_vec_mask & IWL_SHARED_IRQ_FIRST_RSS ? 1 : 0);
+}
+
+/* RX queues (a bit per queue) whose causes in @inta_fh came on the default vector */
+static inline u32 iwl_msix_shared_rx_queues(u32 shared_vec_mask, u32 inta_fh)
+{
+    u32 queues = 0;
+    
+    if ((shared_vec_mask & IWL_SHARED_IRQ_NON_RX) && inta_fh & MSIX_FH_INT_CAUSES_Q0)
+        queues |= BIT(0);
+    if ((shared_vec_mask & IWL_SHARED_IRQ_FIRST_RSS) && inta_fh & MSIX_FH_INT_CAUSES_Q1)
+        queues |= BIT(1);
+    return queues;
+}
+
+/*
+ * One pass over the RX queues in @pending, at most @budget RBs each.
+ * Returns the queues that used their whole budget and need another pass.
+ */
+static inline u32 iwl_msix_service_rx(u32 pending, int budget,
+                                      int (*rx_handle)(void *ctx, int queue, int budget),
+                                      void *ctx)
+{
+    u32 left = 0;
+    int queue;
+    
+    for (queue = 0; pending >> queue; queue++) {
+        if (!(pending & BIT(queue)))
+            continue;
+        if (rx_handle(ctx, queue, budget) >= budget)
+            left |= BIT(queue);
+    }
+    return left;
+}
+
+#endif /* msix_sched_h */
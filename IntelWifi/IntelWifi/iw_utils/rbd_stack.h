@@ -0,0 +1,197 @@
+//
+//  rbd_stack.h
+//  IntelWifi
+//
+//  Helper functions that were not present in original sources: the lists of
+//  the RX allocator as compare-and-swap stacks, and the request batching that
+//  runs on top of them.
+//
+//  struct iwl_rx_mem_buffer (with its next link), struct iwl_rb_allocator and
+//  RX_CLAIM_REQ_ALLOC have to be defined before this file is included.
+//
+
+#ifndef rbd_stack_h
+#define rbd_stack_h
+
+#include <libkern/OSAtomic.h>
+#include <IOKit/IOLocks.h>
+
+/* atomic_xchg(v, 0) */
+static inline int iwl_atomic_xchg_zero(volatile int *v)
+{
+    int old;
+    
+    do {
+        old = *v;
+    } while (!OSCompareAndSwap(old, 0, (volatile UInt32 *)v));
+    return old;
+}
+
+/* atomic_dec_if_positive() */
+static inline int iwl_atomic_dec_if_positive(volatile int *v)
+{
+    int old;
+    
+    do {
+        old = *v;
+        if (old <= 0)
+            return old - 1;
+    } while (!OSCompareAndSwap(old, old - 1, (volatile UInt32 *)v));
+    return old - 1;
+}
+
+/*
+ * The allocator lists are shared by the RX queues and the allocator work loop.
+ * Instead of a spinlock they are LIFO stacks linked through rxb->next and
+ * updated with compare-and-swap only. Any side may push a chain and the
+ * allocator takes rbd_empty whole. Popping is only ABA safe with a single
+ * consumer, so the RX queues pop rbd_allocated under rba->lock, see
+ * iwl_rbd_claim().
+ */
+static inline void iwl_rbd_push_chain(struct iwl_rx_mem_buffer * volatile *head,
+                                      struct iwl_rx_mem_buffer *first,
+                                      struct iwl_rx_mem_buffer *last)
+{
+    struct iwl_rx_mem_buffer *old;
+    
+    do {
+        old = *head;
+        last->next = old;
+    } while (!OSCompareAndSwapPtr(old, first, (void * volatile *)head));
+}
+
+static inline struct iwl_rx_mem_buffer *iwl_rbd_take_all(struct iwl_rx_mem_buffer * volatile *head)
+{
+    struct iwl_rx_mem_buffer *old;
+    
+    do {
+        old = *head;
+    } while (old && !OSCompareAndSwapPtr(old, NULL, (void * volatile *)head));
+    return old;
+}
+
+static inline struct iwl_rx_mem_buffer *iwl_rbd_pop(struct iwl_rx_mem_buffer * volatile *head)
+{
+    struct iwl_rx_mem_buffer *old;
+    
+    do {
+        old = *head;
+    } while (old && !OSCompareAndSwapPtr(old, old->next, (void * volatile *)head));
+    return old;
+}
+
+static inline struct iwl_rx_mem_buffer *iwl_rbd_chain_tail(struct iwl_rx_mem_buffer *first)
+{
+    while (first->next)
+        first = first->next;
+    return first;
+}
+
+/*
+ * Honors the pending allocation requests, RX_CLAIM_REQ_ALLOC RBDs each,
+ * taken from rbd_empty and prepared by fill(). A failed fill() is retried.
+ * req_ready is only bumped once a whole batch is on rbd_allocated. If
+ * rbd_empty runs dry in the middle of a batch, the RBDs prepared so far stay
+ * in rbd_partial and the unfinished requests go back to req_pending, the next
+ * run (kicked by the next request) completes them.
+ * Must not run concurrently with itself. Returns the number of requests that
+ * were put back.
+ */
+static inline int iwl_rbd_alloc_run(struct iwl_rb_allocator *rba,
+                                    bool (*fill)(void *ctx, struct iwl_rx_mem_buffer *rxb),
+                                    void *ctx)
+{
+    struct iwl_rx_mem_buffer *local_empty, *alloc_first, *alloc_last;
+    int pending = iwl_atomic_xchg_zero(&rba->req_pending);
+    int count = rba->partial_count;
+    
+    /* swap out the rba->rbd_empty to a local list */
+    local_empty = iwl_rbd_take_all(&rba->rbd_empty);
+    
+    /* resume the batch a previous run could not complete */
+    alloc_first = rba->rbd_partial;
+    alloc_last = alloc_first ? iwl_rbd_chain_tail(alloc_first) : NULL;
+    rba->rbd_partial = NULL;
+    rba->partial_count = 0;
+    
+    while (pending) {
+        while (count < RX_CLAIM_REQ_ALLOC) {
+            struct iwl_rx_mem_buffer *rxb = local_empty;
+            
+            /* RBDs returned by the queues since the run started */
+            if (!rxb) {
+                local_empty = iwl_rbd_take_all(&rba->rbd_empty);
+                if (!local_empty)
+                    break;
+                continue;
+            }
+            
+            if (!fill(ctx, rxb))
+                continue;
+            
+            /* move the allocated entry to the out list */
+            local_empty = rxb->next;
+            rxb->next = alloc_first;
+            alloc_first = rxb;
+            if (!alloc_last)
+                alloc_last = rxb;
+            count++;
+        }
+        
+        if (count < RX_CLAIM_REQ_ALLOC) {
+            rba->rbd_partial = alloc_first;
+            rba->partial_count = count;
+            OSAddAtomic(pending, &rba->req_pending);
+            return pending;
+        }
+        
+        /* the chain is published before the request is, see iwl_rbd_claim */
+        iwl_rbd_push_chain(&rba->rbd_allocated, alloc_first, alloc_last);
+        OSIncrementAtomic(&rba->req_ready);
+        alloc_first = alloc_last = NULL;
+        count = 0;
+        
+        pending--;
+        if (!pending)
+            // initial code: pending = atomic_xchg(&rba->req_pending, 0);
+            pending = iwl_atomic_xchg_zero(&rba->req_pending);
+    }
+    
+    /* return unused rbds to the allocator empty list */
+    if (local_empty)
+        iwl_rbd_push_chain(&rba->rbd_empty, local_empty, iwl_rbd_chain_tail(local_empty));
+    return 0;
+}
+
+/*
+ * Takes one honored request off rbd_allocated into rxbs, which has room for
+ * RX_CLAIM_REQ_ALLOC entries. Returns the number of RBDs taken, 0 if no
+ * request is ready.
+ */
+static inline int iwl_rbd_claim(struct iwl_rb_allocator *rba, struct iwl_rx_mem_buffer **rxbs)
+{
+    int i;
+    
+    /*
+     * atomic_dec_if_positive returns req_ready - 1 for any scenario.
+     * If req_ready is 0 atomic_dec_if_positive will return -1 and this
+     * function will return early, as there are no ready requests.
+     * atomic_dec_if_positive will perofrm the *actual* decrement only if
+     * req_ready > 0, i.e. - there are ready requests and the function
+     * hands one request to the caller.
+     */
+    if (iwl_atomic_dec_if_positive(&rba->req_ready) < 0)
+        return 0;
+    
+    /* the RX queues claim concurrently, one popper at a time */
+    IOSimpleLockLock(rba->lock);
+    for (i = 0; i < RX_CLAIM_REQ_ALLOC; i++) {
+        rxbs[i] = iwl_rbd_pop(&rba->rbd_allocated);
+        if (!rxbs[i])
+            break;
+    }
+    IOSimpleLockUnlock(rba->lock);
+    return i;
+}
+
+#endif /* rbd_stack_h */
@@ -0,0 +1,59 @@
+//
+//  tx_range.h
+//  IntelWifi
+//
+//  Helper functions that were not present in original sources: the reset of
+//  the scheduler byte counts and the TFDs of reclaimed TX queue entries, done
+//  in plain passes over contiguous entries instead of one entry at a time.
+//
+//  min_t(), TFD_QUEUE_SIZE_MAX and TFD_QUEUE_SIZE_BC_DUP of iwl-fh.h, struct
+//  iwl_tfd and struct iwl_tfh_tfd have to be defined before this file is
+//  included.
+//
+
+#ifndef tx_range_h
+#define tx_range_h
+
+static inline void iwl_pcie_bc_inval(__le16 *bc, int n)
+{
+    int i;
+    
+    /* keep the station id, the length becomes 1 */
+    for (i = 0; i < n; i++)
+        bc[i] = (bc[i] & cpu_to_le16(0xf000)) | cpu_to_le16(1);
+}
+
+/*
+ * iwl_pcie_bc_inval_range - invalidate @count byte counts of the table @bc
+ * starting at @first, the duplicated head of the table included
+ */
+static inline void iwl_pcie_bc_inval_range(__le16 *bc, int first, int count)
+{
+    while (count > 0) {
+        int n = min_t(int, count, TFD_QUEUE_SIZE_MAX - first);
+        
+        iwl_pcie_bc_inval(bc + first, n);
+        if (first < TFD_QUEUE_SIZE_BC_DUP)
+            iwl_pcie_bc_inval(bc + TFD_QUEUE_SIZE_MAX + first, min_t(int, n, TFD_QUEUE_SIZE_BC_DUP - first));
+        
+        count -= n;
+        first = 0;
+    }
+}
+
+/* clear num_tbs of @n TFDs in a row, the format is checked once */
+static inline void iwl_pcie_tfd_clear(void *tfd, u16 tfd_size, bool use_tfh, int n)
+{
+    u8 *p = (u8 *)tfd;
+    int i;
+    
+    if (use_tfh) {
+        for (i = 0; i < n; i++, p += tfd_size)
+            ((struct iwl_tfh_tfd *)p)->num_tbs = 0;
+    } else {
+        for (i = 0; i < n; i++, p += tfd_size)
+            ((struct iwl_tfd *)p)->num_tbs = 0;
+    }
+}
+
+#endif /* tx_range_h */
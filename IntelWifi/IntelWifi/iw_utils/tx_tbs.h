@@ -0,0 +1,44 @@
+//
+//  tx_tbs.h
+//  IntelWifi
+//
+//  Helper functions that were not present in original sources: planning the
+//  TBs of the payload of an mbuf chain, which is mapped in place from the
+//  physical segments of the TX memory cursor.
+//
+//  DIV_ROUND_UP() and IWL_TX_SEG_MAX_SIZE of iwlwifi/pcie/internal.h have to
+//  be defined before this file is included.
+//
+
+#ifndef tx_tbs_h
+#define tx_tbs_h
+
+/*
+ * Worst case number of TBs for @len bytes of one mbuf: every piece between
+ * two page boundaries is split at IWL_TX_SEG_MAX_SIZE, which divides the
+ * page size, so only the first and the last piece can take an extra TB.
+ */
+static inline u32 iwl_tx_max_tbs(u32 len)
+{
+    return DIV_ROUND_UP(len, IWL_TX_SEG_MAX_SIZE) + 1;
+}
+
+/*
+ * iwl_tx_skip_seg - skip what is left of the first @skip bytes of the
+ * payload in the segment at @addr, @len
+ *
+ * Returns false if the whole segment is skipped.
+ */
+static inline bool iwl_tx_skip_seg(u32 *skip, u64 *addr, u32 *len)
+{
+    if (*skip >= *len) {
+        *skip -= *len;
+        return false;
+    }
+    *addr += *skip;
+    *len -= *skip;
+    *skip = 0;
+    return true;
+}
+
+#endif /* tx_tbs_h */
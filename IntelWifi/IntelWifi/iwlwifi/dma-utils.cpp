@@ -10,11 +10,12 @@
 
 #include "../iw_utils/allocation.h"
 
-struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mask) {
-    IOOptionBits options = kIODirectionInOut | kIOMemoryPhysicallyContiguous | kIOMapInhibitCache;
-    
+static struct iwl_dma_ptr* allocate_dma_buf_with_options(size_t size, mach_vm_address_t physical_mask,
+                                                         IOOptionBits options) {
     IOBufferMemoryDescriptor *bmd;
     bmd = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, options, size, physical_mask);
+    if (!bmd)
+        return NULL;
     
     IODMACommand *cmd = IODMACommand::withSpecification(kIODMACommandOutputHost64, 64, 0, IODMACommand::kMapped, 0, 1);
     cmd->setMemoryDescriptor(bmd);
@@ -45,6 +46,23 @@ struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mas
     return result;
 }
 
+struct iwl_dma_ptr* allocate_dma_buf(size_t size, mach_vm_address_t physical_mask) {
+    IOOptionBits options = kIODirectionInOut | kIOMemoryPhysicallyContiguous | kIOMapInhibitCache;
+    
+    return allocate_dma_buf_with_options(size, physical_mask, options);
+}
+
+/*
+ * CUSTOM: RX buffers are physically contiguous like the other DMA buffers,
+ * the device writes a whole RB into a single address. They stay cached,
+ * the frames are copied out of them by the CPU and PCIe DMA is coherent.
+ */
+struct iwl_dma_ptr* allocate_rx_dma_buf(size_t size, mach_vm_address_t physical_mask) {
+    IOOptionBits options = kIODirectionIn | kIOMemoryPhysicallyContiguous;
+    
+    return allocate_dma_buf_with_options(size, physical_mask, options);
+}
+
 void free_dma_buf(struct iwl_dma_ptr *dma_ptr) {
     IODMACommand *cmd = static_cast<IODMACommand *>(dma_ptr->cmd);
     cmd->complete();
@@ -136,6 +136,8 @@ int iwlagn_mac_setup_register(struct iwl_priv *priv, const struct iwl_ucode_capa
 ///* commands */
 int iwl_dvm_send_cmd(struct iwl_priv *priv, struct iwl_host_cmd *cmd);
 int iwl_dvm_send_cmd_pdu(struct iwl_priv *priv, u8 id, u32 flags, u16 len, const void *data);
+void iwl_dvm_cmd_batch_begin(struct iwl_priv *priv, struct iwl_dvm_cmd_batch *batch);
+int iwl_dvm_cmd_batch_end(struct iwl_priv *priv, struct iwl_dvm_cmd_batch *batch);
 //
 ///* RXON */
 void iwl_connection_init_rx_config(struct iwl_priv *priv, struct iwl_rxon_context *ctx);
@@ -172,7 +174,7 @@ void iwl_calib_free_results(struct iwl_priv *priv);
 ///* lib */
 int iwlagn_send_tx_power(struct iwl_priv *priv);
 void iwlagn_temperature(struct iwl_priv *priv);
-//int iwlagn_txfifo_flush(struct iwl_priv *priv, u32 scd_q_msk);
+int iwlagn_txfifo_flush(struct iwl_priv *priv, u32 scd_q_msk);
 //void iwlagn_dev_txfifo_flush(struct iwl_priv *priv);
 //int iwlagn_send_beacon_cmd(struct iwl_priv *priv);
 int iwl_send_statistics_request(struct iwl_priv *priv, u8 flags, bool clear);
@@ -192,6 +194,10 @@ static inline const struct ieee80211_supported_band *iwl_get_hw_mode(
 /* rx */
 int iwlagn_hwrate_to_mac80211_idx(u32 rate_n_flags, enum nl80211_band band);
 void iwl_setup_rx_handlers(struct iwl_priv *priv);
+int iwl_rx_reorder_init(struct iwl_priv *priv);
+void iwl_rx_reorder_exit(struct iwl_priv *priv);
+void iwl_rx_reorder_release_sta(struct iwl_priv *priv, int sta_id);
+void iwl_rx_reorder_release_all(struct iwl_priv *priv);
 void iwl_chswitch_done(struct iwl_priv *priv, bool is_success);
 
 
@@ -199,17 +205,27 @@ void iwl_chswitch_done(struct iwl_priv *priv, bool is_success);
 //int iwlagn_tx_skb(struct iwl_priv *priv,
 //          struct ieee80211_sta *sta,
 //          struct sk_buff *skb);
-//int iwlagn_tx_agg_start(struct iwl_priv *priv, struct ieee80211_vif *vif,
-//            struct ieee80211_sta *sta, u16 tid, u16 *ssn);
-//int iwlagn_tx_agg_oper(struct iwl_priv *priv, struct ieee80211_vif *vif,
-//            struct ieee80211_sta *sta, u16 tid, u8 buf_size);
-//int iwlagn_tx_agg_stop(struct iwl_priv *priv, struct ieee80211_vif *vif,
-//               struct ieee80211_sta *sta, u16 tid);
-//int iwlagn_tx_agg_flush(struct iwl_priv *priv, struct ieee80211_vif *vif,
-//            struct ieee80211_sta *sta, u16 tid);
-//void iwlagn_rx_reply_compressed_ba(struct iwl_priv *priv,
-//                   struct iwl_rx_cmd_buffer *rxb);
+int iwlagn_tx_skb(struct iwl_priv *priv, mbuf_t *m, bool xmit_more);
+void iwlagn_tx_push(struct iwl_priv *priv);
+void iwlagn_wake_output_queue(struct iwl_priv *priv);
+int iwlagn_tx_agg_start(struct iwl_priv *priv, struct ieee80211_vif *vif,
+            struct ieee80211_sta *sta, u16 tid, u16 *ssn);
+int iwlagn_tx_agg_oper(struct iwl_priv *priv, struct ieee80211_vif *vif,
+            struct ieee80211_sta *sta, u16 tid, u8 buf_size);
+int iwlagn_tx_agg_stop(struct iwl_priv *priv, struct ieee80211_vif *vif,
+               struct ieee80211_sta *sta, u16 tid);
+int iwlagn_tx_agg_flush(struct iwl_priv *priv, struct ieee80211_vif *vif,
+            struct ieee80211_sta *sta, u16 tid);
+void iwlagn_check_ratid_empty(struct iwl_priv *priv, int sta_id, u8 tid);
+void iwlagn_tx_agg_release(struct iwl_priv *priv, int sta_id);
+int iwlagn_tx_agg_init(struct iwl_priv *priv);
+void iwlagn_tx_agg_exit(struct iwl_priv *priv);
+void iwlagn_tx_agg_addba_resp(struct iwl_priv *priv, int sta_id, struct ieee80211_mgmt *mgmt, u16 len);
+void iwlagn_tx_agg_delba(struct iwl_priv *priv, int sta_id, int tid);
+void iwlagn_rx_reply_compressed_ba(struct iwl_priv *priv,
+                   struct iwl_rx_cmd_buffer *rxb);
 //void iwlagn_rx_reply_tx(struct iwl_priv *priv, struct iwl_rx_cmd_buffer *rxb);
+void iwlagn_rx_reply_tx(struct iwl_priv *priv, struct iwl_rx_cmd_buffer *rxb);
 //
 //static inline u32 iwl_tx_status_to_mac80211(u32 status)
 //{
@@ -339,7 +355,7 @@ int iwl_remove_dynamic_key(struct iwl_priv *priv, struct iwl_rxon_context *ctx,
                            struct ieee80211_sta *sta);
 void iwl_update_tkip_key(struct iwl_priv *priv, struct ieee80211_vif *vif, struct ieee80211_key_conf *keyconf,
                          struct ieee80211_sta *sta, u32 iv32, u16 *phase1key);
-//int iwl_sta_tx_modify_enable_tid(struct iwl_priv *priv, int sta_id, int tid);
+int iwl_sta_tx_modify_enable_tid(struct iwl_priv *priv, int sta_id, int tid);
 //int iwl_sta_rx_agg_start(struct iwl_priv *priv, struct ieee80211_sta *sta,
 //             int tid, u16 ssn);
 //int iwl_sta_rx_agg_stop(struct iwl_priv *priv, struct ieee80211_sta *sta,
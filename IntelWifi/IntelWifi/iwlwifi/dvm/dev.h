@@ -49,6 +49,8 @@
 #include "../fw/notif-wait.h"
 #include "iwl-trans.h"
 
+#include <kern/thread.h>
+
 //#include "led.h"
 #include "power.h"
 #include "rs.h"
@@ -181,12 +183,52 @@ struct iwl_ht_agg {
  * @next_reclaimed: the WiFi sequence number of the next packet to be acked.
  *	This is basically (last acked packet++).
  * @agg: aggregation state machine
+ * @addba_time: CUSTOM, jiffies at which the ADDBA request went out, or at
+ *	which the last session attempt failed
+ * @addba_token: CUSTOM, dialog token of the last ADDBA request
+ * @addba_failures: CUSTOM, session attempts that failed in a row
+ * @addba_delba: CUSTOM, tell the peer with a DELBA once the session is off
+ * @addba_amsdu: CUSTOM, the peer takes A-MSDUs in the A-MPDUs of the session
  */
 struct iwl_tid_data {
 	u16 seq_number;
 	u16 next_reclaimed;
 	struct iwl_ht_agg agg;
+	/* CUSTOM: mac80211 runs the ADDBA handshake in Linux */
+	unsigned long addba_time;
+	u8 addba_token;
+	u8 addba_failures;
+	bool addba_delba;
+	bool addba_amsdu;
+	/* CUSTOM END */
+};
+
+/*
+ * CUSTOM
+ * struct iwl_rx_reorder_buf - reorder buffer of an RX block ack session
+ *
+ * mac80211 reorders the frames of an RX BA session before they reach the
+ * stack; there is no mac80211 here, so the driver keeps them until the
+ * frames before them have arrived or timed out.
+ *
+ * @frames: held frames, slot of a frame is (sn & slot_mask)
+ * @reorder_time: jiffies at which each slot was filled
+ * @head_sn: first sequence number not released yet
+ * @buf_size: reorder window, in frames
+ * @slot_mask: number of slots - 1, a power of two covering @buf_size
+ * @num_stored: frames currently held
+ * @valid: a BA session is active on this TID
+ */
+struct iwl_rx_reorder_buf {
+	mbuf_t *frames;
+	unsigned long *reorder_time;
+	u16 head_sn;
+	u16 buf_size;
+	u16 slot_mask;
+	u16 num_stored;
+	bool valid;
 };
+/* CUSTOM END */
 
 /*
  * Structure should be accessed with sta_lock held. When station addition
@@ -198,6 +240,8 @@ struct iwl_station_entry {
 	struct iwl_addsta_cmd sta;
 	u8 used, ctxid;
 	struct iwl_link_quality_cmd *lq;
+	/* CUSTOM: station the entry was added for, NULL for local stations */
+	struct ieee80211_sta *ieee_sta;
     
     // MARK: rpeshkov added
     char ssid[IEEE80211_MAX_SSID_LEN + 1];
@@ -645,6 +689,31 @@ enum {
 	IWL_CALIB_DISABLE_ALL			= 0xFFFFFFFF,
 };
 
+/* CUSTOM */
+#define IWL_DVM_CMD_BATCH_MAX	16
+
+/**
+ * struct iwl_dvm_cmd_batch - synchronous host commands sent back to back
+ * @tokens: completion tokens of the commands still in flight
+ * @n_cmds: number of entries in @tokens
+ * @n_sent: commands sent through the batch so far
+ * @n_waits: times the batch waited for the device
+ * @ret: first error seen while sending or waiting
+ *
+ * While a batch is open, plain synchronous commands that don't want the
+ * response are pipelined instead of waiting for each round-trip. Their
+ * errors are only reported by iwl_dvm_cmd_batch_end(). A synchronous
+ * command from another thread is sent and waited for as usual.
+ */
+struct iwl_dvm_cmd_batch {
+	u32 tokens[IWL_DVM_CMD_BATCH_MAX];
+	int n_cmds;
+	u32 n_sent;
+	u32 n_waits;
+	int ret;
+};
+/* CUSTOM END */
+
 #define IWL_OP_MODE_GET_DVM(_iwl_op_mode) \
 	((struct iwl_priv *) ((_iwl_op_mode)->op_mode_specific))
 
@@ -671,6 +740,10 @@ struct iwl_priv {
 	int queue_stop_count[IWL_MAX_HW_QUEUES];
 
 	unsigned long agg_q_alloc[BITS_TO_LONGS(IWL_MAX_HW_QUEUES)];
+	/* CUSTOM */
+	/* queues with frames held back for the rest of a TX burst */
+	unsigned long tx_push_queues[BITS_TO_LONGS(IWL_MAX_HW_QUEUES)];
+	/* CUSTOM END */
 
 	/* ieee device used by generic ieee processing code */
 	struct ieee80211_hw *hw;
@@ -691,6 +764,14 @@ struct iwl_priv {
 
 	struct iwl_notif_wait_data notif_wait;
 
+	/*
+	 * open command batch, the thread that opened it and the round-trips
+	 * it saved, see iwl_dvm_cmd_batch_begin()
+	 */
+	struct iwl_dvm_cmd_batch *cmd_batch;
+	thread_t cmd_batch_owner;
+	u32 hcmd_rtt_saved;
+
 	/* spectrum measurement report caching */
 	struct iwl_spectrum_notification measure_report;
 	u8 measurement_status;
@@ -770,6 +851,14 @@ struct iwl_priv {
 	struct iwl_station_entry stations[IWLAGN_STATION_COUNT];
 	unsigned long ucode_key_table;
 	struct iwl_tid_data tid_data[IWLAGN_STATION_COUNT][IWL_MAX_TID_COUNT];
+	/* CUSTOM */
+	struct iwl_rx_reorder_buf reorder_buf[IWLAGN_STATION_COUNT][IWL_MAX_TID_COUNT];
+	u8 reorder_sta_id; /* last station looked up by TA */
+	void *reorder_timer; /* IOTimerEventSource, armed while frames are held */
+	bool reorder_timer_armed;
+	void *addba_timer; /* IOTimerEventSource, ADDBA response timeout */
+	bool addba_timer_armed;
+	/* CUSTOM END */
 	int num_aux_in_flight;
 
 	u8 mac80211_registered;
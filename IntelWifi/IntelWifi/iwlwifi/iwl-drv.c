@@ -1627,6 +1627,7 @@ struct iwl_mod_params iwlwifi_mod_params = {
 	.d0i3_timeout = 1000,
 	.uapsd_disable = IWL_DISABLE_UAPSD_BSS | IWL_DISABLE_UAPSD_P2P_CLIENT,
     .debug_level = 0xFFFFFFFF,
+    .rx_reorder_timeout = 100,
 	/* the rest are 0 by default */
 };
 IWL_EXPORT_SYMBOL(iwlwifi_mod_params);
@@ -1798,6 +1799,15 @@ module_param_named(d0i3_timeout, iwlwifi_mod_params.d0i3_timeout,
 		   uint, S_IRUGO);
 MODULE_PARM_DESC(d0i3_timeout, "Timeout to D0i3 entry when idle (ms)");
 
+module_param_named(rx_reorder_win, iwlwifi_mod_params.rx_reorder_win,
+		   uint, S_IRUGO);
+MODULE_PARM_DESC(rx_reorder_win,
+		 "max RX reorder window in frames (default: 0 - as requested by the peer)");
+
+module_param_named(rx_reorder_timeout, iwlwifi_mod_params.rx_reorder_timeout,
+		   uint, S_IRUGO);
+MODULE_PARM_DESC(rx_reorder_timeout, "RX reorder release timeout (ms, default: 100)");
+
 module_param_named(disable_11ac, iwlwifi_mod_params.disable_11ac, bool,
 		   S_IRUGO);
 MODULE_PARM_DESC(disable_11ac, "Disable VHT capabilities (default: false)");
@@ -122,6 +122,10 @@ enum iwl_uapsd_disable {
  * @lar_disable: disable LAR (regulatory), default = 0
  * @fw_monitor: allow to use firmware monitor
  * @disable_11ac: disable VHT capabilities, default = false.
+ * @rx_reorder_win: upper bound of the RX block ack reorder window in
+ *	frames, default = 0 (the buffer size of the ADDBA request)
+ * @rx_reorder_timeout: time a frame waits in the RX reorder buffer for
+ *	the frames before it (in msecs), default = 100
  */
 struct iwl_mod_params {
 	int swcrypto;
@@ -143,6 +147,8 @@ struct iwl_mod_params {
 	bool lar_disable;
 	bool fw_monitor;
 	bool disable_11ac;
+	unsigned int rx_reorder_win;
+	unsigned int rx_reorder_timeout;
 };
 
 #endif /* #__iwl_modparams_h__ */
@@ -170,6 +170,10 @@ int iwl_trans_send_cmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd)
 		    !(cmd->flags & CMD_ASYNC)))
 		return -EINVAL;
 
+	if (WARN_ON((cmd->flags & CMD_WANT_COMPLETION) &&
+		    !(cmd->flags & CMD_ASYNC)))
+		return -EINVAL;
+
 #ifdef CONFIG_LOCKDEP
 	if (!(cmd->flags & CMD_ASYNC))
 		lock_map_acquire_read(&trans->sync_cmd_lockdep_map);
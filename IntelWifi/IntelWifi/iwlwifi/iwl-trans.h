@@ -176,6 +176,10 @@ static inline u32 iwl_rx_packet_payload_len(const struct iwl_rx_packet *pkt)
  *	(i.e. mark it as non-idle).
  * @CMD_WANT_ASYNC_CALLBACK: the op_mode's async callback function must be
  *	called after this command completes. Valid only with CMD_ASYNC.
+ * @CMD_WANT_COMPLETION: track the completion of the command in the per-slot
+ *	completion of the command queue. The transport stores a token in
+ *	&struct iwl_host_cmd that can later be passed to iwl_trans_wait_cmds().
+ *	Valid only with CMD_ASYNC.
  */
 enum CMD_MODE {
 	CMD_ASYNC		= BIT(0),
@@ -186,6 +190,7 @@ enum CMD_MODE {
 	CMD_MAKE_TRANS_IDLE	= BIT(5),
 	CMD_WAKE_UP_TRANS	= BIT(6),
 	CMD_WANT_ASYNC_CALLBACK	= BIT(7),
+	CMD_WANT_COMPLETION	= BIT(8),
 };
 
 #define DEF_CMD_PAYLOAD_SIZE 320
@@ -240,39 +245,75 @@ enum iwl_hcmd_dataflag {
 	IWL_HCMD_DFL_DUP	= BIT(1),
 };
 
+/*
+ * Responses of %CMD_WANT_SKB commands are copied out of the RX buffer into
+ * a small pool of recycled buffers, so the RX page goes straight back to
+ * the ring. A response that doesn't fit gets a buffer of its own.
+ */
+#define IWL_RESP_POOL_SIZE	4
+#define IWL_RESP_BUF_SIZE	1024
+
+/**
+ * struct iwl_resp_buf - response buffer of the response pool
+ * @state: bit 0 is set while the buffer holds a response
+ * @data: the response packet
+ */
+struct iwl_resp_buf {
+	unsigned long state;
+	u8 data[IWL_RESP_BUF_SIZE];
+};
+
 /**
  * struct iwl_host_cmd - Host command to the uCode
  *
  * @data: array of chunks that composes the data of the host command
  * @resp_pkt: response packet, if %CMD_WANT_SKB was set
- * @_rx_page_order: (internally used to free response packet)
- * @_rx_page_addr: (internally used to free response packet)
+ * @resp_buf: optional caller buffer, e.g. on the stack, the response packet
+ *	is copied to if it fits, instead of a buffer from the response pool
+ * @resp_buf_len: size of @resp_buf
+ * @_resp_pool_buf: (internally used to free response packet)
+ * @_resp_alloc_len: (internally used to free response packet)
+ * @_resp_alloc_failed: (internally used to fail the command with -ENOMEM
+ *	when no buffer could be found for the response packet)
  * @flags: can be CMD_*
  * @len: array of the lengths of the chunks in data
  * @dataflags: IWL_HCMD_DFL_*
  * @id: command id of the host command, for wide commands encoding the
  *	version and group as well
+ * @token: completion token, set by the transport if %CMD_WANT_COMPLETION
+ *	was set
  */
 struct iwl_host_cmd {
 	const void *data[IWL_MAX_CMD_TBS_PER_TFD];
 	struct iwl_rx_packet *resp_pkt;
-    
-    unsigned long _rx_page_addr;
-    u32 _rx_page_order;
+	void *resp_buf;
+	u32 resp_buf_len;
+
+	struct iwl_resp_buf *_resp_pool_buf;
+	u32 _resp_alloc_len;
+	bool _resp_alloc_failed;
 
 	u32 flags;
 	u32 id;
 	u16 len[IWL_MAX_CMD_TBS_PER_TFD];
 	u8 dataflags[IWL_MAX_CMD_TBS_PER_TFD];
+	u32 token;
 };
 
 static inline void iwl_free_resp(struct iwl_host_cmd *cmd)
 {
 	//free_pages(cmd->_rx_page_addr, cmd->_rx_page_order);
+	if (cmd->_resp_pool_buf)
+		clear_bit(0, &cmd->_resp_pool_buf->state);
+	else if (cmd->_resp_alloc_len)
+		iwh_free(cmd->resp_pkt);
+
+	cmd->_resp_pool_buf = NULL;
+	cmd->_resp_alloc_len = 0;
 }
 
 struct iwl_rx_cmd_buffer {
-	mbuf_t _page;
+	void *_page; /* CUSTOM: address of the RB, it never leaves the transport */
 	int _offset;
 	bool _page_stolen;
 	u32 _rx_page_order;
@@ -281,7 +322,7 @@ struct iwl_rx_cmd_buffer {
 
 static inline void *rxb_addr(struct iwl_rx_cmd_buffer *r)
 {
-    return (void *)((u8*)mbuf_data(r->_page) + r->_offset);
+    return (void *)((u8*)r->_page + r->_offset);
 }
 
 static inline int rxb_offset(struct iwl_rx_cmd_buffer *r)
@@ -289,12 +330,6 @@ static inline int rxb_offset(struct iwl_rx_cmd_buffer *r)
 	return r->_offset;
 }
 
-static inline mbuf_t rxb_steal_page(struct iwl_rx_cmd_buffer *r)
-{
-	r->_page_stolen = true;
-    return r->_page;
-}
-
 static inline void iwl_free_rxb(struct iwl_rx_cmd_buffer *r)
 {
 	//__free_pages(r->_page, r->_rx_page_order);
@@ -387,6 +422,9 @@ struct iwl_hcmd_arr {
 #define HCMD_ARR(x)	\
 	{ .arr = x, .size = ARRAY_SIZE(x) }
 
+/* Upper bound of MSDUs in an A-MSDU built by the transport */
+#define IWL_TRANS_AMSDU_MAX_SUBFRAMES 8
+
 /**
  * struct iwl_trans_config - transport configuration
  *
@@ -406,6 +444,9 @@ struct iwl_hcmd_arr {
  *	in DWORD (as opposed to bytes)
  * @scd_set_active: should the transport configure the SCD for HCMD queue
  * @sw_csum_tx: transport should compute the TCP checksum
+ * @tx_amsdu_max_subframes: maximum number of MSDUs the transport may gather
+ *	into one A-MSDU, 0 disables A-MSDU building
+ * @tx_amsdu_max_bytes: maximum length of an A-MSDU built by the transport
  * @command_groups: array of command groups, each member is an array of the
  *	commands in the group; for debugging only
  * @command_groups_size: number of command groups, to avoid illegal access
@@ -427,6 +468,8 @@ struct iwl_trans_config {
 	bool bc_table_dword;
 	bool scd_set_active;
 	bool sw_csum_tx;
+	u8 tx_amsdu_max_subframes;
+	u16 tx_amsdu_max_bytes;
 	const struct iwl_hcmd_arr *command_groups;
 	int command_groups_size;
 
@@ -482,14 +525,33 @@ struct iwl_trans_txq_scd_cfg {
  *	If RFkill is asserted in the middle of a SYNC host command, it must
  *	return -ERFKILL straight away.
  *	May sleep only if CMD_ASYNC is not set
- * @tx: send an skb. The transport relies on the op_mode to zero the
- *	the ieee80211_tx_info->driver_data. If the MPDU is an A-MSDU, all
+ * @wait_cmds: wait for the completion of commands that were sent with
+ *	%CMD_WANT_COMPLETION, identified by their tokens. Commands whose slot
+ *	was already reused count as completed. Optional, may sleep.
+ * @tx: send an mbuf chain that starts with the 802.11 header. The chain is
+ *	mapped segment by segment, the transport owns it (and dev_cmd) until
+ *	the frame is reclaimed. When xmit_more is set the caller promises
+ *	another frame (or a call to txq_push) and the device write pointer
+ *	may be updated later, once for the whole burst. If the MPDU is an
+ *	A-MSDU, all
  *	the CSUM will be taken care of (TCP CSUM and IP header in case of
  *	IPv4). If the MPDU is a single MSDU, the op_mode must compute the IP
  *	header if it is IPv4.
  *	Must be atomic
- * @reclaim: free packet until ssn. Returns a list of freed packets.
- *	Must be atomic
+ * @tx_amsdu: queue an 802.3 frame for A-MSDU building. Consecutive frames
+ *	for the same DA/TID are gathered into one A-MSDU which is sent when
+ *	the limits are reached, another destination/TID shows up or the
+ *	caller stops announcing more frames. dev_cmd must hold the QoS data
+ *	header to be used for the A-MSDU. Only aggregation queues build
+ *	A-MSDUs. The frame and dev_cmd stay with the caller unless 0 is
+ *	returned, or 1 if the frame was appended to the A-MSDU of an earlier
+ *	one (dev_cmd is freed then, the A-MSDU takes no sequence number of its
+ *	own for it). Must be atomic
+ * @txq_push: publish the write pointer of a queue that has frames held back
+ *	by xmit_more. Must be atomic
+ * @reclaim: free packet until ssn. The transport owns the frames, they are
+ *	released in one batch and the queue is woken once enough room is
+ *	free again. Must be atomic
  * @txq_enable: setup a queue. To setup an AC queue, use the
  *	iwl_trans_ac_txq_enable wrapper. fw_alive must have been called before
  *	this one. The op_mode must not configure the HCMD queue. The scheduler
@@ -552,11 +614,16 @@ struct iwl_trans_ops {
 			 bool test, bool reset);
 
 	int (*send_cmd)(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+	int (*wait_cmds)(struct iwl_trans *trans, const u32 *tokens,
+			 int n_tokens);
 
-	int (*tx)(struct iwl_trans *trans, struct sk_buff *skb,
-		  struct iwl_device_cmd *dev_cmd, int queue);
-	void (*reclaim)(struct iwl_trans *trans, int queue, int ssn,
-			struct sk_buff_head *skbs);
+	int (*tx)(struct iwl_trans *trans, mbuf_t skb,
+		  struct iwl_device_cmd *dev_cmd, int queue, bool xmit_more);
+	int (*tx_amsdu)(struct iwl_trans *trans, mbuf_t skb,
+			struct iwl_device_cmd *dev_cmd, int queue, u8 tid,
+			bool xmit_more);
+	void (*txq_push)(struct iwl_trans *trans, int queue);
+	void (*reclaim)(struct iwl_trans *trans, int queue, int ssn);
 
 	bool (*txq_enable)(struct iwl_trans *trans, int queue, u16 ssn,
 			   const struct iwl_trans_txq_scd_cfg *cfg,
@@ -725,7 +792,7 @@ enum iwl_plat_pm_mode {
  *	supposed to change during runtime.
  */
 struct iwl_trans {
-    void *mbuf_cursor; // IOMbufNaturalMemoryCursor
+    void *tx_mbuf_cursor; // IOMbufNaturalMemoryCursor, multi-segment for TX
     
 	const struct iwl_trans_ops *ops;
 	struct iwl_op_mode *op_mode;
@@ -938,14 +1005,38 @@ iwl_trans_alloc_tx_cmd(struct iwl_trans *trans)
 
 int iwl_trans_send_cmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
 
+static inline int iwl_trans_wait_cmds(struct iwl_trans *trans,
+				      const u32 *tokens, int n_tokens)
+{
+	if (!trans->ops->wait_cmds)
+		return -EOPNOTSUPP;
+
+	return trans->ops->wait_cmds(trans, tokens, n_tokens);
+}
+
 static inline void iwl_trans_free_tx_cmd(struct iwl_trans *trans, struct iwl_device_cmd *dev_cmd)
 {
 	//kmem_cache_free(trans->dev_cmd_pool, dev_cmd);
     iwh_free(dev_cmd);
 }
 
-static inline int iwl_trans_tx(struct iwl_trans *trans, struct sk_buff *skb,
-			       struct iwl_device_cmd *dev_cmd, int queue)
+static inline int iwl_trans_tx(struct iwl_trans *trans, mbuf_t skb,
+			       struct iwl_device_cmd *dev_cmd, int queue, bool xmit_more)
+{
+	if (unlikely(test_bit(STATUS_FW_ERROR, &trans->status)))
+		return -EIO;
+
+	if (WARN_ON_ONCE(trans->state != IWL_TRANS_FW_ALIVE)) {
+		IWL_ERR(trans, "%s bad state = %d\n", __func__, trans->state);
+		return -EIO;
+	}
+
+	return trans->ops->tx(trans, skb, dev_cmd, queue, xmit_more);
+}
+
+static inline int iwl_trans_tx_amsdu(struct iwl_trans *trans, mbuf_t skb,
+				     struct iwl_device_cmd *dev_cmd, int queue,
+				     u8 tid, bool xmit_more)
 {
 	if (unlikely(test_bit(STATUS_FW_ERROR, &trans->status)))
 		return -EIO;
@@ -955,17 +1046,22 @@ static inline int iwl_trans_tx(struct iwl_trans *trans, struct sk_buff *skb,
 		return -EIO;
 	}
 
-	return trans->ops->tx(trans, skb, dev_cmd, queue);
+	return trans->ops->tx_amsdu(trans, skb, dev_cmd, queue, tid, xmit_more);
+}
+
+static inline void iwl_trans_txq_push(struct iwl_trans *trans, int queue)
+{
+	trans->ops->txq_push(trans, queue);
 }
 
-static inline void iwl_trans_reclaim(struct iwl_trans *trans, int queue, int ssn, struct sk_buff_head *skbs)
+static inline void iwl_trans_reclaim(struct iwl_trans *trans, int queue, int ssn)
 {
 	if (WARN_ON_ONCE(trans->state != IWL_TRANS_FW_ALIVE)) {
 		IWL_ERR(trans, "%s bad state = %d\n", __func__, trans->state);
 		return;
 	}
 
-	trans->ops->reclaim(trans, queue, ssn, skbs);
+	trans->ops->reclaim(trans, queue, ssn);
 }
 
 static inline void iwl_trans_txq_disable(struct iwl_trans *trans, int queue, bool configure_scd)
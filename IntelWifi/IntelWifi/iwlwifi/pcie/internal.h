@@ -61,6 +61,14 @@
  */
 #define IWL_PCIE_MAX_FRAGS(x) (x->max_tbs - 3)
 
+/*
+ * The TB length of a TFD is a 12 bit field, at most 4095 bytes. mbuf
+ * segments are split at 2048 bytes instead, a power of two that divides the
+ * page size, so whole pages split into whole TBs and iwl_tx_max_tbs() can
+ * bound the TBs of an mbuf by its length.
+ */
+#define IWL_TX_SEG_MAX_SIZE 2048
+
 /*
  * RX related structures and functions
  */
@@ -91,11 +99,12 @@ enum iwl_shared_irq_flags {
  * @vid: index of this rxb in the global table
  */
 struct iwl_rx_mem_buffer {
-    dma_addr_t page_dma;
-    mbuf_t page;
+    dma_addr_t page_dma; /* mapped once per page, kept across reuse */
+    struct iwl_dma_ptr *page; /* physically contiguous, see iwl_pcie_rx_alloc_page() */
     u16 vid;
     bool invalid;
     TAILQ_ENTRY(iwl_rx_mem_buffer) list;
+    struct iwl_rx_mem_buffer *next; /* link in the allocator stacks */
 };
 
 /**
@@ -112,10 +121,79 @@ struct isr_statistics {
     u32 ctkill;
     u32 wakeup;
     u32 rx;
+    u32 rx_poll;
+    u32 rx_rbs;
     u32 tx;
     u32 unhandled;
+    u32 irqs;
+};
+
+/*
+ * Max RBs handled per RX pass. When a pass uses the whole budget the RX
+ * interrupt causes stay masked and the rest is drained by poll passes on
+ * the interrupt work loop, which lets its other event sources run in between.
+ */
+#define IWL_PCIE_RX_BUDGET 64
+#define IWL_PCIE_RX_INT_BITS (CSR_INT_BIT_FH_RX | CSR_INT_BIT_SW_RX | CSR_INT_BIT_RX_PERIODIC)
+
+/*
+ * Adaptive interrupt moderation. Every IWL_INT_MOD_INTERVAL_MS the interrupt
+ * rate and the work (RBs handled plus TX frames reclaimed) per interrupt are
+ * sampled from the statistics. A high interrupt rate moves the coalescing
+ * timer one level up, little work per interrupt moves it one level down, as
+ * waiting then only adds latency.
+ */
+#define IWL_INT_MOD_INTERVAL_MS 100
+#define IWL_INT_MOD_RATE_HIGH 2000 /* interrupts per second */
+#define IWL_INT_MOD_WORK_LOW 4 /* RBs and TX frames per interrupt */
+
+/**
+ * struct iwl_pcie_int_mod - interrupt moderation state
+ * @level: index into the coalescing timer levels, see iwl_pcie_int_moderation()
+ * @irqs: interrupt count at the last sample
+ * @rx_rbs: RBs handled at the last sample
+ * @tx_reclaimed: TX frames reclaimed at the last sample
+ */
+struct iwl_pcie_int_mod {
+    int level;
+    u32 irqs;
+    u32 rx_rbs;
+    u64 tx_reclaimed;
 };
 
+/**
+ * struct tx_statistics - data queues TX statistics
+ * @packets: frames put on the data queues
+ * @doorbells: write pointer updates (HBUS_TARG_WRPTR writes) for data queues
+ * @deferred: frames whose write pointer update was held back by xmit_more
+ * @amsdus: A-MSDUs built by the transport
+ * @amsdu_subframes: MSDUs sent inside those A-MSDUs
+ * @reclaimed: frames freed by reclaim
+ * @reclaims: reclaim calls that freed frames
+ * @overflowed: frames held back in an overflow queue
+ * @overflow_drops: frames refused because the overflow queue was full
+ * @overflow_max_depth: deepest an overflow queue has been
+ */
+struct tx_statistics {
+    u64 packets;
+    u64 doorbells;
+    u64 deferred;
+    u64 amsdus;
+    u64 amsdu_subframes;
+    u64 reclaimed;
+    u64 reclaims;
+    u64 overflowed;
+    u64 overflow_drops;
+    u32 overflow_max_depth;
+};
+
+/*
+ * Maximum amount of frames/bytes a TX queue may hold back from the device
+ * while the caller announces more frames to come (xmit_more).
+ */
+#define IWL_TX_DB_BATCH_FRAMES 16
+#define IWL_TX_DB_BATCH_BYTES (32 * 1024)
+
 /**
  * struct iwl_rxq - Rx queue
  * @id: queue index
@@ -138,6 +216,8 @@ struct isr_statistics {
  * @queue: actual rx queue. Not used for multi-rx queue.
  *
  * NOTE:  rx_free and rx_used are used as a FIFO for iwl_rx_mem_buffers
+ * NOTE:  rx_free and rx_used are only touched by the context that handles
+ *    this queue, buffers cross to the allocator through &struct iwl_rb_allocator
  */
 struct iwl_rxq {
     int id;
@@ -169,19 +249,28 @@ struct iwl_rxq {
 * @req_pending: number of requests the allcator had not processed yet
 * @req_ready: number of requests honored and ready for claiming
 * @rbd_allocated: RBDs with pages allocated and ready to be handled to
-*    the queue. This is a list of &struct iwl_rx_mem_buffer
-* @rbd_empty: RBDs with no page attached for allocator use. This is a list
-*    of &struct iwl_rx_mem_buffer
-* @lock: protects the rbd_allocated and rbd_empty lists
-* @alloc_wq: work queue for background calls
-* @rx_alloc: work struct for background calls
+*    the queue. This is a lock-free stack of &struct iwl_rx_mem_buffer
+*    linked through @next, pushed by the allocator and popped by the RX
+*    queues under @lock
+* @rbd_empty: RBDs with no page attached for allocator use. This is a
+*    lock-free stack pushed by the RX path and taken whole by the allocator
+* @rbd_partial: RBDs of a request the allocator could not complete for lack
+*    of empty RBDs, owned by the allocator until the batch is full
+* @partial_count: number of RBDs in @rbd_partial
+* @lock: serializes the consumers of @rbd_allocated, pushes don't take it
+* @alloc_wq: event source that runs the allocator on its own work loop
+*    (IOInterruptEventSource), see IntelWifi::rxAllocOccured()
 */
 struct iwl_rb_allocator {
     int req_pending;
     int req_ready;
-    TAILQ_HEAD(, iwl_rx_mem_buffer) rbd_allocated;
-    TAILQ_HEAD(, iwl_rx_mem_buffer) rbd_empty;
+    struct iwl_rx_mem_buffer * volatile rbd_allocated;
+    struct iwl_rx_mem_buffer * volatile rbd_empty;
+    struct iwl_rx_mem_buffer *rbd_partial;
+    int partial_count;
+//    spinlock_t lock;
     IOSimpleLock *lock;
+    void *alloc_wq;
 //    struct workqueue_struct *alloc_wq;
 //    struct work_struct rx_alloc;
 };
@@ -227,6 +316,30 @@ struct iwl_cmd_meta {
 #define TFD_TX_CMD_SLOTS 256
 #define TFD_CMD_SLOTS 32
 
+/**
+ * struct iwl_pcie_cmd_completion - completion of a host command slot
+ * @gen: generation of the command that last used the slot, bumped on
+ *	every enqueue with %CMD_WANT_COMPLETION
+ * @done: the command of generation @gen was completed by the firmware
+ *
+ * Protected by &iwl_trans_pcie.wait_command_queue, waiters sleep on the
+ * address of the completion.
+ */
+struct iwl_pcie_cmd_completion {
+    u32 gen;
+    bool done;
+};
+
+/*
+ * A completion token carries the command queue index in the low byte and
+ * the generation of the slot above it, so that a stale token of a reused
+ * slot is never mistaken for the current command.
+ */
+#define IWL_PCIE_CMD_TOKEN(gen, idx)    (((gen) << 8) | (idx))
+#define IWL_PCIE_CMD_TOKEN_IDX(token)   ((token) & 0xff)
+#define IWL_PCIE_CMD_TOKEN_GEN(token)   ((token) >> 8)
+#define IWL_PCIE_CMD_GEN_MASK           0xffffff
+
 /*
  * The FH will write back to the first TB only, so we need to copy some data
  * into the buffer regardless of whether it should be mapped or not.
@@ -241,17 +354,167 @@ struct iwl_cmd_meta {
 
 struct iwl_pcie_txq_entry {
     struct iwl_device_cmd *cmd;
-    struct sk_buff *skb;
-    /* buffer to free after command completes */
-    const void *free_buf;
-    vm_size_t free_buf_size;
+    mbuf_t skb;
     struct iwl_cmd_meta meta;
+    /* bytes accounted to the queue's byte limit */
+    u32 bytes;
 };
 
 struct iwl_pcie_first_tb_buf {
     u8 buf[IWL_FIRST_TB_SIZE_ALIGN];
 };
 
+/*
+ * TB1 of a data frame holds the remainder of the TX command and the 802.11
+ * header. Like TB0 it gets a buffer per slot that is mapped once, when the
+ * queue is allocated, so the TX path only has to copy into it.
+ */
+#define IWL_TB1_BUF_SIZE 128
+
+struct iwl_pcie_tb1_buf {
+    u8 buf[IWL_TB1_BUF_SIZE];
+};
+
+/*
+ * Host commands get a pre-mapped buffer per command queue slot for
+ * everything after TB0, big enough for the largest command the firmware
+ * accepts (IWL_MAX_CMD_SIZE, the scan with the probe request template).
+ * NOCOPY and DUP chunks are copied into it as well, bigger commands are
+ * refused.
+ */
+#define IWL_PCIE_HCMD_BUF_SIZE 4096
+
+struct iwl_pcie_hcmd_buf {
+    u8 buf[IWL_PCIE_HCMD_BUF_SIZE];
+};
+
+/*
+ * Every A-MSDU subframe gets a slot in the queue's pre-mapped header area.
+ * It holds the padding of the previous subframe, the subframe header
+ * (DA, SA, length) and the LLC/SNAP header.
+ */
+#define IWL_AMSDU_SUBFRAME_HDR_SIZE 32
+#define IWL_AMSDU_SNAP_LEN 8
+
+/**
+ * struct iwl_amsdu_stage - frames being gathered into an A-MSDU
+ * @head: first 802.3 frame, frames are linked with mbuf_nextpkt
+ * @tail: last 802.3 frame
+ * @dev_cmd: TX command (with the QoS data header) of the first frame
+ * @da: destination of the gathered frames
+ * @tid: TID of the gathered frames
+ * @n_subframes: number of gathered frames
+ * @n_tbs: worst case TBs needed for the subframes
+ * @len: A-MSDU length so far, including subframe headers and padding
+ * @held: the A-MSDU is complete but neither the ring nor the overflow queue
+ *	had room for it, it goes out before anything else on the queue
+ */
+struct iwl_amsdu_stage {
+    mbuf_t head;
+    mbuf_t tail;
+    struct iwl_device_cmd *dev_cmd;
+    u8 da[ETH_ALEN];
+    u8 tid;
+    u8 n_subframes;
+    u8 n_tbs;
+    u32 len;
+    bool held;
+};
+
+/*
+ * Period of the TX queue stuck watchdog. A stalled queue is caught at most
+ * this long after its wd_timeout expired.
+ */
+#define IWL_TXQ_WATCHDOG_INTERVAL_MS 500
+
+/* Frames a TX queue can hold back while its ring is full, power of 2 */
+#define IWL_TXQ_OVERFLOW_SIZE 64
+
+/**
+ * struct iwl_txq_overflow - frames waiting for room on a full TX queue
+ * @entries: the frames with their TX commands. An A-MSDU is kept as the
+ *	list of its 802.3 frames with its length and number of subframes,
+ *	both are 0 for an 802.11 frame
+ * @head: free running index of the next entry to fill, moved by the TX path
+ * @tail: free running index of the next entry to send, moved by the reclaim
+ *	path once the frame is on the ring
+ *
+ * Both indexes only move under txq->lock, but the reclaim path doesn't hold
+ * it for the whole drain, see iwl_pcie_txq_overflow_drain(). A frame from
+ * the TX path still never overtakes a waiting one.
+ */
+struct iwl_txq_overflow {
+    struct {
+        mbuf_t skb;
+        struct iwl_device_cmd *dev_cmd;
+        u32 amsdu_len;
+        u8 amsdu_subframes;
+    } entries[IWL_TXQ_OVERFLOW_SIZE];
+    u32 head;
+    u32 tail;
+};
+
+static inline u32 iwl_txq_overflow_depth(const struct iwl_txq_overflow *ovf)
+{
+    return ovf->head - ovf->tail;
+}
+
+/* Byte queue limits, after lib/dynamic_queue_limits.c */
+#define IWL_BQL_MAX_LIMIT (1024 * 1024)
+/* a whole doorbell batch can be in flight, also right after a reset */
+#define IWL_BQL_MIN_LIMIT IWL_TX_DB_BATCH_BYTES
+#define IWL_BQL_SLACK_HOLD_TIME HZ
+
+/**
+ * struct iwl_txq_bql - in-flight byte limit of a TX queue
+ * @num_queued: total bytes put on the ring
+ * @adj_limit: @limit + @num_completed
+ * @last_obj_cnt: bytes of the last frame put on the ring
+ * @limit: current limit
+ * @num_completed: total bytes reclaimed
+ * @prev_ovlimit: bytes over the limit at the previous completion
+ * @prev_num_queued: @num_queued at the previous completion
+ * @prev_last_obj_cnt: @last_obj_cnt at the previous completion
+ * @lowest_slack: lowest slack seen since @slack_start_time
+ * @slack_start_time: time slacks were first seen
+ *
+ * The limit grows when the ring ran dry while frames were held back and
+ * shrinks when it kept more bytes than a completion interval needs for
+ * longer than IWL_BQL_SLACK_HOLD_TIME.
+ */
+struct iwl_txq_bql {
+    u32 num_queued;
+    u32 adj_limit;
+    u32 last_obj_cnt;
+    
+    u32 limit;
+    u32 num_completed;
+    
+    u32 prev_ovlimit;
+    u32 prev_num_queued;
+    u32 prev_last_obj_cnt;
+    
+    u32 lowest_slack;
+    unsigned long slack_start_time;
+};
+
+static inline void iwl_txq_bql_queued(struct iwl_txq_bql *bql, u32 count)
+{
+    bql->last_obj_cnt = count;
+    bql->num_queued += count;
+}
+
+/* bytes that can still be queued, negative when over the limit */
+static inline int iwl_txq_bql_avail(const struct iwl_txq_bql *bql)
+{
+    return (int)(bql->adj_limit - bql->num_queued);
+}
+
+static inline u32 iwl_txq_bql_inflight(const struct iwl_txq_bql *bql)
+{
+    return bql->num_queued - bql->num_completed;
+}
+
 /**
  * struct iwl_txq - Tx Queue for DMA
  * @q: generic Rx/Tx queue descriptor
@@ -260,15 +523,23 @@ struct iwl_pcie_first_tb_buf {
  *    the writeback -- this is DMA memory and an array holding one buffer
  *    for each command on the queue
  * @first_tb_dma: DMA address for the first_tb_bufs start
+ * @tb1_bufs: TB1 buffers of data frames, one for each slot of a data queue
+ * @tb1_dma: DMA address for the tb1_bufs start
+ * @hcmd_bufs: host command buffers, one for each slot of the command queue
+ * @hcmd_dma: DMA address for the hcmd_bufs start
  * @entries: transmit entries (driver state)
  * @lock: queue lock
- * @stuck_timer: timer that fires if queue gets stuck
+ * @stuck_deadline: jiffies after which the queue is considered stuck if it
+ *    made no progress, 0 when the queue is empty. Checked by the periodic
+ *    TX watchdog instead of a timer per queue
  * @trans_pcie: pointer back to transport (for timer)
  * @need_update: indicates need to update read/write index
  * @ampdu: true if this queue is an ampdu queue for an specific RA/TID
  * @wd_timeout: queue watchdog timeout (jiffies) - per queue
- * @frozen: tx stuck queue timer is frozen
- * @frozen_expiry_remainder: remember how long until the timer fires
+ * @frozen: tx stuck queue deadline is frozen
+ * @frozen_expiry_remainder: remember how long until the deadline expires
+ * @overflow_q: overflow queue for handling frames that didn't fit on HW queue
+ * @bql: in-flight byte limit, data queues only
  * @bc_tbl: byte count table of the queue (relevant only for gen2 transport)
  * @write_ptr: 1-st empty entry (index) host_w
  * @read_ptr: last used entry (index) host_r
@@ -277,6 +548,12 @@ struct iwl_pcie_first_tb_buf {
  * @id: queue id
  * @low_mark: low watermark, resume queue if free space more than this
  * @high_mark: high watermark, stop queue if free space less than this
+ * @db_pending_frames: frames queued since the write pointer was last written
+ * @db_pending_bytes: bytes queued since the write pointer was last written
+ * @amsdu: frames being gathered into the next A-MSDU
+ * @amsdu_hdrs: pre-mapped A-MSDU subframe headers, one set per TFD, only
+ *	allocated for aggregation queues
+ * @amsdu_hdrs_dma: DMA address of @amsdu_hdrs
  *
  * A Tx queue consists of circular buffer of BDs (a.k.a. TFDs, transmit frame
  * descriptors) and required locking structures.
@@ -300,10 +577,16 @@ struct iwl_txq {
     struct iwl_pcie_first_tb_buf *first_tb_bufs;
     dma_addr_t first_tb_dma;
     struct iwl_dma_ptr *first_tb_dma_ptr;
+    struct iwl_pcie_tb1_buf *tb1_bufs;
+    dma_addr_t tb1_dma;
+    struct iwl_dma_ptr *tb1_dma_ptr;
+    struct iwl_pcie_hcmd_buf *hcmd_bufs;
+    dma_addr_t hcmd_dma;
+    struct iwl_dma_ptr *hcmd_dma_ptr;
     struct iwl_pcie_txq_entry *entries;
     IOSimpleLock *lock;
     unsigned long frozen_expiry_remainder;
-    //struct timer_list stuck_timer;
+    unsigned long stuck_deadline;
     struct iwl_trans_pcie *trans_pcie;
     bool need_update;
     bool frozen;
@@ -311,7 +594,8 @@ struct iwl_txq {
     int block;
     unsigned long wd_timeout;
     
-    mbuf_t overflow_q;
+    struct iwl_txq_overflow overflow_q;
+    struct iwl_txq_bql bql;
     struct iwl_dma_ptr bc_tbl;
     
     int write_ptr;
@@ -321,6 +605,14 @@ struct iwl_txq {
     u32 id;
     int low_mark;
     int high_mark;
+    
+    u16 db_pending_frames;
+    u32 db_pending_bytes;
+    
+    struct iwl_amsdu_stage amsdu;
+    struct iwl_dma_ptr *amsdu_hdrs_dma_ptr;
+    u8 *amsdu_hdrs;
+    dma_addr_t amsdu_hdrs_dma;
 };
 
 
@@ -330,6 +622,18 @@ iwl_pcie_get_first_tb_dma(struct iwl_txq *txq, int idx)
     return txq->first_tb_dma + sizeof(struct iwl_pcie_first_tb_buf) * idx;
 }
 
+static inline dma_addr_t
+iwl_pcie_get_tb1_dma(struct iwl_txq *txq, int idx)
+{
+    return txq->tb1_dma + sizeof(struct iwl_pcie_tb1_buf) * idx;
+}
+
+static inline dma_addr_t
+iwl_pcie_get_hcmd_dma(struct iwl_txq *txq, int idx)
+{
+    return txq->hcmd_dma + sizeof(struct iwl_pcie_hcmd_buf) * idx;
+}
+
 static inline u16 iwl_pcie_tfd_tb_get_len(struct iwl_trans *trans, void *_tfd,
                                           u8 idx)
 {
@@ -355,6 +659,10 @@ struct iwl_trans_pcie {
     struct iwl_rx_mem_buffer rx_pool[RX_POOL_SIZE];
     struct iwl_rx_mem_buffer *global_table[RX_POOL_SIZE];
     struct iwl_rb_allocator rba;
+    /* poll pass for the default queue (IOInterruptEventSource) and whether
+     * it currently owns the queue with the RX interrupt causes masked */
+    void *rx_poll_src;
+    bool rx_polling;
     struct iwl_trans *trans;
     
     /* INT ICT Table */
@@ -366,6 +674,8 @@ struct iwl_trans_pcie {
     bool is_down, opmode_down;
     bool debug_rfkill;
     struct isr_statistics isr_stats;
+    struct tx_statistics tx_stats;
+    struct iwl_pcie_int_mod int_mod;
     
     IOSimpleLock* irq_lock;
     IOLock *mutex;
@@ -387,6 +697,8 @@ struct iwl_trans_pcie {
     IOLock* ucode_write_waitq;
     IOLock* wait_command_queue;
     IOLock* d0i3_waitq;
+    struct iwl_pcie_cmd_completion cmd_completion[TFD_CMD_SLOTS];
+    struct iwl_resp_buf resp_pool[IWL_RESP_POOL_SIZE];
 
     u8 page_offs, dev_cmd_offs;
     
@@ -397,6 +709,8 @@ struct iwl_trans_pcie {
     u8 no_reclaim_cmds[MAX_NO_RECLAIM_CMDS];
     u8 max_tbs;
     u16 tfd_size;
+    u16 tx_db_batch_frames;
+    u32 tx_db_batch_bytes;
 
     u8 max_skb_frags;
     u32 hw_rev;
@@ -405,6 +719,8 @@ struct iwl_trans_pcie {
     bool bc_table_dword;
     bool scd_set_active;
     bool sw_csum_tx;
+    u8 amsdu_max_subframes;
+    u16 amsdu_max_bytes;
     u32 rx_page_order;
 
     /*protect hw register */
@@ -421,6 +737,8 @@ struct iwl_trans_pcie {
     u8 shared_vec_mask;
     u32 alloc_vecs;
     u32 def_irq;
+    /* RX queues sharing the default vector that used up their budget */
+    u32 msix_shared_pending;
     u32 fh_init_mask;
     u32 hw_init_mask;
     u32 fh_mask;
@@ -451,6 +769,8 @@ int iwl_pcie_gen2_rx_init(struct iwl_trans *trans);
 //irqreturn_t iwl_pcie_irq_rx_msix_handler(int irq, void *dev_id);
 int iwl_pcie_rx_stop(struct iwl_trans *trans);
 void iwl_pcie_rx_free(struct iwl_trans *trans);
+void iwl_pcie_int_moderation_reset(struct iwl_trans *trans);
+void iwl_pcie_int_moderation(struct iwl_trans *trans, u32 interval_ms);
 /*****************************************************
  * ICT - interrupt handling
  ******************************************************/
@@ -476,16 +796,24 @@ void iwl_trans_pcie_txq_disable(struct iwl_trans *trans, int queue,
                                 bool configure_scd);
 void iwl_trans_pcie_txq_set_shared_mode(struct iwl_trans *trans, u32 txq_id,
                                         bool shared_mode);
-//void iwl_trans_pcie_log_scd_error(struct iwl_trans *trans,
-//                                  struct iwl_txq *txq);
-//int iwl_trans_pcie_tx(struct iwl_trans *trans, struct sk_buff *skb,
-//                      struct iwl_device_cmd *dev_cmd, int txq_id);
+void iwl_trans_pcie_log_scd_error(struct iwl_trans *trans,
+                                  struct iwl_txq *txq);
+void iwl_trans_pcie_freeze_txq_timer(struct iwl_trans *trans, unsigned long txqs,
+                                     bool freeze);
+bool iwl_pcie_txq_check_stuck(struct iwl_trans *trans);
+int iwl_trans_pcie_tx(struct iwl_trans *trans, mbuf_t skb,
+                      struct iwl_device_cmd *dev_cmd, int txq_id, bool xmit_more);
+int iwl_trans_pcie_tx_amsdu(struct iwl_trans *trans, mbuf_t skb,
+                            struct iwl_device_cmd *dev_cmd, int txq_id, u8 tid, bool xmit_more);
+void iwl_trans_pcie_txq_push(struct iwl_trans *trans, int txq_id);
 void iwl_pcie_txq_check_wrptrs(struct iwl_trans *trans);
 int iwl_trans_pcie_send_hcmd(struct iwl_trans *trans, struct iwl_host_cmd *cmd);
+int iwl_trans_pcie_wait_cmds(struct iwl_trans *trans, const u32 *tokens,
+                             int n_tokens);
+void iwl_pcie_cmd_completion_wake_all(struct iwl_trans *trans);
 //void iwl_pcie_hcmd_complete(struct iwl_trans *trans,
 //                            struct iwl_rx_cmd_buffer *rxb);
-//void iwl_trans_pcie_reclaim(struct iwl_trans *trans, int txq_id, int ssn,
-//                            struct sk_buff_head *skbs);
+void iwl_trans_pcie_reclaim(struct iwl_trans *trans, int txq_id, int ssn);
 //void iwl_trans_pcie_tx_reset(struct iwl_trans *trans);
 
 /*****************************************************
@@ -550,6 +878,14 @@ static inline void _iwl_enable_interrupts(struct iwl_trans *trans)
     }
 }
 
+/* CUSTOM: everything but the RX causes, used while RX is being polled */
+static inline void iwl_enable_non_rx_int(struct iwl_trans *trans)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    iwl_write32(trans, CSR_INT_MASK, trans_pcie->inta_mask & ~IWL_PCIE_RX_INT_BITS);
+}
+
 // line 617
 static inline void iwl_enable_interrupts(struct iwl_trans *trans)
 {
@@ -648,6 +984,38 @@ static inline bool iwl_is_rfkill_set(struct iwl_trans *trans)
 
 
 
+/*
+ * CUSTOM: iwl_op_mode_queue_full() and iwl_op_mode_queue_not_full(), there
+ * is no trans->op_mode, the op mode is reached through the controller
+ */
+void iwl_trans_pcie_queue_full(struct iwl_trans *trans, int queue);
+void iwl_trans_pcie_queue_not_full(struct iwl_trans *trans, int queue);
+
+// line 692
+static inline void iwl_wake_queue(struct iwl_trans *trans,
+                                  struct iwl_txq *txq)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (test_and_clear_bit(txq->id, trans_pcie->queue_stopped)) {
+        IWL_DEBUG_TX_QUEUES(trans, "Wake hwq %d\n", txq->id);
+        iwl_trans_pcie_queue_not_full(trans, txq->id);
+    }
+}
+
+// line 703
+static inline void iwl_stop_queue(struct iwl_trans *trans,
+                                  struct iwl_txq *txq)
+{
+    struct iwl_trans_pcie *trans_pcie = IWL_TRANS_GET_PCIE_TRANS(trans);
+    
+    if (!test_and_set_bit(txq->id, trans_pcie->queue_stopped)) {
+        iwl_trans_pcie_queue_full(trans, txq->id);
+        IWL_DEBUG_TX_QUEUES(trans, "Stop hwq %d\n", txq->id);
+    } else
+        IWL_DEBUG_TX_QUEUES(trans, "hwq %d already stopped\n", txq->id);
+}
+
 static inline bool iwl_queue_used(const struct iwl_txq *q, int i)
 {
     return q->write_ptr >= q->read_ptr ?
@@ -277,12 +277,15 @@ const struct iwl_trans_ops trans_ops_pcie = {
     IWL_TRANS_COMMON_OPS,
     IWL_TRANS_PM_OPS
     .send_cmd = iwl_trans_pcie_send_hcmd,
+    .wait_cmds = iwl_trans_pcie_wait_cmds,
     .fw_alive = iwl_trans_pcie_fw_alive,
 //    .start_hw = iwl_trans_pcie_start_hw,
 //    .start_fw = iwl_trans_pcie_start_fw,
 //    .stop_device = iwl_trans_pcie_stop_device,
-//    .tx = iwl_trans_pcie_tx,
-//    .reclaim = iwl_trans_pcie_reclaim,
+    .tx = iwl_trans_pcie_tx,
+    .tx_amsdu = iwl_trans_pcie_tx_amsdu,
+    .txq_push = iwl_trans_pcie_txq_push,
+    .reclaim = iwl_trans_pcie_reclaim,
 //
     .txq_disable = iwl_trans_pcie_txq_disable,
     .txq_enable = iwl_trans_pcie_txq_enable,
@@ -291,7 +294,7 @@ const struct iwl_trans_ops trans_ops_pcie = {
     
 //    .wait_tx_queues_empty = iwl_trans_pcie_wait_txqs_empty,
 //
-//    .freeze_txq_timer = iwl_trans_pcie_freeze_txq_timer,
+    .freeze_txq_timer = iwl_trans_pcie_freeze_txq_timer,
 //    .block_txq_ptrs = iwl_trans_pcie_block_txq_ptrs,
 };
 
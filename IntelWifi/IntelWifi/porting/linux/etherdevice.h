@@ -33,6 +33,23 @@
 
 #include <linux/types.h>
 
+/* uapi/linux/if_ether.h */
+#define ETH_HLEN 14            /* Total octets in header. */
+#define ETH_P_802_3_MIN 0x0600 /* If the value in the ethernet type is less than this value
+                                * then the frame is Ethernet II. Else it is 802.3 */
+
+/** line 103
+ * is_multicast_ether_addr - Determine if the Ethernet address is a multicast.
+ * @addr: Pointer to a six-byte array containing the Ethernet address
+ *
+ * Return true if the address is a multicast address.
+ * By definition the broadcast address is also a multicast address.
+ */
+static inline bool is_multicast_ether_addr(const u8 *addr)
+{
+    return 0x01 & addr[0];
+}
+
 /** line 157
  * is_broadcast_ether_addr - Determine if the Ethernet address is broadcast
  * @addr: Pointer to a six-byte array containing the Ethernet address
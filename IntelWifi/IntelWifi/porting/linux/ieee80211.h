@@ -652,6 +652,68 @@ static inline bool ieee80211_is_first_frag(__le16 seq_ctrl)
     return (seq_ctrl & cpu_to_le16(IEEE80211_SCTL_FRAG)) == 0;
 }
 
+/**
+ * ieee80211_get_qos_ctl - get pointer to qos control bytes
+ * @hdr: the frame
+ *
+ * The qos ctrl bytes come after the frame_control, duration, seq_num
+ * and 3 or 4 addresses of length ETH_ALEN.
+ * 3 addr: 2 + 2 + 2 + 3*6 = 24
+ * 4 addr: 2 + 2 + 2 + 4*6 = 30
+ */
+static inline u8 *ieee80211_get_qos_ctl(struct ieee80211_hdr *hdr)
+{
+    if (ieee80211_has_a4(hdr->frame_control))
+        return (u8 *)hdr + 30;
+    else
+        return (u8 *)hdr + 24;
+}
+
+/**
+ * ieee80211_hdrlen - get header length in bytes from frame control
+ * @fc: frame control field in little-endian format
+ * Return: The header length in bytes.
+ */
+static inline unsigned int ieee80211_hdrlen(__le16 fc)
+{
+    unsigned int hdrlen = 24;
+    
+    if (ieee80211_is_data(fc)) {
+        if (ieee80211_has_a4(fc))
+            hdrlen = 30;
+        if (ieee80211_is_data_qos(fc)) {
+            hdrlen += IEEE80211_QOS_CTL_LEN;
+            if (ieee80211_has_order(fc))
+                hdrlen += IEEE80211_HT_CTL_LEN;
+        }
+        return hdrlen;
+    }
+    
+    if (ieee80211_is_mgmt(fc)) {
+        if (ieee80211_has_order(fc))
+            hdrlen += IEEE80211_HT_CTL_LEN;
+        return hdrlen;
+    }
+    
+    if (ieee80211_is_ctl(fc)) {
+        /*
+         * ACK and CTS are 10 bytes, all others 16. To see how
+         * to get this condition consider
+         *   subtype mask:   0b0000000011110000 (0x00F0)
+         *   ACK subtype:    0b0000000011010000 (0x00D0)
+         *   CTS subtype:    0b0000000011000000 (0x00C0)
+         *   bits that matter:         ^^^      (0x00E0)
+         *   value of those: 0b0000000011000000 (0x00C0)
+         */
+        if ((fc & cpu_to_le16(0x00E0)) == cpu_to_le16(0x00C0))
+            hdrlen = 10;
+        else
+            hdrlen = 16;
+    }
+    
+    return hdrlen;
+}
+
 
 
 struct mac_address {
@@ -1022,6 +1084,61 @@ struct ieee80211_ht_cap {
 #define IEEE80211_HT_AMPDU_PARM_DENSITY        0x1C
 #define        IEEE80211_HT_AMPDU_PARM_DENSITY_SHIFT    2
 
+/* Maximum reorder buffer size of an HT block ack session */
+#define IEEE80211_MAX_AMPDU_BUF        0x40
+
+/* Block Ack Parameter Set field masks (for addba_req / addba_resp capab) */
+#define IEEE80211_ADDBA_PARAM_AMSDU_MASK    0x0001
+#define IEEE80211_ADDBA_PARAM_POLICY_MASK    0x0002
+#define IEEE80211_ADDBA_PARAM_TID_MASK        0x003C
+#define IEEE80211_ADDBA_PARAM_BUF_SIZE_MASK    0xFFC0
+/* DELBA Parameter Set field masks (for delba params) */
+#define IEEE80211_DELBA_PARAM_TID_MASK        0xF000
+#define IEEE80211_DELBA_PARAM_INITIATOR_MASK    0x0800
+
+/* Action category code */
+enum ieee80211_category {
+    WLAN_CATEGORY_SPECTRUM_MGMT = 0,
+    WLAN_CATEGORY_QOS = 1,
+    WLAN_CATEGORY_DLS = 2,
+    WLAN_CATEGORY_BACK = 3,
+    WLAN_CATEGORY_PUBLIC = 4,
+    WLAN_CATEGORY_RADIO_MEASUREMENT = 5,
+    WLAN_CATEGORY_HT = 7,
+    WLAN_CATEGORY_SA_QUERY = 8,
+    WLAN_CATEGORY_PROTECTED_DUAL_OF_ACTION = 9,
+    WLAN_CATEGORY_WNM = 10,
+    WLAN_CATEGORY_WNM_UNPROTECTED = 11,
+    WLAN_CATEGORY_TDLS = 12,
+    WLAN_CATEGORY_MESH_ACTION = 13,
+    WLAN_CATEGORY_MULTIHOP_ACTION = 14,
+    WLAN_CATEGORY_SELF_PROTECTED = 15,
+    WLAN_CATEGORY_DMG = 16,
+    WLAN_CATEGORY_WMM = 17,
+    WLAN_CATEGORY_FST = 18,
+    WLAN_CATEGORY_UNPROT_DMG = 20,
+    WLAN_CATEGORY_VHT = 21,
+    WLAN_CATEGORY_VENDOR_SPECIFIC_PROTECTED = 126,
+    WLAN_CATEGORY_VENDOR_SPECIFIC = 127,
+};
+
+/* BACK action code */
+enum ieee80211_back_actioncode {
+    WLAN_ACTION_ADDBA_REQ = 0,
+    WLAN_ACTION_ADDBA_RESP = 1,
+    WLAN_ACTION_DELBA = 2,
+};
+
+/* Status codes, the ones the driver uses */
+enum ieee80211_statuscode {
+    WLAN_STATUS_SUCCESS = 0,
+};
+
+/* Reason codes, the ones the driver uses */
+enum ieee80211_reasoncode {
+    WLAN_REASON_QSTA_NOT_USE = 37,
+};
+
 
 // line 870
 #define WLAN_SA_QUERY_TR_ID_LEN 2
@@ -1345,6 +1462,13 @@ enum ieee80211_eid {
 #define WLAN_AKM_SUITE_FT_FILS_SHA256       SUITE(0x000FAC, 16)
 #define WLAN_AKM_SUITE_FT_FILS_SHA384       SUITE(0x000FAC, 17)
 
+#define IEEE80211_WEP_IV_LEN        4
+#define IEEE80211_WEP_ICV_LEN       4
+#define IEEE80211_CCMP_HDR_LEN      8
+#define IEEE80211_CCMP_MIC_LEN      8
+#define IEEE80211_TKIP_IV_LEN       8
+#define IEEE80211_TKIP_ICV_LEN      4
+
 #define WLAN_MAX_KEY_LEN            32
 
 #define WLAN_PMK_NAME_LEN           16
@@ -15,6 +15,20 @@
 // line 135
 #define IEEE80211_INVAL_HW_QUEUE    0xff
 
+/** line 138
+ * enum ieee80211_ac_numbers - AC numbers as used in mac80211
+ * @IEEE80211_AC_VO: voice
+ * @IEEE80211_AC_VI: video
+ * @IEEE80211_AC_BE: best effort
+ * @IEEE80211_AC_BK: background
+ */
+enum ieee80211_ac_numbers {
+    IEEE80211_AC_VO        = 0,
+    IEEE80211_AC_VI        = 1,
+    IEEE80211_AC_BE        = 2,
+    IEEE80211_AC_BK        = 3,
+};
+
 
 /* line 335
  * The maximum number of IPv4 addresses listed for ARP filtering. If the number
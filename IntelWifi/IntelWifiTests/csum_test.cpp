@@ -0,0 +1,109 @@
+//
+//  csum_test.cpp
+//  IntelWifiTests
+//
+//  Benchmark of the one's complement sum of the software TX checksum
+//  (iw_utils/csum.h) against the 16 bit loop of RFC 1071 at common packet
+//  sizes: minimal frames, the IPv4 minimum MTU, the Ethernet MTU and jumbo
+//  frames. Both have to agree for every length and alignment.
+//
+
+#include <string.h>
+
+#include "test_util.h"
+
+#include <linux/types.h>
+
+#include "iw_utils/csum.h"
+
+#define BENCH_BYTES (256L * 1024 * 1024)
+
+/* the reference implementation of RFC 1071, section 4.1 */
+static u16 rfc1071_sum(const u8 *addr, u32 count)
+{
+    u32 sum = 0;
+    u16 w;
+    
+    while (count > 1) {
+        memcpy(&w, addr, sizeof(w));
+        sum += w;
+        addr += 2;
+        count -= 2;
+    }
+    if (count > 0)
+        sum += *addr;
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (u16)sum;
+}
+
+static void fill_random(u8 *p, u32 len, unsigned *seed)
+{
+    u32 i;
+    
+    for (i = 0; i < len; i++)
+        p[i] = (u8)rand_r(seed);
+}
+
+/* every length up to a few words, at every alignment */
+static void test_lengths(void)
+{
+    u8 buf[256 + 8];
+    unsigned seed = 1;
+    u32 len, align;
+    
+    fill_random(buf, sizeof(buf), &seed);
+    for (align = 0; align < 8; align++)
+        for (len = 0; len <= 256; len++)
+            CHECK_EQ(iwl_csum_block(buf + align, len), rfc1071_sum(buf + align, len));
+    
+    /* carries of all-ones data have to fold back in */
+    memset(buf, 0xff, sizeof(buf));
+    for (len = 0; len <= 256; len++)
+        CHECK_EQ(iwl_csum_block(buf, len), rfc1071_sum(buf, len));
+}
+
+static void bench(u32 len)
+{
+    u8 *buf = (u8 *)malloc(len + 1);
+    long runs = BENCH_BYTES / len, i;
+    unsigned seed = len;
+    double start, t_ref, t_new;
+    u64 sum;
+    
+    /* one byte off, the IP header of an 802.11 frame is rarely aligned */
+    fill_random(buf, len + 1, &seed);
+    CHECK_EQ(iwl_csum_block(buf + 1, len), rfc1071_sum(buf + 1, len));
+    
+    sum = 0;
+    start = test_now();
+    for (i = 0; i < runs; i++) {
+        buf[1] = (u8)i;
+        sum += rfc1071_sum(buf + 1, len);
+    }
+    t_ref = test_now() - start;
+    test_sink += sum;
+    
+    sum = 0;
+    start = test_now();
+    for (i = 0; i < runs; i++) {
+        buf[1] = (u8)i;
+        sum += iwl_csum_block(buf + 1, len);
+    }
+    t_new = test_now() - start;
+    test_sink += sum;
+    
+    printf("%5u bytes: RFC 1071 %7.1f ns %5.2f GB/s, iwl_csum_block %7.1f ns %5.2f GB/s\n", len,
+           t_ref * 1e9 / runs, BENCH_BYTES / t_ref / 1e9, t_new * 1e9 / runs, BENCH_BYTES / t_new / 1e9);
+    free(buf);
+}
+
+int main(void)
+{
+    test_lengths();
+    bench(64);
+    bench(576);
+    bench(1500);
+    bench(9000);
+    return test_result("csum");
+}
@@ -0,0 +1,339 @@
+//
+//  msix_sched_test.cpp
+//  IntelWifiTests
+//
+//  Runs the MSI-X vector handlers against a simulated interrupt controller.
+//  The controller masks a vector when it fires (automask) and delivers a
+//  message raised while masked once the handler unmasks it. Every vector has
+//  a thread of its own that calls the handler and runs it again when it asks
+//  for another pass, as the IOFilterInterruptEventSource of the vector does.
+//  The handlers follow iwl_pcie_irq_rx_msix_handler() and
+//  iwl_pcie_irq_msix_handler() on top of iw_utils/msix_sched.h.
+//
+//  Checked for the three vector layouts of iwl_pcie_set_interrupt_capa():
+//  no frame is left behind, no queue is handled by two threads at once, and
+//  no pass handles more than a budget per queue.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "test_util.h"
+
+#include <linux/types.h>
+#include "iwlwifi/iwl-csr.h"
+
+/* from iwlwifi/pcie/internal.h */
+#define IWL_MAX_RX_HW_QUEUES 16
+#define IWL_PCIE_RX_BUDGET 64
+
+enum iwl_shared_irq_flags {
+    IWL_SHARED_IRQ_NON_RX        = BIT(0),
+    IWL_SHARED_IRQ_FIRST_RSS    = BIT(1),
+};
+
+#include "iw_utils/msix_sched.h"
+
+#define FRAMES_PER_QUEUE 200000
+#define FW_NOTIFICATIONS 2000
+
+struct sim_vector {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool masked;        /* automask, cleared by the handler */
+    bool pending;       /* message raised while masked */
+    int signals;        /* event source producer count */
+    int consumed;
+    bool running;
+    pthread_t thread;
+};
+
+struct sim {
+    /* layout, as iwl_pcie_set_interrupt_capa() picks it */
+    int num_vecs;
+    int num_queues;
+    u32 def_irq;
+    u32 shared_vec_mask;
+
+    struct sim_vector vec[IWL_MAX_RX_HW_QUEUES];
+    volatile u32 fh_causes;     /* CSR_MSIX_FH_INT_CAUSES_AD */
+    volatile u32 hw_causes;     /* CSR_MSIX_HW_INT_CAUSES_AD */
+    bool stop;
+
+    /* device side of the RX queues */
+    volatile int backlog[IWL_MAX_RX_HW_QUEUES];
+    volatile int in_handler[IWL_MAX_RX_HW_QUEUES];
+    long delivered[IWL_MAX_RX_HW_QUEUES];
+
+    /* driver state */
+    u32 msix_shared_pending;
+    volatile int alive_raised;
+    int alive_handled;
+    int max_pass_rbs;
+    long passes;
+};
+
+static struct sim sim;
+static __thread int pass_rbs;
+
+/* vector the cause of RX queue @queue is routed to, see iwl_pcie_map_rx_causes() */
+static int sim_queue_vector(int queue)
+{
+    int offset = sim.shared_vec_mask & IWL_SHARED_IRQ_FIRST_RSS ? 1 : 0;
+    
+    return queue ? queue - offset : 0;
+}
+
+static void sim_signal(struct sim_vector *v)
+{
+    v->signals++;
+    pthread_cond_signal(&v->cond);
+}
+
+/* the device raises the message of a vector */
+static void sim_raise(int entry)
+{
+    struct sim_vector *v = &sim.vec[entry];
+    
+    pthread_mutex_lock(&v->lock);
+    if (v->masked) {
+        v->pending = true;
+    } else {
+        v->masked = true;
+        sim_signal(v);
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+/* iwl_pcie_clear_irq() */
+static void sim_clear_irq(int entry)
+{
+    struct sim_vector *v = &sim.vec[entry];
+    
+    pthread_mutex_lock(&v->lock);
+    if (v->pending) {
+        v->pending = false;
+        sim_signal(v);
+    } else {
+        v->masked = false;
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+/* iwl_pcie_rx_handle(): takes up to a budget of RBs off the queue */
+static int sim_rx_handle(void *ctx, int queue, int budget)
+{
+    int old, n;
+    
+    CHECK(OSCompareAndSwap(0, 1, &sim.in_handler[queue]));
+    do {
+        old = sim.backlog[queue];
+        n = old < budget ? old : budget;
+    } while (n && !OSCompareAndSwap(old, old - n, &sim.backlog[queue]));
+    sim.delivered[queue] += n;
+    pass_rbs += n;
+    sim.in_handler[queue] = 0;
+    return n;
+}
+
+/* iwl_pcie_irq_rx_msix_handler() */
+static bool sim_rx_msix_handler(int entry)
+{
+    int queue = iwl_msix_entry_to_queue(sim.shared_vec_mask, entry);
+    
+    CHECK(queue < sim.num_queues);
+    if (iwl_msix_service_rx(BIT(queue), IWL_PCIE_RX_BUDGET, sim_rx_handle, NULL))
+        return true;
+    sim_clear_irq(entry);
+    return false;
+}
+
+/* iwl_pcie_irq_msix_handler() */
+static bool sim_msix_handler(int entry)
+{
+    u32 inta_fh = __sync_fetch_and_and(&sim.fh_causes, 0);
+    u32 inta_hw = __sync_fetch_and_and(&sim.hw_causes, 0);
+    u32 rx_pending;
+    
+    if (!(inta_fh | inta_hw) && !sim.msix_shared_pending) {
+        sim_clear_irq(entry);
+        return false;
+    }
+    
+    rx_pending = sim.msix_shared_pending |
+                 iwl_msix_shared_rx_queues(sim.shared_vec_mask, inta_fh);
+    sim.msix_shared_pending = iwl_msix_service_rx(rx_pending, IWL_PCIE_RX_BUDGET,
+                                                  sim_rx_handle, NULL);
+    
+    /* the other causes are not held up by a busy queue */
+    if (inta_hw & MSIX_HW_INT_CAUSES_REG_ALIVE)
+        sim.alive_handled++;
+    
+    if (sim.msix_shared_pending)
+        return true;
+    sim_clear_irq(entry);
+    return false;
+}
+
+/* the work loop of a vector, IntelWifi::msixInterruptOccured() */
+static void *sim_vector_thread(void *arg)
+{
+    int entry = (int)(long)arg;
+    struct sim_vector *v = &sim.vec[entry];
+    
+    pthread_mutex_lock(&v->lock);
+    for (;;) {
+        bool again;
+        
+        while (v->consumed == v->signals && !sim.stop)
+            pthread_cond_wait(&v->cond, &v->lock);
+        if (v->consumed == v->signals)
+            break;
+        v->consumed = v->signals;
+        v->running = true;
+        pthread_mutex_unlock(&v->lock);
+        
+        pass_rbs = 0;
+        if ((u32)entry == sim.def_irq)
+            again = sim_msix_handler(entry);
+        else
+            again = sim_rx_msix_handler(entry);
+        __sync_fetch_and_add(&sim.passes, 1);
+        if (pass_rbs > sim.max_pass_rbs)
+            sim.max_pass_rbs = pass_rbs;
+        
+        pthread_mutex_lock(&v->lock);
+        v->running = false;
+        /* signalInterrupt(), the vector stays masked */
+        if (again)
+            v->signals++;
+    }
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+/* the device: bursts of frames on a queue, each followed by its interrupt */
+static void *sim_queue_thread(void *arg)
+{
+    int queue = (int)(long)arg;
+    int vector = sim_queue_vector(queue);
+    unsigned seed = queue + 1;
+    int sent = 0;
+    
+    while (sent < FRAMES_PER_QUEUE) {
+        int burst = 1 + rand_r(&seed) % (4 * IWL_PCIE_RX_BUDGET);
+        
+        if (burst > FRAMES_PER_QUEUE - sent)
+            burst = FRAMES_PER_QUEUE - sent;
+        OSAddAtomic(burst, &sim.backlog[queue]);
+        sent += burst;
+        if ((u32)vector == sim.def_irq)
+            __sync_fetch_and_or(&sim.fh_causes, BIT(MSIX_FH_INT_CAUSES_Q(queue)));
+        sim_raise(vector);
+        if (!(rand_r(&seed) & 7))
+            sched_yield();
+    }
+    return NULL;
+}
+
+/* firmware notifications on the default vector */
+static void *sim_fw_thread(void *arg)
+{
+    int i;
+    
+    for (i = 0; i < FW_NOTIFICATIONS; i++) {
+        __sync_fetch_and_or(&sim.hw_causes, MSIX_HW_INT_CAUSES_REG_ALIVE);
+        sim.alive_raised++;
+        sim_raise(sim.def_irq);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static bool sim_idle(void)
+{
+    int i;
+    
+    for (i = 0; i < sim.num_vecs; i++) {
+        struct sim_vector *v = &sim.vec[i];
+        bool busy;
+        
+        pthread_mutex_lock(&v->lock);
+        busy = v->masked || v->running || v->signals != v->consumed;
+        pthread_mutex_unlock(&v->lock);
+        if (busy)
+            return false;
+    }
+    return true;
+}
+
+static void run_layout(const char *name, int num_vecs, u32 shared_vec_mask)
+{
+    pthread_t queues[IWL_MAX_RX_HW_QUEUES], fw;
+    double start, elapsed;
+    long total = 0;
+    int i;
+    
+    memset(&sim, 0, sizeof(sim));
+    sim.num_vecs = num_vecs;
+    sim.shared_vec_mask = shared_vec_mask;
+    if (shared_vec_mask & IWL_SHARED_IRQ_FIRST_RSS)
+        sim.num_queues = num_vecs + 1;
+    else if (shared_vec_mask & IWL_SHARED_IRQ_NON_RX)
+        sim.num_queues = num_vecs;
+    else
+        sim.num_queues = num_vecs - 1;
+    sim.def_irq = shared_vec_mask ? 0 : num_vecs - 1;
+    
+    for (i = 0; i < num_vecs; i++) {
+        pthread_mutex_init(&sim.vec[i].lock, NULL);
+        pthread_cond_init(&sim.vec[i].cond, NULL);
+        pthread_create(&sim.vec[i].thread, NULL, sim_vector_thread, (void *)(long)i);
+    }
+    
+    start = test_now();
+    for (i = 0; i < sim.num_queues; i++)
+        pthread_create(&queues[i], NULL, sim_queue_thread, (void *)(long)i);
+    pthread_create(&fw, NULL, sim_fw_thread, NULL);
+    for (i = 0; i < sim.num_queues; i++)
+        pthread_join(queues[i], NULL);
+    pthread_join(fw, NULL);
+    
+    /* every interrupt has to bring the vectors back to idle on its own */
+    while (!sim_idle() && test_now() - start < 30)
+        sched_yield();
+    elapsed = test_now() - start;
+    CHECK(sim_idle());
+    
+    for (i = 0; i < num_vecs; i++) {
+        pthread_mutex_lock(&sim.vec[i].lock);
+        sim.stop = true;
+        pthread_cond_signal(&sim.vec[i].cond);
+        pthread_mutex_unlock(&sim.vec[i].lock);
+    }
+    for (i = 0; i < num_vecs; i++)
+        pthread_join(sim.vec[i].thread, NULL);
+    
+    for (i = 0; i < sim.num_queues; i++) {
+        CHECK_EQ(sim.backlog[i], 0);
+        CHECK_EQ(sim.delivered[i], FRAMES_PER_QUEUE);
+        total += sim.delivered[i];
+    }
+    CHECK_EQ(sim.msix_shared_pending, 0);
+    CHECK(sim.alive_handled > 0);
+    CHECK(sim.alive_handled <= sim.alive_raised);
+    /* the default vector serves up to two queues */
+    CHECK(sim.max_pass_rbs <= 2 * IWL_PCIE_RX_BUDGET);
+    
+    printf("%-16s %2d vectors %2d queues: %ld passes, max %d RBs per pass, %.0f RBs/s\n",
+           name, num_vecs, sim.num_queues, sim.passes, sim.max_pass_rbs, total / elapsed);
+}
+
+int main(void)
+{
+    run_layout("dedicated", 6, 0);
+    run_layout("non-rx shared", 5, IWL_SHARED_IRQ_NON_RX);
+    run_layout("rss shared", 4, IWL_SHARED_IRQ_NON_RX | IWL_SHARED_IRQ_FIRST_RSS);
+    return test_result("msix_sched");
+}
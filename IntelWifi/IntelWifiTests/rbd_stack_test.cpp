@@ -0,0 +1,278 @@
+//
+//  rbd_stack_test.cpp
+//  IntelWifiTests
+//
+//  Stress test of the RX allocator (iw_utils/rbd_stack.h): RX queue threads
+//  consume RBDs, hand them back and claim batches while the allocator thread
+//  honors the requests, the way iwl_pcie_rx_handle_rb() and
+//  iwl_pcie_rx_allocator() use it. Every claimed batch has to be whole, every
+//  RBD has to be prepared and owned by a single queue, and none may get lost.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <vector>
+
+#include <IOKit/IOLocks.h>
+
+#include "test_util.h"
+
+/* the allocator parts of iwlwifi/pcie/internal.h */
+#define RX_POST_REQ_ALLOC 2
+#define RX_CLAIM_REQ_ALLOC 8
+
+struct iwl_rx_mem_buffer {
+    volatile int owner;     /* queue holding the RBD, -1 for the allocator */
+    bool filled;            /* stands for the page, set by the fill step */
+    struct iwl_rx_mem_buffer *next;
+};
+
+struct iwl_rb_allocator {
+    int req_pending;
+    int req_ready;
+    struct iwl_rx_mem_buffer * volatile rbd_allocated;
+    struct iwl_rx_mem_buffer * volatile rbd_empty;
+    struct iwl_rx_mem_buffer *rbd_partial;
+    int partial_count;
+    IOSimpleLock *lock;
+};
+
+#include "iw_utils/rbd_stack.h"
+
+#define NUM_QUEUES 4
+#define QUEUE_RBDS 64
+#define FRAMES_PER_QUEUE 400000
+
+static struct iwl_rb_allocator rba;
+static volatile int queues_running;
+static volatile int alloc_deferred;
+
+static bool fill_rbd(void *ctx, struct iwl_rx_mem_buffer *rxb)
+{
+    unsigned *seed = (unsigned *)ctx;
+    
+    CHECK(!rxb->filled);
+    CHECK_EQ(rxb->owner, -1);
+    /* page allocation failures are retried by the allocator */
+    if ((rand_r(seed) & 31) == 0)
+        return false;
+    rxb->filled = true;
+    return true;
+}
+
+static void *allocator_thread(void *arg)
+{
+    unsigned seed = 1;
+    
+    while (queues_running || rba.req_pending) {
+        if (!rba.req_pending) {
+            sched_yield();
+            continue;
+        }
+        if (iwl_rbd_alloc_run(&rba, fill_rbd, &seed))
+            alloc_deferred++;
+    }
+    return NULL;
+}
+
+struct rx_queue {
+    int id;
+    std::vector<struct iwl_rx_mem_buffer *> rx_free;
+    std::vector<struct iwl_rx_mem_buffer *> rx_used;
+    int used_count;
+    long claims;
+};
+
+static void queue_used_to_allocator(struct rx_queue *q)
+{
+    struct iwl_rx_mem_buffer *first = NULL, *last = NULL;
+    
+    for (size_t i = 0; i < q->rx_used.size(); i++) {
+        struct iwl_rx_mem_buffer *rxb = q->rx_used[i];
+        
+        rxb->owner = -1;
+        if (last)
+            last->next = rxb;
+        else
+            first = rxb;
+        last = rxb;
+    }
+    q->rx_used.clear();
+    if (first)
+        iwl_rbd_push_chain(&rba.rbd_empty, first, last);
+}
+
+static void *queue_thread(void *arg)
+{
+    struct rx_queue *q = (struct rx_queue *)arg;
+    long frames = 0;
+    
+    while (frames < FRAMES_PER_QUEUE) {
+        if (!q->rx_free.empty()) {
+            struct iwl_rx_mem_buffer *rxb = q->rx_free.back();
+            
+            /* the page was stolen by the stack, the RBD goes back */
+            q->rx_free.pop_back();
+            CHECK(rxb->filled);
+            CHECK_EQ(rxb->owner, q->id);
+            rxb->filled = false;
+            q->rx_used.push_back(rxb);
+            q->used_count++;
+            frames++;
+            
+            if ((q->used_count % RX_CLAIM_REQ_ALLOC) == RX_POST_REQ_ALLOC) {
+                queue_used_to_allocator(q);
+                OSIncrementAtomic(&rba.req_pending);
+            }
+        }
+        
+        if (q->used_count >= RX_CLAIM_REQ_ALLOC) {
+            struct iwl_rx_mem_buffer *rxbs[RX_CLAIM_REQ_ALLOC];
+            int n = iwl_rbd_claim(&rba, rxbs);
+            
+            if (n) {
+                CHECK_EQ(n, RX_CLAIM_REQ_ALLOC);
+                for (int i = 0; i < n; i++) {
+                    /* a second owner means a batch was handed out twice */
+                    CHECK(OSCompareAndSwap(-1, q->id, &rxbs[i]->owner));
+                    CHECK(rxbs[i]->filled);
+                    q->rx_free.push_back(rxbs[i]);
+                }
+                q->used_count -= n;
+                q->claims++;
+            } else if (q->rx_free.empty()) {
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+static int count_chain(struct iwl_rx_mem_buffer *rxb, std::vector<int> &seen,
+                       struct iwl_rx_mem_buffer *pool)
+{
+    int n = 0;
+    
+    for (; rxb; rxb = rxb->next, n++)
+        seen[rxb - pool]++;
+    return n;
+}
+
+static void test_stress(void)
+{
+    int allocator_pool = NUM_QUEUES * (RX_CLAIM_REQ_ALLOC - RX_POST_REQ_ALLOC);
+    int pool_size = NUM_QUEUES * QUEUE_RBDS + allocator_pool;
+    std::vector<struct iwl_rx_mem_buffer> pool(pool_size);
+    std::vector<int> seen(pool_size);
+    struct rx_queue queues[NUM_QUEUES];
+    pthread_t alloc, threads[NUM_QUEUES];
+    long claims = 0;
+    double start, elapsed;
+    int i, q, total;
+    
+    memset(&rba, 0, sizeof(rba));
+    rba.lock = IOSimpleLockAlloc();
+    for (i = 0; i < pool_size; i++) {
+        struct iwl_rx_mem_buffer *rxb = &pool[i];
+        
+        rxb->next = NULL;
+        if (i < allocator_pool) {
+            rxb->owner = -1;
+            rxb->filled = false;
+            iwl_rbd_push_chain(&rba.rbd_empty, rxb, rxb);
+        } else {
+            q = (i - allocator_pool) / QUEUE_RBDS;
+            rxb->owner = q;
+            rxb->filled = true;
+            queues[q].rx_free.push_back(rxb);
+        }
+    }
+    
+    queues_running = 1;
+    start = test_now();
+    pthread_create(&alloc, NULL, allocator_thread, NULL);
+    for (q = 0; q < NUM_QUEUES; q++) {
+        queues[q].id = q;
+        queues[q].used_count = 0;
+        queues[q].claims = 0;
+        pthread_create(&threads[q], NULL, queue_thread, &queues[q]);
+    }
+    for (q = 0; q < NUM_QUEUES; q++)
+        pthread_join(threads[q], NULL);
+    queues_running = 0;
+    pthread_join(alloc, NULL);
+    elapsed = test_now() - start;
+    
+    /* every RBD is in exactly one place */
+    total = 0;
+    for (q = 0; q < NUM_QUEUES; q++) {
+        for (i = 0; i < (int)queues[q].rx_free.size(); i++)
+            seen[queues[q].rx_free[i] - &pool[0]]++;
+        for (i = 0; i < (int)queues[q].rx_used.size(); i++)
+            seen[queues[q].rx_used[i] - &pool[0]]++;
+        total += queues[q].rx_free.size() + queues[q].rx_used.size();
+        claims += queues[q].claims;
+    }
+    total += count_chain(rba.rbd_allocated, seen, &pool[0]);
+    total += count_chain(rba.rbd_empty, seen, &pool[0]);
+    total += count_chain(rba.rbd_partial, seen, &pool[0]);
+    CHECK_EQ(total, pool_size);
+    for (i = 0; i < pool_size; i++)
+        CHECK_EQ(seen[i], 1);
+    
+    /* whatever was honored and not claimed is still on the stack */
+    CHECK_EQ(count_chain(rba.rbd_allocated, seen, &pool[0]), rba.req_ready * RX_CLAIM_REQ_ALLOC);
+    
+    printf("stress: %d queues, %ld batches claimed, %d deferred runs, %.0f claims/s\n",
+           NUM_QUEUES, claims, alloc_deferred, claims / elapsed);
+    IOSimpleLockFree(rba.lock);
+}
+
+/* a request the allocator can't fill is kept, not published short */
+static void test_short_batch(void)
+{
+    struct iwl_rx_mem_buffer pool[RX_CLAIM_REQ_ALLOC];
+    struct iwl_rx_mem_buffer *rxbs[RX_CLAIM_REQ_ALLOC];
+    unsigned seed = 0;
+    int i;
+    
+    memset(&rba, 0, sizeof(rba));
+    memset(pool, 0, sizeof(pool));
+    rba.lock = IOSimpleLockAlloc();
+    for (i = 0; i < RX_CLAIM_REQ_ALLOC; i++)
+        pool[i].owner = -1;
+    
+    for (i = 0; i < 3; i++)
+        iwl_rbd_push_chain(&rba.rbd_empty, &pool[i], &pool[i]);
+    rba.req_pending = 1;
+    
+    while (iwl_rbd_alloc_run(&rba, fill_rbd, &seed) == 0)
+        ;
+    CHECK_EQ(rba.req_ready, 0);
+    CHECK_EQ(rba.req_pending, 1);
+    CHECK_EQ(rba.partial_count, 3);
+    CHECK(rba.rbd_allocated == NULL);
+    CHECK_EQ(iwl_rbd_claim(&rba, rxbs), 0);
+    
+    /* the queue hands back the rest with its next request */
+    for (i = 3; i < RX_CLAIM_REQ_ALLOC - 1; i++)
+        pool[i].next = &pool[i + 1];
+    iwl_rbd_push_chain(&rba.rbd_empty, &pool[3], &pool[RX_CLAIM_REQ_ALLOC - 1]);
+    CHECK_EQ(iwl_rbd_alloc_run(&rba, fill_rbd, &seed), 0);
+    CHECK_EQ(rba.req_ready, 1);
+    CHECK_EQ(rba.req_pending, 0);
+    CHECK(rba.rbd_partial == NULL);
+    CHECK_EQ(iwl_rbd_claim(&rba, rxbs), RX_CLAIM_REQ_ALLOC);
+    for (i = 0; i < RX_CLAIM_REQ_ALLOC; i++)
+        CHECK(rxbs[i]->filled);
+    CHECK_EQ(iwl_rbd_claim(&rba, rxbs), 0);
+    IOSimpleLockFree(rba.lock);
+}
+
+int main(void)
+{
+    test_short_batch();
+    test_stress();
+    return test_result("rbd_stack");
+}
@@ -0,0 +1,47 @@
+//
+//  IOLocks.h
+//  IntelWifiTests
+//
+//  Host stand-in for the kernel <IOKit/IOLocks.h>: IOSimpleLock and IOLock
+//  are both pthread mutexes here.
+//
+
+#ifndef shim_IOLocks_h
+#define shim_IOLocks_h
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef pthread_mutex_t IOSimpleLock;
+typedef pthread_mutex_t IOLock;
+
+static inline IOSimpleLock *IOSimpleLockAlloc(void)
+{
+    IOSimpleLock *lock = (IOSimpleLock *)malloc(sizeof(*lock));
+    
+    pthread_mutex_init(lock, NULL);
+    return lock;
+}
+
+static inline void IOSimpleLockFree(IOSimpleLock *lock)
+{
+    pthread_mutex_destroy(lock);
+    free(lock);
+}
+
+static inline void IOSimpleLockLock(IOSimpleLock *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+static inline void IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+#define IOLockAlloc IOSimpleLockAlloc
+#define IOLockFree IOSimpleLockFree
+#define IOLockLock IOSimpleLockLock
+#define IOLockUnlock IOSimpleLockUnlock
+
+#endif /* shim_IOLocks_h */
@@ -0,0 +1,19 @@
+//
+//  IOTypes.h
+//  IntelWifiTests
+//
+//  Host stand-in for the kernel <IOKit/IOTypes.h>.
+//
+
+#ifndef shim_IOTypes_h
+#define shim_IOTypes_h
+
+#include <libkern/OSTypes.h>
+
+typedef UInt32 IOOptionBits;
+typedef int IOReturn;
+typedef UInt64 IOPhysicalAddress64;
+
+#define kIOReturnSuccess 0
+
+#endif /* shim_IOTypes_h */
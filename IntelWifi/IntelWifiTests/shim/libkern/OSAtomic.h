@@ -0,0 +1,47 @@
+//
+//  OSAtomic.h
+//  IntelWifiTests
+//
+//  Host stand-in for the kernel <libkern/OSAtomic.h> on top of the compiler
+//  builtins. Only the calls used by the driver are provided. Like the kernel
+//  header, the macros cast the address argument.
+//
+
+#ifndef shim_OSAtomic_h
+#define shim_OSAtomic_h
+
+#include <libkern/OSTypes.h>
+
+static inline Boolean __OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+static inline Boolean __OSCompareAndSwap64(UInt64 oldValue, UInt64 newValue, volatile UInt64 *address)
+{
+    return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+static inline Boolean __OSCompareAndSwapPtr(void *oldValue, void *newValue, void * volatile *address)
+{
+    return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+static inline SInt32 __OSAddAtomic(SInt32 amount, volatile SInt32 *address)
+{
+    return __sync_fetch_and_add(address, amount);
+}
+
+#define OSCompareAndSwap(o, n, a) __OSCompareAndSwap(o, n, (volatile UInt32 *)(a))
+#define OSCompareAndSwap64(o, n, a) __OSCompareAndSwap64(o, n, (volatile UInt64 *)(a))
+#define OSCompareAndSwapPtr(o, n, a) __OSCompareAndSwapPtr((void *)(o), (void *)(n), (void * volatile *)(a))
+#define OSAddAtomic(n, a) __OSAddAtomic(n, (volatile SInt32 *)(a))
+#define OSIncrementAtomic(a) __OSAddAtomic(1, (volatile SInt32 *)(a))
+#define OSDecrementAtomic(a) __OSAddAtomic(-1, (volatile SInt32 *)(a))
+
+static inline void OSMemoryBarrier(void)
+{
+    __sync_synchronize();
+}
+
+#endif /* shim_OSAtomic_h */
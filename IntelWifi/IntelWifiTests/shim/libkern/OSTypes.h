@@ -0,0 +1,26 @@
+//
+//  OSTypes.h
+//  IntelWifiTests
+//
+//  Host stand-in for the kernel <libkern/OSTypes.h>, so the port headers
+//  compile in the host-side tests.
+//
+
+#ifndef shim_OSTypes_h
+#define shim_OSTypes_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint8_t  UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int8_t   SInt8;
+typedef int16_t  SInt16;
+typedef int32_t  SInt32;
+typedef int64_t  SInt64;
+typedef unsigned char Boolean;
+
+#endif /* shim_OSTypes_h */
@@ -0,0 +1,52 @@
+//
+//  test_util.h
+//  IntelWifiTests
+//
+//  Host-side tests for the parts of the driver that don't touch the device.
+//  Every *_test.cpp is a program of its own, built against the headers in
+//  shim/ instead of the kernel ones, see the test target of the makefile.
+//
+
+#ifndef test_util_h
+#define test_util_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long _a = (long long)(a), _b = (long long)(b); \
+    if (_a != _b) { \
+        fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, _a, _b); \
+        test_failures++; \
+    } \
+} while (0)
+
+static inline double test_now(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* keeps the optimizer from dropping a benchmarked computation */
+static volatile unsigned long long test_sink;
+
+static inline int test_result(const char *name)
+{
+    printf("%s: %s\n", name, test_failures ? "FAIL" : "PASS");
+    return test_failures ? 1 : 0;
+}
+
+#endif /* test_util_h */
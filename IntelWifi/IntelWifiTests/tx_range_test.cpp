@@ -0,0 +1,248 @@
+//
+//  tx_range_test.cpp
+//  IntelWifiTests
+//
+//  Microbenchmark of the reclaim reset (iw_utils/tx_range.h) against the
+//  per-entry loop it replaced, which invalidated the byte count from the
+//  station id of each TX command and reset each TFD on its own, the way
+//  iwl_pcie_txq_inval_byte_cnt_tbl() and iwl_pcie_tfd_unmap() do. Both have
+//  to leave the byte count table and the TFDs in the same state, wraps of
+//  the ring and of the duplicated head of the table included.
+//
+
+#include <string.h>
+
+#include "test_util.h"
+
+#include <linux/types.h>
+
+/* from linux/kernel.h */
+#define min_t(type, x, y) \
+({ type __x = (x); type __y = (y); __x < __y ? __x : __y; })
+
+/* from iwlwifi/iwl-fh.h */
+#define TFD_QUEUE_SIZE_MAX 256
+#define TFD_QUEUE_SIZE_BC_DUP 64
+#define TFD_QUEUE_BC_SIZE (TFD_QUEUE_SIZE_MAX + TFD_QUEUE_SIZE_BC_DUP)
+#define IWL_NUM_OF_TBS 20
+#define IWL_TFH_NUM_TBS 25
+
+struct iwl_tfd_tb {
+    __le32 lo;
+    __le16 hi_n_len;
+} __attribute__((packed));
+
+struct iwl_tfh_tb {
+    __le16 tb_len;
+    __le64 addr;
+} __attribute__((packed));
+
+struct iwl_tfd {
+    u8 __reserved1[3];
+    u8 num_tbs;
+    struct iwl_tfd_tb tbs[IWL_NUM_OF_TBS];
+    __le32 __pad;
+} __attribute__((packed));
+
+struct iwl_tfh_tfd {
+    __le16 num_tbs;
+    struct iwl_tfh_tb tbs[IWL_TFH_NUM_TBS];
+    __le32 __pad;
+} __attribute__((packed));
+
+#include "iw_utils/tx_range.h"
+
+/* a TX command buffer per slot, sta_id at its place in struct iwl_tx_cmd */
+#define CMD_SIZE 320
+#define CMD_STA_ID_OFFS 44
+
+#define RECLAIM_RUNS 200000
+
+struct ring {
+    bool use_tfh;
+    u16 tfd_size;
+    int n_window;
+    u8 *tfds;
+    __le16 bc[TFD_QUEUE_BC_SIZE];
+    u8 *cmds[TFD_QUEUE_SIZE_MAX];
+};
+
+static void *ring_get_tfd(struct ring *r, int idx)
+{
+    return r->tfds + r->tfd_size * (idx & (r->n_window - 1));
+}
+
+/* what the TX path leaves behind for a frame on slot @idx */
+static void ring_fill(struct ring *r, int idx, unsigned *seed)
+{
+    u8 sta_id = rand_r(seed) & 0xf;
+    u16 len = 1 + rand_r(seed) % 0xfff;
+    __le16 bc_ent = cpu_to_le16(len | (sta_id << 12));
+    
+    r->cmds[idx][CMD_STA_ID_OFFS] = sta_id;
+    r->bc[idx] = bc_ent;
+    if (idx < TFD_QUEUE_SIZE_BC_DUP)
+        r->bc[TFD_QUEUE_SIZE_MAX + idx] = bc_ent;
+    if (r->use_tfh)
+        ((struct iwl_tfh_tfd *)ring_get_tfd(r, idx))->num_tbs = cpu_to_le16(3);
+    else
+        ((struct iwl_tfd *)ring_get_tfd(r, idx))->num_tbs = 3;
+}
+
+/* the per-entry reset of the reclaim loop before the range helpers */
+static void reset_per_entry(struct ring *r, int first, int count)
+{
+    int idx;
+    
+    for (idx = first; count--; idx = (idx + 1) & (TFD_QUEUE_SIZE_MAX - 1)) {
+        u8 sta_id = r->cmds[idx][CMD_STA_ID_OFFS];
+        __le16 bc_ent = cpu_to_le16(1 | (sta_id << 12));
+        void *tfd = ring_get_tfd(r, idx);
+        
+        r->bc[idx] = bc_ent;
+        if (idx < TFD_QUEUE_SIZE_BC_DUP)
+            r->bc[TFD_QUEUE_SIZE_MAX + idx] = bc_ent;
+        
+        /* the sanity check on the number of chunks reads the TFD first */
+        if (r->use_tfh) {
+            test_sink += le16_to_cpu(((struct iwl_tfh_tfd *)tfd)->num_tbs) & 0x1f;
+            ((struct iwl_tfh_tfd *)tfd)->num_tbs = 0;
+        } else {
+            test_sink += ((struct iwl_tfd *)tfd)->num_tbs & 0x1f;
+            ((struct iwl_tfd *)tfd)->num_tbs = 0;
+        }
+    }
+}
+
+/* iwl_pcie_txq_inval_byte_cnt_range() and iwl_pcie_tfd_reset_range() */
+static void reset_range(struct ring *r, int first, int count)
+{
+    iwl_pcie_bc_inval_range(r->bc, first, count);
+    while (count > 0) {
+        int n = min_t(int, count, TFD_QUEUE_SIZE_MAX - first);
+        
+        iwl_pcie_tfd_clear(ring_get_tfd(r, first), r->tfd_size, r->use_tfh, n);
+        count -= n;
+        first = 0;
+    }
+}
+
+static void ring_init(struct ring *r, bool use_tfh)
+{
+    int i;
+    
+    memset(r, 0, sizeof(*r));
+    r->use_tfh = use_tfh;
+    r->tfd_size = use_tfh ? sizeof(struct iwl_tfh_tfd) : sizeof(struct iwl_tfd);
+    r->n_window = TFD_QUEUE_SIZE_MAX;
+    r->tfds = (u8 *)calloc(TFD_QUEUE_SIZE_MAX, r->tfd_size);
+    for (i = 0; i < TFD_QUEUE_SIZE_MAX; i++)
+        r->cmds[i] = (u8 *)calloc(1, CMD_SIZE);
+}
+
+static void ring_free(struct ring *r)
+{
+    int i;
+    
+    free(r->tfds);
+    for (i = 0; i < TFD_QUEUE_SIZE_MAX; i++)
+        free(r->cmds[i]);
+}
+
+/*
+ * Reclaims of 1 to 64 frames walk around the ring, as block acks do. Each
+ * lap the whole ring is filled with the same frames on both rings and the
+ * resets of the lap are timed together.
+ */
+static void bench(bool use_tfh)
+{
+    struct ring *old_r = (struct ring *)malloc(sizeof(*old_r));
+    struct ring *new_r = (struct ring *)malloc(sizeof(*new_r));
+    int firsts[TFD_QUEUE_SIZE_MAX], counts[TFD_QUEUE_SIZE_MAX];
+    double t_old = 0, t_new = 0, start;
+    unsigned seed = 1;
+    long entries = 0;
+    int first = 0, run = 0, i, n, lap;
+    
+    ring_init(old_r, use_tfh);
+    ring_init(new_r, use_tfh);
+    
+    while (run < RECLAIM_RUNS) {
+        unsigned s1 = seed, s2 = seed;
+        
+        for (i = 0; i < TFD_QUEUE_SIZE_MAX; i++) {
+            ring_fill(old_r, i, &s1);
+            ring_fill(new_r, i, &s2);
+        }
+        seed = s1;
+        
+        for (n = 0, lap = 0; lap < TFD_QUEUE_SIZE_MAX; n++) {
+            int count = min_t(int, 1 + rand_r(&seed) % 64, TFD_QUEUE_SIZE_MAX - lap);
+            
+            firsts[n] = first;
+            counts[n] = count;
+            lap += count;
+            first = (first + count) & (TFD_QUEUE_SIZE_MAX - 1);
+        }
+        run += n;
+        entries += TFD_QUEUE_SIZE_MAX;
+        
+        start = test_now();
+        for (i = 0; i < n; i++)
+            reset_per_entry(old_r, firsts[i], counts[i]);
+        t_old += test_now() - start;
+        
+        start = test_now();
+        for (i = 0; i < n; i++)
+            reset_range(new_r, firsts[i], counts[i]);
+        t_new += test_now() - start;
+        
+        CHECK(!memcmp(old_r->bc, new_r->bc, sizeof(old_r->bc)));
+        CHECK(!memcmp(old_r->tfds, new_r->tfds, TFD_QUEUE_SIZE_MAX * old_r->tfd_size));
+    }
+    
+    printf("%-6s TFDs: per entry %.2f ns/entry, range %.2f ns/entry\n", use_tfh ? "TFH" : "legacy",
+           t_old * 1e9 / entries, t_new * 1e9 / entries);
+    
+    ring_free(old_r);
+    ring_free(new_r);
+    free(old_r);
+    free(new_r);
+}
+
+/* a range crossing the end of the ring resets both parts, and nothing else */
+static void test_wrap(void)
+{
+    struct ring *r = (struct ring *)malloc(sizeof(*r));
+    __le16 bc[TFD_QUEUE_BC_SIZE];
+    unsigned seed = 7;
+    int i;
+    
+    ring_init(r, false);
+    for (i = 0; i < TFD_QUEUE_SIZE_MAX; i++)
+        ring_fill(r, i, &seed);
+    memcpy(bc, r->bc, sizeof(bc));
+    
+    reset_range(r, TFD_QUEUE_SIZE_MAX - 10, 20);
+    for (i = 0; i < TFD_QUEUE_SIZE_MAX; i++) {
+        bool reset = i >= TFD_QUEUE_SIZE_MAX - 10 || i < 10;
+        u16 expected = reset ? (le16_to_cpu(bc[i]) & 0xf000) | 1 : le16_to_cpu(bc[i]);
+        
+        CHECK_EQ(((struct iwl_tfd *)ring_get_tfd(r, i))->num_tbs, reset ? 0 : 3);
+        CHECK_EQ(le16_to_cpu(r->bc[i]), expected);
+        CHECK_EQ(le16_to_cpu(r->bc[i]) >> 12, r->cmds[i][CMD_STA_ID_OFFS]);
+    }
+    for (i = 0; i < TFD_QUEUE_SIZE_BC_DUP; i++)
+        CHECK_EQ(r->bc[TFD_QUEUE_SIZE_MAX + i], r->bc[i]);
+    
+    ring_free(r);
+    free(r);
+}
+
+int main(void)
+{
+    test_wrap();
+    bench(false);
+    bench(true);
+    return test_result("tx_range");
+}
@@ -0,0 +1,307 @@
+//
+//  tx_tbs_test.cpp
+//  IntelWifiTests
+//
+//  Runs the TB planning of the data TX path (iw_utils/tx_tbs.h) on a mock
+//  TFD ring with synthetic mbuf chains. The chains live in memory with a
+//  random virtual to physical mapping. A mock of IOMbufNaturalMemoryCursor
+//  turns them into physical segments, which become the TBs of the TFD as in
+//  iwl_fill_data_tbs(). Every TB has to fit its 12 bit length field, the
+//  TBs have to cover the payload behind the 802.11 header exactly, and
+//  iwl_tx_max_tbs() must never under-estimate. The packet rate is printed
+//  for small, Ethernet sized and jumbo frames.
+//
+
+#include <string.h>
+
+#include "test_util.h"
+
+#include <linux/types.h>
+
+/* from linux/kernel.h */
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define min_t(type, x, y) \
+({ type __x = (x); type __y = (y); __x < __y ? __x : __y; })
+
+/* from iwlwifi/pcie/internal.h */
+#define IWL_TX_SEG_MAX_SIZE 2048
+
+#include "iw_utils/tx_tbs.h"
+
+#define PAGE_SIZE 4096
+#define ARENA_PAGES 4096
+#define TFD_QUEUE_SIZE_MAX 256
+#define IWL_NUM_OF_TBS 20
+#define RECLAIM_BATCH 64
+#define PACKETS 2000000
+#define POOL 1024
+
+/* the TB layout of struct iwl_tfd in iwlwifi/iwl-fh.h */
+struct mock_tb {
+    __le32 lo;
+    __le16 hi_n_len;
+} __attribute__((packed));
+
+struct mock_tfd {
+    u8 __reserved1[3];
+    u8 num_tbs;
+    struct mock_tb tbs[IWL_NUM_OF_TBS];
+    __le32 __pad;
+} __attribute__((packed));
+
+struct mock_seg {
+    u64 location;
+    u32 length;
+};
+
+struct mock_mbuf {
+    u32 off;        /* virtual offset of the data in the arena */
+    u32 len;
+    struct mock_mbuf *next;
+};
+
+struct mock_pkt {
+    struct mock_mbuf m[4];
+    u32 len;
+    u8 hdr_len;
+};
+
+static u64 page_phys[ARENA_PAGES];
+
+/* a quarter of the pages follow the previous one in physical memory */
+static void arena_init(unsigned *seed)
+{
+    int i;
+    
+    for (i = 0; i < ARENA_PAGES; i++) {
+        if (i && !(rand_r(seed) & 3))
+            page_phys[i] = page_phys[i - 1] + PAGE_SIZE;
+        else
+            page_phys[i] = (u64)(rand_r(seed) % (1 << 20)) * PAGE_SIZE * 2;
+    }
+}
+
+static u64 virt_to_phys(u32 off)
+{
+    return page_phys[off / PAGE_SIZE] + off % PAGE_SIZE;
+}
+
+/*
+ * IOMbufNaturalMemoryCursor: physically contiguous data is coalesced, also
+ * across mbufs, up to @max_seg bytes per segment. Returns 0 if the chain
+ * doesn't fit in @max_segs segments.
+ */
+static u32 cursor_segments(struct mock_mbuf *m, struct mock_seg *segs, u32 max_segs, u32 max_seg)
+{
+    u32 n = 0;
+    
+    for (; m; m = m->next) {
+        u32 off = m->off, left = m->len;
+        
+        while (left) {
+            u32 piece = min_t(u32, left, PAGE_SIZE - off % PAGE_SIZE);
+            u64 phys = virt_to_phys(off);
+            
+            while (piece) {
+                u32 take;
+                
+                if (n && segs[n - 1].location + segs[n - 1].length == phys &&
+                    segs[n - 1].length < max_seg) {
+                    take = min_t(u32, piece, max_seg - segs[n - 1].length);
+                    segs[n - 1].length += take;
+                } else {
+                    if (n == max_segs)
+                        return 0;
+                    take = min_t(u32, piece, max_seg);
+                    segs[n].location = phys;
+                    segs[n].length = take;
+                    n++;
+                }
+                phys += take;
+                off += take;
+                piece -= take;
+                left -= take;
+            }
+        }
+    }
+    return n;
+}
+
+/* iwl_pcie_mbuf_max_tbs() */
+static u32 mbuf_max_tbs(struct mock_mbuf *m, u32 skip)
+{
+    u32 n_tbs = 0;
+    
+    for (; m; m = m->next) {
+        u32 len = m->len;
+        
+        if (skip >= len) {
+            skip -= len;
+            continue;
+        }
+        len -= skip;
+        skip = 0;
+        n_tbs += iwl_tx_max_tbs(len);
+    }
+    return n_tbs;
+}
+
+struct mock_ring {
+    struct mock_tfd tfds[TFD_QUEUE_SIZE_MAX];
+    int write_ptr;
+    int read_ptr;
+    long tbs;
+};
+
+/* iwl_fill_data_tbs() on the TFD at write_ptr, TB0 and TB1 are the TX command */
+static int ring_tx(struct mock_ring *r, struct mock_pkt *p, bool verify)
+{
+    struct mock_seg segs[IWL_NUM_OF_TBS];
+    struct mock_tfd *tfd = &r->tfds[r->write_ptr];
+    u32 skip = p->hdr_len, covered = 0;
+    u32 nsegs, i;
+    
+    /* reclaim a block ack worth of frames when the ring is full */
+    if (((r->write_ptr + 1) & (TFD_QUEUE_SIZE_MAX - 1)) == r->read_ptr) {
+        for (i = 0; i < RECLAIM_BATCH; i++) {
+            r->tfds[r->read_ptr].num_tbs = 0;
+            r->read_ptr = (r->read_ptr + 1) & (TFD_QUEUE_SIZE_MAX - 1);
+        }
+    }
+    
+    tfd->num_tbs = 2;
+    nsegs = cursor_segments(&p->m[0], segs, IWL_NUM_OF_TBS - 2, IWL_TX_SEG_MAX_SIZE);
+    if (!nsegs)
+        return -1;
+    
+    for (i = 0; i < nsegs; i++) {
+        u64 tb_phys = segs[i].location;
+        u32 tb_len = segs[i].length;
+        struct mock_tb *tb;
+        
+        if (!iwl_tx_skip_seg(&skip, &tb_phys, &tb_len))
+            continue;
+        
+        /* iwl_pcie_tfd_set_tb() */
+        tb = &tfd->tbs[tfd->num_tbs++];
+        tb->lo = cpu_to_le32((u32)tb_phys);
+        tb->hi_n_len = cpu_to_le16((u16)(((tb_phys >> 32) & 0xf) | (tb_len << 4)));
+        
+        if (verify) {
+            CHECK(tb_len <= 0xfff);
+            CHECK_EQ(le16_to_cpu(tb->hi_n_len) >> 4, tb_len);
+        }
+        covered += tb_len;
+    }
+    
+    if (verify) {
+        CHECK_EQ(covered, p->len - p->hdr_len);
+        CHECK(tfd->num_tbs - 2u <= mbuf_max_tbs(&p->m[0], p->hdr_len));
+    }
+    
+    r->tbs += tfd->num_tbs;
+    r->write_ptr = (r->write_ptr + 1) & (TFD_QUEUE_SIZE_MAX - 1);
+    return 0;
+}
+
+static u32 arena_alloc(unsigned *seed, u32 len, u32 align)
+{
+    u32 slots = (ARENA_PAGES * PAGE_SIZE - len) / align;
+    
+    return (rand_r(seed) % slots) * align;
+}
+
+/* an 802.11 header mbuf and the payload in clusters of @cluster bytes */
+static void make_pkt(struct mock_pkt *p, u32 len, u32 cluster, unsigned *seed)
+{
+    u32 head = min_t(u32, len, 128);
+    int n = 0;
+    
+    memset(p, 0, sizeof(*p));
+    p->len = len;
+    p->hdr_len = 26;
+    
+    p->m[n].off = arena_alloc(seed, head, 256) + 32;
+    p->m[n].len = head;
+    len -= head;
+    while (len) {
+        u32 l = min_t(u32, len, cluster);
+        
+        p->m[n].next = &p->m[n + 1];
+        n++;
+        p->m[n].off = arena_alloc(seed, cluster, cluster);
+        p->m[n].len = l;
+        len -= l;
+    }
+}
+
+static void bench(const char *name, u32 len, u32 cluster)
+{
+    static struct mock_pkt pool[POOL];
+    static struct mock_ring ring;
+    unsigned seed = len;
+    double start, elapsed;
+    long i, dropped = 0;
+    
+    for (i = 0; i < POOL; i++) {
+        make_pkt(&pool[i], len, cluster, &seed);
+        /* the frames are checked once outside of the timed loop */
+        CHECK_EQ(ring_tx(&ring, &pool[i], true), 0);
+    }
+    
+    memset(&ring, 0, sizeof(ring));
+    start = test_now();
+    for (i = 0; i < PACKETS; i++)
+        dropped += ring_tx(&ring, &pool[i & (POOL - 1)], false) ? 1 : 0;
+    elapsed = test_now() - start;
+    test_sink += ring.tbs;
+    CHECK_EQ(dropped, 0);
+    
+    printf("%-10s %5u bytes: %6.2f Mpps, %.1f TBs per frame\n", name, len,
+           PACKETS / elapsed / 1e6, (double)ring.tbs / PACKETS);
+}
+
+/*
+ * The bound holds for a single mbuf at every start in a page and every
+ * length over discontiguous pages. With 4095 byte segments, the largest
+ * length of the field, whole pages would take two TBs and the length alone
+ * couldn't bound them.
+ */
+static void test_bound(void)
+{
+    struct mock_seg segs[64];
+    struct mock_mbuf m;
+    u32 off, len, n, over_4095 = 0;
+    
+    for (n = 0; n < 8; n++)
+        page_phys[n] = (u64)(2 * n + 1) * PAGE_SIZE * 2;
+    
+    for (off = 0; off < PAGE_SIZE; off += 7) {
+        for (len = 1; len <= 3 * PAGE_SIZE; len += 13) {
+            memset(&m, 0, sizeof(m));
+            m.off = off;
+            m.len = len;
+            
+            n = cursor_segments(&m, segs, 64, IWL_TX_SEG_MAX_SIZE);
+            CHECK(n && n <= iwl_tx_max_tbs(len));
+            
+            n = cursor_segments(&m, segs, 64, 4095);
+            if (n > DIV_ROUND_UP(len, 4095) + 1)
+                over_4095++;
+        }
+    }
+    printf("bound: %u of the layouts exceed it with 4095 byte segments\n", over_4095);
+    CHECK(over_4095 > 0);
+}
+
+int main(void)
+{
+    unsigned seed = 1;
+    
+    test_bound();
+    arena_init(&seed);
+    bench("tcp ack", 90, 2048);
+    bench("ethernet", 1526, 2048);
+    bench("jumbo", 9026, 4096);
+    return test_result("tx_tbs");
+}
@@ -9,11 +9,43 @@
 #define kext_user_shared_h
 
 
+#include <stdint.h>
+
 // User client method dispatch selectors.
 enum {
     kIwlClientScan,
+    kIwlClientTxStats,
+    kIwlClientTxQueues,
     
     kNumberOfMethods // Must be last
 };
 
+// Output structure of kIwlClientTxStats
+struct iwl_client_tx_stats {
+    uint64_t packets;       // frames put on the data queues
+    uint64_t doorbells;     // write pointer updates for data queues
+    uint64_t deferred;      // frames whose write pointer update was batched
+    uint64_t amsdus;        // A-MSDUs built by the driver
+    uint64_t amsdu_subframes; // MSDUs sent inside those A-MSDUs
+    uint64_t reclaimed;     // frames freed after TX completion
+    uint64_t reclaims;      // batches those frames were freed in
+    uint64_t overflowed;    // frames held back while a queue was full
+    uint64_t overflow_drops; // frames refused because the overflow queue was full
+    uint32_t overflow_max_depth; // deepest an overflow queue has been
+};
+
+#define IWL_CLIENT_MAX_TXQS 32
+
+// Output structure of kIwlClientTxQueues
+struct iwl_client_txq_stats {
+    uint32_t n_queues;
+    struct {
+        uint32_t id;
+        uint32_t used;              // TFDs on the ring
+        uint32_t bql_limit;         // current in-flight byte limit
+        uint32_t bql_inflight;      // bytes on the ring
+        uint32_t overflow_depth;    // frames waiting for room
+    } queues[IWL_CLIENT_MAX_TXQS];
+};
+
 #endif /* kext_user_shared_h */
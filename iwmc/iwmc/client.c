@@ -98,3 +98,25 @@ void iwmc_scan(struct iwmc_client* client) {
     struct iwmc_priv *priv = IWMC_PRIV(client);
     IOConnectCallScalarMethod(priv->data_port, kIwlClientScan, 0, 0, 0, 0);
 }
+
+/**
+ * Read TX statistics of the data queues
+ */
+int iwmc_tx_stats(struct iwmc_client* client, struct iwl_client_tx_stats *stats) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    size_t size = sizeof(*stats);
+    
+    kern_return_t kern_result = IOConnectCallStructMethod(priv->data_port, kIwlClientTxStats, NULL, 0, stats, &size);
+    return kern_result == KERN_SUCCESS ? 0 : -1;
+}
+
+/**
+ * Read the state of every active data queue
+ */
+int iwmc_txq_stats(struct iwmc_client* client, struct iwl_client_txq_stats *stats) {
+    struct iwmc_priv *priv = IWMC_PRIV(client);
+    size_t size = sizeof(*stats);
+    
+    kern_return_t kern_result = IOConnectCallStructMethod(priv->data_port, kIwlClientTxQueues, NULL, 0, stats, &size);
+    return kern_result == KERN_SUCCESS ? 0 : -1;
+}
@@ -11,6 +11,8 @@
 
 #include <stdio.h>
 
+#include "kext_user_shared.h"
+
 struct iwmc_client {
     void *priv;
 };
@@ -26,6 +28,8 @@ void iwmc_free(struct iwmc_client* client);
  * Commands
  */
 void iwmc_scan(struct iwmc_client* client);
+int iwmc_tx_stats(struct iwmc_client* client, struct iwl_client_tx_stats *stats);
+int iwmc_txq_stats(struct iwmc_client* client, struct iwl_client_txq_stats *stats);
 
 
 #endif /* client_h */
@@ -15,6 +15,8 @@
  * Commands
  */
 #define IWMC_CMD_SCAN "scan"
+#define IWMC_CMD_TXSTATS "txstats"
+#define IWMC_CMD_TXQUEUES "txqueues"
 
 
 #endif /* constants_h */
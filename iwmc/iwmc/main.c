@@ -21,7 +21,7 @@
 int main(int argc, const char * argv[]) {
     
     if (argc < 2) {
-        error("Provide command. Available commands: scan\n");
+        error("Provide command. Available commands: scan, txstats, txqueues\n");
         return 1;
     }
     
@@ -36,6 +36,41 @@ int main(int argc, const char * argv[]) {
     if (strcmp(cmd_name, IWMC_CMD_SCAN) == 0) {
         iwmc_scan(client);
         log("Scan command sent to client");
+    } else if (strcmp(cmd_name, IWMC_CMD_TXSTATS) == 0) {
+        struct iwl_client_tx_stats stats;
+        
+        if (iwmc_tx_stats(client, &stats)) {
+            error("Failed to read TX statistics\n");
+        } else {
+            printf("packets:   %llu\n", stats.packets);
+            printf("doorbells: %llu\n", stats.doorbells);
+            printf("deferred:  %llu\n", stats.deferred);
+            printf("doorbells per packet: %.3f\n",
+                   stats.packets ? (double)stats.doorbells / stats.packets : 0.0);
+            printf("amsdus:    %llu\n", stats.amsdus);
+            printf("subframes per amsdu: %.3f\n",
+                   stats.amsdus ? (double)stats.amsdu_subframes / stats.amsdus : 0.0);
+            printf("reclaimed: %llu\n", stats.reclaimed);
+            printf("frames per reclaim: %.3f\n",
+                   stats.reclaims ? (double)stats.reclaimed / stats.reclaims : 0.0);
+            printf("overflowed: %llu (max depth %u)\n", stats.overflowed, stats.overflow_max_depth);
+            printf("overflow drops: %llu\n", stats.overflow_drops);
+        }
+    } else if (strcmp(cmd_name, IWMC_CMD_TXQUEUES) == 0) {
+        struct iwl_client_txq_stats stats;
+        uint32_t i;
+        
+        if (iwmc_txq_stats(client, &stats)) {
+            error("Failed to read TX queues\n");
+        } else {
+            printf("queue  used  limit     in-flight  overflow\n");
+            for (i = 0; i < stats.n_queues; i++) {
+                printf("%5u  %4u  %8u  %9u  %8u\n",
+                       stats.queues[i].id, stats.queues[i].used,
+                       stats.queues[i].bql_limit, stats.queues[i].bql_inflight,
+                       stats.queues[i].overflow_depth);
+            }
+        }
     }
     
     iwmc_free(client);